@@ -0,0 +1,315 @@
+// Benchmarks of the hot kernels and of gen() as a whole, see the Readme.
+// Results are written as JSON so they can be compared across commits.
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cacheWriter.hpp"
+#include "canonical.hpp"
+#include "cmdparser.hpp"
+#include "cubes.hpp"
+#include "hashes.hpp"
+#include "newCache.hpp"
+#include "packedCube.hpp"
+#include "rotations.hpp"
+#include "workPool.hpp"
+
+#ifndef CUBES_GIT_REVISION
+#define CUBES_GIT_REVISION "unknown"
+#endif
+
+struct Result {
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> params;
+    uint64_t items = 0;            // processed per repetition
+    std::vector<double> seconds;  // by repetition
+
+    double best() const { return *std::min_element(seconds.begin(), seconds.end()); }
+    double median() const {
+        auto s = seconds;
+        std::sort(s.begin(), s.end());
+        return s[s.size() / 2];
+    }
+};
+
+static std::vector<Result> results;
+static int reps = 3;
+// keeps the compiler from dropping the loops that only read
+static volatile uint64_t sink;
+
+// runs prepare (not timed) and then body reps times. body returns the items it processed.
+static void measure(const std::string &name, std::vector<std::pair<std::string, std::string>> params, std::function<uint64_t()> body,
+                    std::function<void()> prepare = {}) {
+    Result r{name, std::move(params), 0, {}};
+    for (int i = 0; i < reps; ++i) {
+        if (prepare) prepare();
+        auto start = std::chrono::steady_clock::now();
+        r.items = body();
+        r.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::printf("bench %-10s", name.c_str());
+    for (auto &[k, v] : r.params) std::printf(" %s=%s", k.c_str(), v.c_str());
+    std::printf(": %.3f s, %.2f M items/s\n\r", r.best(), r.items / r.best() / 1e6);
+    results.push_back(std::move(r));
+}
+
+static std::vector<int> threadCounts(int maxThreads) {
+    std::vector<int> out;
+    for (int t = 1; t < maxThreads; t *= 2) out.push_back(t);
+    out.push_back(maxThreads);
+    return out;
+}
+
+// every cube of a set, unpacked, with the shape it was stored under
+struct CubeList {
+    int n = 0;
+    std::vector<XYZ> points;
+    std::vector<XYZ> shapes;
+    size_t size() const { return shapes.size(); }
+    const XYZ *cube(size_t i) const { return points.data() + i * n; }
+};
+
+static CubeList listCubes(Hashy &hashes, int n) {
+    CubeList list;
+    list.n = n;
+    for (auto &[shape, set] : hashes.byshape)
+        for (auto &subset : set.byhash)
+            for (auto cube : subset.set) {
+                list.points.resize(list.points.size() + n);
+                cube.unpack(list.points.data() + list.points.size() - n);
+                list.shapes.push_back(shape);
+            }
+    return list;
+}
+
+static void benchCanonical(const CubeList &cubes) {
+    const int n = cubes.n;
+    // the rotate and sort of every valid rotation the canonical engines replaced
+    measure("rotate", {{"n", std::to_string(n)}}, [&]() {
+        Cube in(n), rotated(n);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < cubes.size(); ++i) {
+            std::copy(cubes.cube(i), cubes.cube(i) + n, in.data());
+            for (int r = 0; r < 24; ++r) {
+                if (!Rotations::rotate(r, cubes.shapes[i], in, rotated).second) continue;
+                std::sort(rotated.begin(), rotated.end());
+                sum += (uint32_t)rotated.data()[0];
+            }
+        }
+        sink = sum;
+        return cubes.size();
+    });
+    for (auto &engine : Canonical::engines()) {
+        if (!engine.supported()) continue;
+        measure("canonical", {{"n", std::to_string(n)}, {"engine", engine.name}}, [&]() {
+            std::vector<XYZ> out(n);
+            for (size_t i = 0; i < cubes.size(); ++i) engine.canonicalize(cubes.cube(i), n, cubes.shapes[i], out.data());
+            return cubes.size();
+        });
+    }
+}
+
+static void benchInsert(const CubeList &cubes, int maxThreads) {
+    const int n = cubes.n;
+    const size_t words = packedWords(n);
+    std::vector<uint64_t> keys(cubes.size() * words);
+    for (size_t i = 0; i < cubes.size(); ++i) packXYZs(cubes.cube(i), n, keys.data() + i * words);
+    for (int threads : threadCounts(maxThreads)) {
+        WorkPool pool(threads);
+        Hashy hashes;
+        measure(
+            "insert", {{"n", std::to_string(n)}, {"threads", std::to_string(threads)}},
+            [&]() {
+                pool.submit(cubes.size(), [&](size_t begin, size_t end, int) {
+                    for (size_t i = begin; i < end; ++i) hashes.byshape[cubes.shapes[i]].insert(keys.data() + i * words, n);
+                });
+                pool.wait();
+                return cubes.size();
+            },
+            [&]() {
+                hashes = Hashy();
+                hashes.init(n, Hashy::shardBits(threads, cubes.size() / Hashy::generateShapes(n).size()));
+            });
+    }
+}
+
+static void benchScan(Hashy &hashes, int n, const std::string &dir) {
+    const std::string path = dir + "cubes_" + std::to_string(n) + ".bin";
+    std::vector<XYZ> shapes;
+    for (auto &[shape, set] : hashes.byshape) shapes.push_back(shape);
+    CacheWriter writer;
+    if (!writer.open(path, n, shapes)) exit(-1);
+    for (auto &[shape, set] : hashes.byshape) writer.writeShape(shape, set);
+    writer.close();
+    CacheReader reader;
+    if (reader.loadFile(path) != 0) exit(-1);
+    const uint64_t bytes = reader.size() * n * sizeof(XYZ);
+    // the file is mapped and in the page cache, so this is the scan over the mapping
+    measure("scan", {{"n", std::to_string(n)}, {"bytes", std::to_string(bytes)}}, [&]() {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < reader.numShapes(); ++i) {
+            auto range = reader.getCubesByShape(i);
+            for (const auto c : range)
+                for (auto &p : c) sum += (uint32_t)p;
+        }
+        sink = sum;
+        return reader.size();
+    });
+    reader.unload();
+    std::filesystem::remove(path);
+}
+
+static void benchExpand(ICache &base, uint64_t expected, int n, int maxThreads) {
+    for (int threads : threadCounts(maxThreads)) {
+        for (bool hashless : {false, true}) {
+            Hashy hashes;
+            measure(
+                "expand", {{"n", std::to_string(n)}, {"threads", std::to_string(threads)}, {"hashless", hashless ? "true" : "false"}},
+                [&]() { return expandAll(n, base, hashes, hashless, threads); },
+                [&]() {
+                    hashes = Hashy();
+                    hashes.init(n, hashless ? 0 : Hashy::shardBits(threads, expected / Hashy::generateShapes(n).size()));
+                });
+        }
+    }
+}
+
+// the duplicate inserts expanding base from n - 1 to n, with and without the symmetry
+// pruning of the candidates (GenOptions::symmetry). the counts are fixed, so they go into
+// the params and the runs only time it.
+static void benchDuplicates(ICache &base, int n, int threads) {
+    for (bool symmetry : {false, true}) {
+        Hashy hashes;
+        auto prepare = [&]() {
+            hashes = Hashy();
+            hashes.init(n);
+        };
+        uint64_t inserts = 0;
+        prepare();
+        const uint64_t count = expandAll(n, base, hashes, false, threads, symmetry, &inserts);
+        measure(
+            "duplicates",
+            {{"n", std::to_string(n)},
+             {"symmetry", symmetry ? "true" : "false"},
+             {"inserts", std::to_string(inserts)},
+             {"duplicates", std::to_string(inserts - count)}},
+            [&]() {
+                expandAll(n, base, hashes, false, threads, symmetry);
+                return inserts;
+            },
+            prepare);
+    }
+}
+
+static void benchGen(int fromN, int toN, int maxThreads, const std::string &dir) {
+    for (int n = fromN; n <= toN; ++n)
+        for (int threads : threadCounts(maxThreads)) {
+            GenOptions opts;
+            opts.threads = threads;
+            opts.base_path = dir;
+            measure("gen", {{"n", std::to_string(n)}, {"threads", std::to_string(threads)}}, [&]() {
+                auto cache = gen(n, opts);
+                uint64_t count = 0;
+                for (uint32_t i = 0; i < cache.numShapes(); ++i) count += cache.getCubesByShape(i).size();
+                return count;
+            });
+        }
+}
+
+static std::string quote(const std::string &s) { return "\"" + s + "\""; }
+
+static bool writeJson(const std::string &path, const std::string &engine) {
+    std::FILE *f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        std::printf("ERROR could not create %s\n\r", path.c_str());
+        return false;
+    }
+    std::fprintf(f, "{\n  \"revision\": %s,\n  \"engine\": %s,\n  \"hardware_threads\": %u,\n  \"repetitions\": %d,\n  \"benchmarks\": [\n",
+                 quote(CUBES_GIT_REVISION).c_str(), quote(engine).c_str(), std::thread::hardware_concurrency(), reps);
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto &r = results[i];
+        std::ostringstream params;
+        for (size_t j = 0; j < r.params.size(); ++j) params << (j ? ", " : "") << quote(r.params[j].first) << ": " << quote(r.params[j].second);
+        std::fprintf(f, "    {\"name\": %s, \"params\": {%s}, \"items\": %lu, \"seconds_min\": %.6f, \"seconds_median\": %.6f, \"items_per_second\": %.1f}%s\n",
+                     quote(r.name).c_str(), params.str().c_str(), r.items, r.best(), r.median(), r.items / r.best(), i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+    return std::fclose(f) == 0;
+}
+
+void configure_arguments(cli::Parser &parser) {
+    parser.set_optional<std::string>("b", "benchmarks", "canonical,insert,scan,expand,duplicates,gen", "comma separated benchmarks to run");
+    parser.set_optional<std::string>("d", "data", "./tests/test_data.bin", "cache file the input cubes of the kernel benchmarks are expanded from");
+    parser.set_optional<int>("s", "size", 10, "N of the polycubes the kernel benchmarks work on");
+    parser.set_optional<int>("n", "gen_size", 10, "largest N the gen benchmark sweeps up to");
+    parser.set_optional<int>("g", "gen_from", 8, "smallest N of the gen benchmark");
+    parser.set_optional<int>("t", "threads", 1, "largest thread count, the sweeps run 1, 2, 4, ... and this");
+    parser.set_optional<int>("r", "repetitions", 3, "runs of every benchmark, the fastest one is reported");
+    parser.set_optional<std::string>("e", "engine", "auto", "canonicalisation engine used by everything but the canonical benchmark");
+    parser.set_optional<std::string>("j", "json", "./bench.json", "where to write the results");
+    parser.set_optional<std::string>("f", "work_folder", "./bench_tmp/", "folder for the files the benchmarks write, in a subfolder removed afterwards");
+}
+
+int main(int argc, char **argv) {
+    cli::Parser parser(argc, argv);
+    configure_arguments(parser);
+    parser.run_and_exit_if_error();
+    if (!Canonical::select(parser.get<std::string>("e"))) {
+        std::printf("canonicalisation engine \"%s\" is not available\n", parser.get<std::string>("e").c_str());
+        return 1;
+    }
+    reps = std::max(1, parser.get<int>("r"));
+    const int maxThreads = std::max(1, parser.get<int>("t"));
+    const int size = parser.get<int>("s");
+    // a folder of its own inside -f, which may hold other files, removed when done
+    const std::string dir = (std::filesystem::path(parser.get<std::string>("f")) / ("cubes_bench_" + std::to_string(getpid()))).string() + "/";
+    std::filesystem::create_directories(dir);
+    auto enabled = [selected = "," + parser.get<std::string>("b") + ","](const std::string &name) { return selected.find("," + name + ",") != std::string::npos; };
+
+    if (enabled("canonical") || enabled("insert") || enabled("scan") || enabled("expand") || enabled("duplicates")) {
+        // the kernels work on the polycubes of size and size - 1 grown from the data file
+        CacheReader reader;
+        if (reader.loadFile(parser.get<std::string>("d")) != 0) {
+            std::filesystem::remove_all(dir);
+            return 1;
+        }
+        const int dataN = reader.size() ? reader.n() : 0;
+        if (dataN == 0 || size <= dataN) {
+            std::printf("ERROR the kernel benchmarks need -s larger than the N of the data file\n\r");
+            std::filesystem::remove_all(dir);
+            return 1;
+        }
+        std::vector<std::unique_ptr<FlatCache>> levels;
+        ICache *base = &reader, *prevBase = nullptr;
+        Hashy cur;
+        for (int n = dataN + 1; n <= size; ++n) {
+            prevBase = base;
+            cur = Hashy();
+            cur.init(n);
+            expandAll(n, *base, cur, false, maxThreads);
+            levels.push_back(std::make_unique<FlatCache>(cur, n));
+            base = levels.back().get();
+        }
+        const auto cubes = listCubes(cur, size);
+        if (enabled("canonical")) benchCanonical(cubes);
+        if (enabled("insert")) benchInsert(cubes, maxThreads);
+        if (enabled("scan")) benchScan(cur, size, dir);
+        if (enabled("expand")) benchExpand(*prevBase, cubes.size(), size, maxThreads);
+        // every level grown from the data file
+        if (enabled("duplicates"))
+            for (int n = dataN + 1; n <= size; ++n) benchDuplicates(n == dataN + 1 ? (ICache &)reader : *levels[n - dataN - 2], n, maxThreads);
+    }
+    if (enabled("gen")) benchGen(parser.get<int>("g"), parser.get<int>("n"), maxThreads, dir);
+
+    std::filesystem::remove_all(dir);
+    return writeJson(parser.get<std::string>("j"), Canonical::selected().name) ? 0 : 1;
+}
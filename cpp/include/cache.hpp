@@ -10,6 +10,8 @@ struct Cache {
     static constexpr uint32_t MAGIC = 0x42554350;
     static constexpr uint32_t XYZ_SIZE = 3;
     static constexpr uint32_t ALL_SHAPES = -1;
+    // ShapeEntry::flags: the cubes of the shape are sorted by their XYZs (see FrozenShape)
+    static constexpr uint8_t SORTED = 1;
     struct Header {
         uint32_t magic = MAGIC;  // shoud be "PCUB" = 0x42554350
         uint32_t n;              // we will never need 32bit but it is nicely aligned
@@ -20,13 +22,17 @@ struct Cache {
         uint8_t dim0;      // offset by -1
         uint8_t dim1;      // offset by -1
         uint8_t dim2;      // offset by -1
-        uint8_t reserved;  // for alignment
+        uint8_t flags;     // SORTED, otherwise 0
         uint64_t offset;   // from beginning of file
         uint64_t size;     // in bytes should be multiple of XYZ_SIZE
     };
 
+    // the cubes of hashes with n cubes each, frozen shapes (from load) are written with their own n
     static void save(std::string path, Hashy& hashes, uint8_t n);
-    static Hashy load(std::string path, uint32_t extractShape = ALL_SHAPES);
+    // the shapes of the file as frozen sets (see FrozenShape), read by threads in parallel.
+    // the file is trusted to hold no duplicates, verify drops them and non-canonical cubes
+    // (-V). frozen shapes are read-only, nothing may be inserted into the returned sets.
+    static Hashy load(std::string path, uint32_t extractShape = ALL_SHAPES, int threads = 1, bool verify = false);
 
     int filedesc;
     void* mmap_ptr;
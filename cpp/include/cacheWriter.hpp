@@ -0,0 +1,96 @@
+#pragma once
+#ifndef OPENCUBES_CACHEWRITER_HPP
+#define OPENCUBES_CACHEWRITER_HPP
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+#include "cube.hpp"
+#include "hashes.hpp"
+
+/**
+ * Streaming writer for cache files (see cache.cpp for the format).
+ *
+ * The header and the shape table are reserved up front and patched in close(), the XYZ
+ * blocks of the shapes are appended in whatever order the shapes are finished. Data goes
+ * through one large aligned buffer, optionally with O_DIRECT, so writing costs a few
+ * syscalls per buffer instead of one per cube and a finished shape can be dropped from
+ * memory right after it was written.
+ */
+class CacheWriter {
+   public:
+    CacheWriter();
+    ~CacheWriter();
+
+    CacheWriter(const CacheWriter &) = delete;
+    CacheWriter &operator=(const CacheWriter &) = delete;
+
+    // create path for polycubes with n cubes. shapes is the complete shape table and has to be
+    // sorted. with direct the data is written with O_DIRECT, if the filesystem supports it.
+    bool open(const std::string &path, uint8_t n, const std::vector<XYZ> &shapes, bool direct = false);
+
+    // append all cubes of shape, every shape at most once. thread safe.
+    template <class ShapeSet>
+    void writeShape(XYZ shape, ShapeSet &set) {
+        if (set.frozen) return writeFrozen(shape, *set.frozen);
+        std::lock_guard<std::mutex> lk(mu_);
+        beginShape(shape);
+        for (auto &subset : set.byhash)
+            for (const auto &c : subset.set) append(c);
+        endShape(false);
+    }
+
+    // append the cubes of a frozen shape as they are, the block is marked as sorted. thread safe.
+    // shapes of another N than the file are refused.
+    void writeFrozen(XYZ shape, const FrozenShape &frozen);
+
+    // append the packed cubes fill(add) passes to add (one at a time) as shape, sorted if
+    // they come in order. thread safe.
+    template <class Fill>
+    void writeShapeWith(XYZ shape, Fill fill, bool sorted = false) {
+        std::lock_guard<std::mutex> lk(mu_);
+        beginShape(shape);
+        fill([this](const uint64_t *words) { append(FlatCubeSet::Entry{words, n_}); });
+        endShape(sorted);
+    }
+
+    // flush everything and write header and shape table. shapes never written stay empty.
+    void close();
+
+    bool isOpen() const { return fd_ >= 0; }
+    const std::string &path() const { return path_; }
+
+    // buffer size and alignment of writes, O_DIRECT needs the alignment for offsets and sizes
+    static constexpr size_t BUFFER_SIZE = 8 << 20;
+    static constexpr size_t ALIGNMENT = 4096;
+
+   private:
+    void beginShape(XYZ shape);
+    void append(const FlatCubeSet::Entry &c);
+    // count unpacked cubes with n cubes each, copied as they are
+    void append(const XYZ *xyzs, uint64_t count, int n);
+    void endShape(bool sorted);
+    // write the aligned part of the buffer (everything if final)
+    void flush(bool final);
+    void writeAll(const uint8_t *data, size_t len, uint64_t offset);
+
+    struct Free {
+        void operator()(uint8_t *p) const;
+    };
+    std::unique_ptr<uint8_t, Free> buf_;
+    size_t fill_ = 0;
+    uint64_t fileOffset_ = 0;  // where buf_[0] goes
+    int fd_ = -1;
+    bool direct_ = false;
+    std::string path_;
+    uint8_t n_ = 0;
+    std::vector<Cache::ShapeEntry> table_;
+    Cache::ShapeEntry *current_ = nullptr;
+    uint64_t numPolycubes_ = 0;
+    std::mutex mu_;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+#ifndef OPENCUBES_CANDIDATEGRID_HPP
+#define OPENCUBES_CANDIDATEGRID_HPP
+#include <cstdint>
+#include <vector>
+
+#include "cube.hpp"
+
+/**
+ * Finds the free cells next to a polycube with an occupancy bitmap instead of sorting
+ * 6 * N neighbours and subtracting the cube.
+ *
+ * The bounding box of the input shape is padded by one cell on every side, so every
+ * neighbour of a cube has its own bit: the neighbours are the occupancy mask shifted
+ * by the x, y and z strides, and wrapping around a row only ever lands in padding.
+ * A precomputed mask then keeps the cells that give the target shape of the workset.
+ *
+ * Only used if the padded box fits into 128 bits, callers fall back otherwise.
+ */
+class CandidateGrid {
+   public:
+    static constexpr int MAX_CELLS = 128;
+
+    // shape is the largest coordinate of the input cubes, expandDim and notSameShape as in
+    // ShapePair: candidates either stay in the box or grow it along expandDim.
+    CandidateGrid(XYZ shape, XYZ expandDim, bool notSameShape) {
+        const int px = shape.x() + 3, py = shape.y() + 3, pz = shape.z() + 3;
+        cells_ = px * py * pz;
+        if (!fits()) return;
+        strideY_ = pz;
+        strideX_ = py * pz;
+        for (int x = -1; x < px - 1; ++x)
+            for (int y = -1; y < py - 1; ++y)
+                for (int z = -1; z < pz - 1; ++z) {
+                    const XYZ p(x, y, z);
+                    const int i = index(p);
+                    cell_[i] = p;
+                    if (keep(p, shape, expandDim, notSameShape)) allowed_ |= (Mask)1 << i;
+                }
+    }
+
+    bool fits() const { return cells_ <= MAX_CELLS; }
+
+    // replace out with the candidate cells next to c, in bit order
+    void candidates(const Cube &c, std::vector<XYZ> &out) const {
+        out.clear();
+        if (cells_ <= 64)
+            collect<uint64_t>(c, out);
+        else
+            collect<Mask>(c, out);
+    }
+
+   private:
+    using Mask = unsigned __int128;
+
+    int index(XYZ p) const { return (p.x() + 1) * strideX_ + (p.y() + 1) * strideY_ + (p.z() + 1); }
+
+    static bool inside(int v, int max) { return v >= 0 && v <= max; }
+
+    static bool keep(XYZ p, XYZ shape, XYZ expandDim, bool notSameShape) {
+        bool in[3], edge[3];
+        for (int d = 0; d < 3; ++d) {
+            in[d] = inside(p[d], shape[d]);
+            edge[d] = p[d] == -1 || p[d] == shape[d] + 1;
+        }
+        if (!notSameShape) return in[0] && in[1] && in[2];
+        for (int d = 0; d < 3; ++d)
+            if (expandDim[d] == 1 && edge[d] && in[(d + 1) % 3] && in[(d + 2) % 3]) return true;
+        return false;
+    }
+
+    static int lowestBit(uint64_t m) { return __builtin_ctzll(m); }
+    static int lowestBit(Mask m) {
+        const uint64_t lo = (uint64_t)m;
+        return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll((uint64_t)(m >> 64));
+    }
+
+    template <typename M>
+    void collect(const Cube &c, std::vector<XYZ> &out) const {
+        M occupied = 0;
+        for (const auto &p : c) occupied |= (M)1 << index(p);
+        M free = (occupied << 1) | (occupied >> 1) | (occupied << strideY_) | (occupied >> strideY_) | (occupied << strideX_) |
+                 (occupied >> strideX_);
+        free &= (M)allowed_ & ~occupied;
+        for (; free; free &= free - 1) out.push_back(cell_[lowestBit(free)]);
+    }
+
+    int cells_ = 0;
+    int strideY_ = 0, strideX_ = 0;
+    Mask allowed_ = 0;
+    XYZ cell_[MAX_CELLS];
+};
+
+#endif
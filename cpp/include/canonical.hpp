@@ -0,0 +1,162 @@
+#pragma once
+#ifndef OPENCUBES_CANONICAL_HPP
+#define OPENCUBES_CANONICAL_HPP
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cube.hpp"
+#include "rotations.hpp"
+
+// coefficients of the per rotation key function, padded to 32 lanes for vector loads
+struct RotationKeys {
+    int32_t mx[32], my[32], mz[32];
+    int32_t offx[32], offy[32], offz[32];
+};
+
+constexpr RotationKeys makeRotationKeys() {
+    RotationKeys k{};
+    const int32_t weight[3] = {1 << 16, 1 << 8, 1};
+    for (int r = 0; r < 24; ++r) {
+        int32_t *m[3] = {k.mx, k.my, k.mz};
+        int32_t *off[3] = {k.offx, k.offy, k.offz};
+        const auto &L = Rotations::LUT[r];
+        for (int i = 0; i < 3; ++i) {
+            // new component i is taken from old component L[i] (mirrored if L[3 + i] < 0)
+            m[L[i]][r] += L[3 + i] < 0 ? -weight[i] : weight[i];
+            if (L[3 + i] < 0) off[L[i]][r] += weight[i];
+        }
+    }
+    return k;
+}
+
+// The rotations that keep a shape sorted only depend on how its three dimensions compare.
+// Classes are indexed by the comparisons s[i] <= s[j] (see rotationClass()), for each the
+// mask of valid Rotations::LUT entries and the list of them.
+struct RotationClasses {
+    uint32_t mask[64];
+    uint8_t count[64];
+    uint8_t rot[64][24];
+};
+
+// bit of s[a] <= s[b] in the class index
+constexpr int lessEqualBit(int a, int b) {
+    constexpr int bits[3][3] = {{-1, 0, 2}, {3, -1, 1}, {5, 4, -1}};
+    return bits[a][b];
+}
+
+constexpr RotationClasses makeRotationClasses() {
+    RotationClasses c{};
+    for (int cls = 0; cls < 64; ++cls) {
+        for (int r = 0; r < 24; ++r) {
+            const auto &L = Rotations::LUT[r];
+            // shape[L[0]] <= shape[L[1]] <= shape[L[2]], equal components compare both ways
+            if (!(cls & (1 << lessEqualBit(L[0], L[1]))) || !(cls & (1 << lessEqualBit(L[1], L[2])))) continue;
+            c.mask[cls] |= 1u << r;
+            c.rot[cls][c.count[cls]++] = r;
+        }
+    }
+    return c;
+}
+
+// Batcher's odd-even merge sort network for n elements
+struct SortingNetwork {
+    uint8_t a[256], b[256];
+    int size;
+};
+
+constexpr SortingNetwork makeSortingNetwork(int n) {
+    SortingNetwork net{};
+    int p2 = 1;
+    while (p2 < n) p2 <<= 1;
+    // sort the next power of two. comparators touching padding after n would never swap.
+    for (int p = 1; p < p2; p <<= 1)
+        for (int k = p; k >= 1; k >>= 1)
+            for (int j = k % p; j + k < p2; j += 2 * k)
+                for (int i = 0; i < k && i + j + k < p2; ++i)
+                    if ((i + j) / (2 * p) == (i + j + k) / (2 * p) && i + j + k < n) {
+                        net.a[net.size] = i + j;
+                        net.b[net.size] = i + j + k;
+                        net.size++;
+                    }
+    return net;
+}
+
+/**
+ * Canonicalisation of polycubes.
+ *
+ * The canonical form of a polycube is the lexicographically greatest sorted XYZ list among
+ * all orientations in Rotations::LUT that keep the shape sorted (x <= y <= z).
+ *
+ * Every point is encoded as the sortable key (x << 16 | y << 8 | z). For rotation r the key
+ * of a point is linear in its coordinates: key = x * mx + y * my + z * mz + off, where off
+ * only depends on the shape. The SIMD engines evaluate this for many rotations at once, one
+ * rotation per lane, sort all lanes together with a sorting network and then pick the greatest lane.
+ *
+ * The engine is chosen at runtime from the features of the cpu, so binaries built without
+ * -march=native still use AVX2 / AVX-512 where available.
+ */
+struct Canonical {
+    // points: n XYZs within shape, in any order. writes the canonical sorted XYZ list to out
+    // and returns the shape of the canonical orientation.
+    using Fn = XYZ (*)(const XYZ *points, int n, XYZ shape, XYZ *out);
+
+    struct Engine {
+        const char *name;
+        Fn canonicalize;
+        bool (*supported)();
+    };
+
+    // SIMD engines are instantiated up to this many points and fall back to scalar above.
+    static constexpr int MAX_POINTS = 32;
+
+    // all engines compiled in, slowest first
+    static const std::vector<Engine> &engines();
+    // fastest engine the cpu supports
+    static const Engine &best();
+    // select an engine by name ("auto" picks best()). returns false if it is unknown or unsupported.
+    static bool select(const std::string &name);
+    static const Engine &selected() { return *current; }
+
+    static XYZ canonicalize(const XYZ *points, int n, XYZ shape, XYZ *out) { return current->canonicalize(points, n, shape, out); }
+
+    // symmetry of a polycube in canonical form: the number of rotations that map it onto
+    // itself (1, 2, 3, 4, 6, 8, 12 or 24) and whether its mirror image is a different polycube.
+    struct Symmetry {
+        int order;
+        bool chiral;
+    };
+    static Symmetry symmetry(const XYZ *canonical, int n, XYZ shape);
+    // rotations mapping a polycube in canonical form onto itself, bit r for Rotations::LUT[r]
+    static uint32_t stabiliser(const XYZ *canonical, int n, XYZ shape);
+
+    static XYZ scalar(const XYZ *points, int n, XYZ shape, XYZ *out);
+    static XYZ avx2(const XYZ *points, int n, XYZ shape, XYZ *out);
+    static XYZ avx512(const XYZ *points, int n, XYZ shape, XYZ *out);
+
+    static constexpr RotationKeys ROTATION_KEYS = makeRotationKeys();
+    static constexpr RotationClasses ROTATION_CLASSES = makeRotationClasses();
+
+    // index into ROTATION_CLASSES: 4 valid rotations for distinct dimensions, 8 with two equal, 24 for a cube
+    static int rotationClass(XYZ shape) {
+        const int x = shape.x(), y = shape.y(), z = shape.z();
+        return (x <= y) | (y <= z) << 1 | (x <= z) << 2 | (y <= x) << 3 | (z <= y) << 4 | (z <= x) << 5;
+    }
+
+    // bit r is set if rotation r keeps shape sorted.
+    static uint32_t validRotations(XYZ shape) { return ROTATION_CLASSES.mask[rotationClass(shape)]; }
+
+    static XYZ rotatedShape(int r, XYZ shape) {
+        const auto &L = Rotations::LUT[r];
+        return XYZ(shape[L[0]], shape[L[1]], shape[L[2]]);
+    }
+
+    static int32_t key(XYZ p) { return (uint32_t)p; }
+    static XYZ fromKey(int32_t k) { return XYZ((k >> 16) & 0xff, (k >> 8) & 0xff, k & 0xff); }
+
+   private:
+    static const Engine *current;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef OPENCUBES_CUBEQUERY_HPP
+#define OPENCUBES_CUBEQUERY_HPP
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "cube.hpp"
+#include "newCache.hpp"
+
+/**
+ * Looks polycubes up in a mapped cache file without loading it into sets.
+ *
+ * A query is canonicalised (see Canonical), which gives its shape table entry, and then
+ * searched in the block of that shape. Blocks written with -S are sorted (CacheReader::
+ * isSorted()) and binary searched, a query touches a few pages of one block. Unsorted blocks
+ * of older files are scanned.
+ *
+ * findMany() canonicalises on all threads and then searches the queries grouped by shape in
+ * sorted order, each search starting where the previous one of its shape ended, so queries
+ * close to each other in a block share the pages they read.
+ */
+class CubeQuery {
+   public:
+    struct Result {
+        bool found = false;
+        XYZ shape;            // of the canonical form
+        uint32_t sid = 0;     // shape table entry, valid if found
+        // of the cube in its shape block. in sorted blocks of cubes not found the index it
+        // would have, the first cube greater than the query.
+        uint64_t index = 0;
+    };
+
+    // cache has to stay loaded while the query is used
+    explicit CubeQuery(CacheReader &cache);
+
+    // polycubes with n() cubes are looked up
+    int n() const { return n_; }
+
+    // points: n() XYZs in any position, orientation and order. writes the canonical form to
+    // canonical (n() XYZs) if it is not null.
+    Result find(const XYZ *points, XYZ *canonical = nullptr) const;
+
+    // count queries of n() XYZs each, back to back in points
+    std::vector<Result> findMany(const XYZ *points, size_t count, int threads = 1) const;
+
+    // canonical: the canonical form as stored in cache files (the sorted XYZs of its
+    // canonical orientation), shape the shape of that orientation
+    Result findCanonical(const XYZ *canonical, XYZ shape) const { return search(canonical, shape, 0); }
+
+    // the most cubes of a Cube
+    static constexpr int MAX_QUERY_POINTS = 127;
+
+   private:
+    // canonical form of points to out, returns its shape
+    XYZ canonicalize(const XYZ *points, XYZ *out) const;
+    // canonical with shape, searched from the index from on
+    Result search(const XYZ *canonical, XYZ shape, uint64_t from) const;
+
+    CacheReader &cache_;
+    int n_;
+    std::map<XYZ, uint32_t> sids_;
+};
+
+#endif
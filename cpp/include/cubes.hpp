@@ -2,8 +2,67 @@
 #ifndef OPENCUBES_CUBES_HPP
 #define OPENCUBES_CUBES_HPP
 
+#include <string>
+
 #include "hashes.hpp"
 #include "newCache.hpp"
 
-FlatCache gen(int n, int threads = 1, bool use_cache = false, bool write_cache = false, bool split_cache = false, bool use_split_cache = false, std::string base_path = "./cache/");
-#endif
\ No newline at end of file
+struct GenOptions {
+    int threads = 1;
+    bool use_cache = false;        // load cubes_{n-1}.bin instead of generating it
+    bool write_cache = false;      // write cubes_n.bin (streamed, see below)
+    bool split_cache = false;      // write one file per output shape
+    bool use_split_cache = false;  // load one file per input shape
+    std::string base_path = "./cache/";
+    bool hashless = false;   // count by canonical parent, see Readme
+    bool count_only = false; // hashless with chirality and symmetry statistics
+    bool direct_io = false;  // write cache files with O_DIRECT
+    bool pcube = false;      // read and write cubes_n.pcube (compressed, see pcube.hpp) instead of cubes_n.bin
+    // sharded generation, see shards.hpp. a shard is "i/k" or a file listing unit ids.
+    std::string shard;
+    std::string unit_list;
+    uint64_t unit_size = 1 << 20;  // input cubes per work unit
+    bool merge = false;            // combine the finished shards
+    // keep a resume state of the run, see resume.hpp
+    bool checkpoint = false;
+    bool resume = false;  // continue from the resume state, implies checkpoint
+    // json progress lines (see progress.hpp) every progress seconds, 0 for none
+    double progress = 0;
+    std::string progress_file;  // appended to, stderr if empty
+    // how a mapped cache file of N-1 is read, see inputPipeline.hpp: "mmap" (page faults
+    // only), "readahead" (madvise ahead of the workers) or "stream" (pread into buffers)
+    std::string input = "readahead";
+    bool huge_pages = false;  // ask for transparent huge pages on the mapped input
+    // pin the workers to NUMA nodes and insert on the node owning a shard, see numa.hpp
+    bool numa = false;
+    // "hash" sets or "sort": sorted runs merged per output shape, see sortedRuns.hpp
+    std::string dedup = "hash";
+    uint64_t mem_limit = 0;  // MiB of sorted runs kept in memory before they are spilled, 0 for no limit
+    // generate N - 1 (and below) next to N when it is not loaded, expanding its shapes as they
+    // are finished instead of keeping all of N - 1 in memory
+    bool pipeline = false;
+    // sort the shape blocks of the cache files, so they can be searched (see cubeQuery.hpp)
+    bool sorted_cache = false;
+    // expand on the gpu, see gpuExpand.hpp. needs a build with -DCUBES_CUDA=ON.
+    bool gpu = false;
+    // MiB the run may use, -1 for the cgroup limit or the physical memory, 0 for no budget.
+    // gen() adapts to it, see memoryBudget.hpp.
+    int64_t mem_budget = 0;
+    // over the budget, finished shapes may go to split cache files instead of the returned
+    // cache. off for the levels N is generated from.
+    bool spill = true;
+    // expand only one candidate cell per orbit of the symmetries of a parent
+    bool symmetry = false;
+};
+
+// Generates all polycubes with n cubes. With write_cache every output shape is written to
+// the cache file as soon as it is finished and then dropped, so the returned cache is empty.
+// Shards and the merge step only write files and return an empty cache as well.
+FlatCache gen(int n, const GenOptions &opts = {});
+
+// Expands all cubes of base (polycubes with n - 1 cubes) into hashes, which has to be
+// init(n), and returns the number of polycubes with n cubes. This is the inner loop of
+// gen() without caches, resume state or progress output, for the benchmarks. inserts (if
+// set) gets the children inserted, duplicates included, or accepted when hashless.
+uint64_t expandAll(int n, ICache &base, Hashy &hashes, bool hashless, int threads, bool symmetry = false, uint64_t *inserts = nullptr);
+#endif
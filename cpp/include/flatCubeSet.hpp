@@ -0,0 +1,256 @@
+#pragma once
+#ifndef OPENCUBES_FLATCUBESET_HPP
+#define OPENCUBES_FLATCUBESET_HPP
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "cube.hpp"
+#include "packedCube.hpp"
+
+/**
+ * Concurrent open-addressing set of polycubes with a fixed number of cubes.
+ * The polycubes are stored packed (see packedCube.hpp) inline in one flat array
+ * next to an array of 32 bit tags, so stored cubes cost no allocations.
+ *
+ * Slots are claimed with a CAS on their tag: inserting threads never block each other.
+ * The table only needs to be taken exclusively to grow it, inserts hold it shared.
+ *
+ * Callers pass in hashPackedWords() of the key, which is used as is: slots are indexed by
+ * its low bits and tags come from its high 32 bits. Shards (see Hashy) are picked from the
+ * highest bits, which only costs the tags of one set a few of their bits.
+ */
+class FlatCubeSet {
+   public:
+    // stored polycube, refers to the memory of the set
+    struct Entry {
+        const uint64_t* words;
+        uint8_t n;
+
+        size_t size() const { return n; }
+        void unpack(XYZ* points) const { unpackXYZs(words, n, points); }
+        Cube toCube() const {
+            Cube c(n);
+            unpack(c.data());
+            return c;
+        }
+    };
+
+    class iterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Entry;
+        using pointer = Entry*;
+        using reference = Entry&;
+
+        iterator(const FlatCubeSet* set, size_t slot) : set_(set), slot_(slot) { skipEmpty(); }
+
+        const value_type operator*() const { return Entry{set_->slot(slot_), (uint8_t)set_->n_}; }
+
+        iterator& operator++() {
+            ++slot_;
+            skipEmpty();
+            return *this;
+        }
+
+        friend bool operator==(const iterator& a, const iterator& b) { return a.slot_ == b.slot_; };
+        friend bool operator!=(const iterator& a, const iterator& b) { return a.slot_ != b.slot_; };
+
+       private:
+        void skipEmpty() {
+            while (slot_ < set_->capacity_ && set_->tags_[slot_].load(std::memory_order_relaxed) < TAG_MIN) ++slot_;
+        }
+        const FlatCubeSet* set_;
+        size_t slot_;
+    };
+
+    FlatCubeSet() = default;
+    FlatCubeSet(const FlatCubeSet&) = delete;
+    FlatCubeSet& operator=(const FlatCubeSet&) = delete;
+
+    // insert the packed polycube with n cubes if not yet contained.
+    // returns true if it was inserted.
+    bool insert(const uint64_t* key, int n, size_t hash) {
+        const uint32_t tag = toTag(hash);
+        while (true) {
+            {
+                std::shared_lock lock(mutex_);
+                switch (tryInsert(key, n, hash, tag)) {
+                    case Result::Inserted:
+                        return true;
+                    case Result::Found:
+                        return false;
+                    case Result::Full:
+                        break;
+                }
+            }
+            grow(n);
+        }
+    }
+
+    // insert count packed polycubes with n cubes each, key i at keys + i * packedWords(n),
+    // holding the table only once unless it has to grow. returns how many were inserted.
+    size_t insertMany(const uint64_t* keys, const uint64_t* hashes, size_t count, int n) {
+        const size_t words = packedWords(n);
+        size_t inserted = 0, i = 0;
+        while (i < count) {
+            {
+                std::shared_lock lock(mutex_);
+                for (; i < count; ++i) {
+                    const Result r = tryInsert(keys + i * words, n, hashes[i], toTag(hashes[i]));
+                    if (r == Result::Full) break;
+                    inserted += r == Result::Inserted;
+                }
+            }
+            if (i < count) grow(n);
+        }
+        return inserted;
+    }
+
+    bool contains(const uint64_t* key, int n, size_t hash) const {
+        std::shared_lock lock(mutex_);
+        if (capacity_ == 0 || (uint32_t)n != n_) return false;
+        const uint32_t tag = toTag(hash);
+        for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+            uint32_t t = waitWritten(i);
+            if (t == TAG_EMPTY) return false;
+            if (t == tag && std::memcmp(slot(i), key, words_ * sizeof(uint64_t)) == 0) return true;
+        }
+    }
+
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    // slots of the table, safe to call while other threads insert
+    size_t capacity() const {
+        std::shared_lock lock(mutex_);
+        return capacity_;
+    }
+
+    // drop all cubes and release the memory.
+    // only call while no thread inserts.
+    void clear() {
+        std::unique_lock lock(mutex_);
+        tags_.reset();
+        data_.reset();
+        capacity_ = mask_ = growAt_ = 0;
+        n_ = words_ = 0;
+        size_ = 0;
+    }
+
+    // append the packed cubes stored so far to out, while other threads may go on inserting.
+    // cubes inserted meanwhile may be missing. growing the table waits until the copy is done.
+    void snapshot(std::vector<uint64_t>& out) const {
+        std::shared_lock lock(mutex_);
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (tags_[i].load(std::memory_order_acquire) < TAG_MIN) continue;
+            out.insert(out.end(), slot(i), slot(i) + words_);
+        }
+    }
+
+    // iterators are only valid while no thread inserts
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, capacity_); }
+
+   private:
+    static constexpr uint32_t TAG_EMPTY = 0;
+    static constexpr uint32_t TAG_BUSY = 1;  // slot claimed, key not yet written
+    static constexpr uint32_t TAG_MIN = 2;
+    static constexpr size_t MIN_CAPACITY = 64;
+
+    enum class Result { Inserted, Found, Full };
+
+    // slots are indexed by the low bits of the hash, tags come from the high bits.
+    static uint32_t toTag(size_t hash) {
+        uint32_t tag = hash >> 32;
+        return tag < TAG_MIN ? tag + TAG_MIN : tag;
+    }
+
+    uint64_t* slot(size_t i) const { return data_.get() + i * words_; }
+
+    uint32_t waitWritten(size_t i) const {
+        uint32_t t = tags_[i].load(std::memory_order_acquire);
+        while (t == TAG_BUSY) t = tags_[i].load(std::memory_order_acquire);
+        return t;
+    }
+
+    Result tryInsert(const uint64_t* key, int n, size_t hash, uint32_t tag) {
+        if (capacity_ == 0 || (uint32_t)n != n_) return Result::Full;
+        bool reserved = false;
+        for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+            uint32_t t = waitWritten(i);
+            if (t == TAG_EMPTY) {
+                // reserve room before claiming, so concurrent inserts can never fill the table
+                if (!reserved) {
+                    if (size_.fetch_add(1, std::memory_order_relaxed) >= growAt_) {
+                        size_.fetch_sub(1, std::memory_order_relaxed);
+                        return Result::Full;
+                    }
+                    reserved = true;
+                }
+                if (tags_[i].compare_exchange_strong(t, TAG_BUSY, std::memory_order_acquire)) {
+                    std::memcpy(slot(i), key, words_ * sizeof(uint64_t));
+                    tags_[i].store(tag, std::memory_order_release);
+                    return Result::Inserted;
+                }
+                // lost the slot to another thread: look at what it wrote
+                t = waitWritten(i);
+            }
+            if (t == tag && std::memcmp(slot(i), key, words_ * sizeof(uint64_t)) == 0) {
+                if (reserved) size_.fetch_sub(1, std::memory_order_relaxed);
+                return Result::Found;
+            }
+        }
+    }
+
+    // double the capacity (or allocate the table for cubes of size n).
+    // the old slots are rehashed into the new arrays while holding the table exclusively.
+    void grow(int n) {
+        std::unique_lock lock(mutex_);
+        if (capacity_ != 0 && (uint32_t)n != n_) {
+            std::printf("ERROR cube of size %d inserted into set of size %u!\n\r", n, n_);
+            std::exit(-1);
+        }
+        if (capacity_ != 0 && size_ < growAt_) return;  // another thread grew the table already
+        size_t newCapacity = capacity_ ? capacity_ * 2 : MIN_CAPACITY;
+        std::unique_ptr<std::atomic<uint32_t>[]> newTags(new std::atomic<uint32_t>[newCapacity]);
+        const uint32_t words = packedWords(n);
+        std::unique_ptr<uint64_t[]> newData(new uint64_t[newCapacity * words]);
+        for (size_t i = 0; i < newCapacity; ++i) newTags[i].store(TAG_EMPTY, std::memory_order_relaxed);
+        const size_t newMask = newCapacity - 1;
+        for (size_t i = 0; i < capacity_; ++i) {
+            uint32_t t = tags_[i].load(std::memory_order_relaxed);
+            if (t < TAG_MIN) continue;
+            size_t j = hashPackedWords(slot(i), words_) & newMask;
+            while (newTags[j].load(std::memory_order_relaxed) != TAG_EMPTY) j = (j + 1) & newMask;
+            newTags[j].store(t, std::memory_order_relaxed);
+            std::memcpy(newData.get() + j * words, slot(i), words * sizeof(uint64_t));
+        }
+        tags_ = std::move(newTags);
+        data_ = std::move(newData);
+        n_ = n;
+        words_ = words;
+        capacity_ = newCapacity;
+        mask_ = newMask;
+        growAt_ = newCapacity / 4 * 3;
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::unique_ptr<std::atomic<uint32_t>[]> tags_;
+    std::unique_ptr<uint64_t[]> data_;
+    size_t capacity_ = 0;
+    size_t mask_ = 0;
+    size_t growAt_ = 0;
+    std::atomic<size_t> size_{0};
+    uint32_t n_ = 0;
+    uint32_t words_ = 0;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef OPENCUBES_FROZENSHAPE_HPP
+#define OPENCUBES_FROZENSHAPE_HPP
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cube.hpp"
+#include "flatCubeSet.hpp"
+
+/**
+ * Read-only set of the polycubes of one shape, made from the sets of a finished shape.
+ *
+ * The cubes are stored unpacked and back to back like a shape block of a cache file (see
+ * ShapeRange), sorted by their XYZs. So a frozen shape is expanded, written and searched
+ * without locks and without copying it, lookups are binary searches.
+ */
+class FrozenShape {
+   public:
+    // the cubes of all sets, polycubes with n cubes of shape
+    FrozenShape(const std::vector<const FlatCubeSet *> &sets, int n, XYZ shape);
+    // the cubes of a cache file block, sorted here unless they are already
+    FrozenShape(std::vector<XYZ> xyzs, int n, XYZ shape, bool sorted);
+
+    XYZ shape() const { return shape_; }
+    int n() const { return n_; }
+    uint64_t size() const { return size_; }
+    // the XYZs of all cubes, cube i at data() + i * n()
+    XYZ *data() { return xyzs_.data(); }
+    const XYZ *data() const { return xyzs_.data(); }
+    const XYZ *cube(uint64_t i) const { return xyzs_.data() + i * n_; }
+    uint64_t memory() const { return xyzs_.capacity() * sizeof(XYZ); }
+
+    // index of the sorted polycube points, -1 if it is not in the set
+    int64_t find(const XYZ *points) const;
+    bool contains(const XYZ *points) const { return find(points) >= 0; }
+
+    // drop duplicates and cubes that are not canonical polycubes of shape, returns how many
+    uint64_t removeInvalid();
+
+    // order of the cubes, the bytes of their XYZs
+    static int compare(const XYZ *a, const XYZ *b, int n) { return std::memcmp(a, b, n * sizeof(XYZ)); }
+
+   private:
+    void sort();
+
+    std::vector<XYZ> xyzs_;
+    uint64_t size_ = 0;
+    int n_;
+    XYZ shape_;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+#ifndef OPENCUBES_GPUEXPAND_HPP
+#define OPENCUBES_GPUEXPAND_HPP
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cube.hpp"
+
+/**
+ * Optional GPU backend for the expansion of shape pairs (see Workset::expand in cubes.cpp).
+ *
+ * Batches of parents are copied to the device, where every thread expands one parent: it
+ * finds the free neighbour cells like Workset::neighbours(), canonicalises every child with
+ * the rotation keys of Canonical::scalar() and drops the children it produced twice. The
+ * host then inserts the canonical children into the sets, or only adds up the counts.
+ *
+ * The CUDA implementation is the library cubes_gpu (src/gpu/gpuExpand.cu), only built with
+ * -DCUBES_CUDA=ON. Without it open() returns null and gen() stays on the cpu.
+ */
+class GpuExpander {
+   public:
+    // one shape pair, as in ShapePair
+    struct Pair {
+        XYZ shape, targetShape, expandDim;
+        bool notSameShape;
+    };
+
+    enum class Mode {
+        Insert,  // all canonical children with their shapes, deduplicated by the host
+        Accept,  // hashless: the children whose canonical parent is the parent expanded
+        Count,   // hashless: only the number of accepted children
+    };
+
+    struct Output {
+        uint64_t count = 0;         // children found
+        std::vector<XYZ> children;  // n XYZs each, canonical, empty with Mode::Count
+        std::vector<XYZ> shapes;    // the shape of every child
+    };
+
+    // backend for children with n cubes on the first device, null if there is none or the
+    // backend is not built
+    static std::unique_ptr<GpuExpander> open(int n);
+    virtual ~GpuExpander() = default;
+
+    virtual const char *name() const = 0;
+    // expand count parents with n - 1 cubes, back to back in parents, into out (replaced).
+    // thread safe, every worker gets its own stream and buffers.
+    virtual void expand(int worker, const Pair &pair, const XYZ *parents, uint64_t count, Mode mode, Output &out) = 0;
+
+    // parents per batch copied to the device, also what a pool item of gen() expands
+    static constexpr uint64_t BATCH = 1 << 14;
+};
+
+#endif
@@ -1,75 +1,142 @@
 #pragma once
 #ifndef OPENCUBES_HASHES_HPP
 #define OPENCUBES_HASHES_HPP
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <cstdio>
 #include <map>
-#include <shared_mutex>
-#include <unordered_set>
+#include <memory>
 #include <vector>
 
 #include "cube.hpp"
+#include "flatCubeSet.hpp"
+#include "frozenShape.hpp"
+#include "packedCube.hpp"
 #include "utils.hpp"
 
-struct HashCube {
-    size_t operator()(const Cube &cube) const {
-        // https://stackoverflow.com/questions/20511347/a-good-hash-function-for-a-vector/72073933#72073933
-        std::size_t seed = cube.size();
-        for (auto &p : cube) {
-            auto x = HashXYZ()(p);
-            seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        }
-        return seed;
-    }
-};
-
-using CubeSet = std::unordered_set<Cube, HashCube, std::equal_to<Cube>>;
+using CubeSet = FlatCubeSet;
 
 struct Hashy {
     struct Subsubhashy {
         CubeSet set;
-        std::shared_mutex set_mutex;
 
-        template <typename CubeT>
-        void insert(CubeT &&c) {
-            std::lock_guard lock(set_mutex);
-            set.emplace(std::forward<CubeT>(c));
-        }
+        bool insert(const uint64_t *key, int n, size_t hash) { return set.insert(key, n, hash); }
 
-        bool contains(const Cube &c) {
-            std::shared_lock lock(set_mutex);
-            return set.count(c);
-        }
+        bool contains(const uint64_t *key, int n, size_t hash) const { return set.contains(key, n, hash); }
 
-        auto size() {
-            std::shared_lock lock(set_mutex);
-            return set.size();
-        }
+        auto size() const { return set.size(); }
     };
-    template <int NUM>
+    // the sets of one shape, picked by the highest bits of the hash
     struct Subhashy {
-        std::array<Subsubhashy, NUM> byhash;
-
-        template <typename CubeT>
-        void insert(CubeT &&c) {
-            HashCube hash;
-            auto idx = hash(c) % NUM;
-            auto &set = byhash[idx];
-            if (!set.contains(c)) set.insert(std::forward<CubeT>(c));
-            // printf("new size %ld\n\r", byshape[shape].size());
+        static constexpr int DEFAULT_BITS = 5;
+        static constexpr int MAX_BITS = 10;
+
+        explicit Subhashy(int bits = DEFAULT_BITS) : bits(bits), byhash{std::unique_ptr<Subsubhashy[]>(new Subsubhashy[1 << bits]), (size_t)1 << bits} {}
+
+        // insert a packed polycube with n cubes, returns false if it was there already.
+        // a frozen shape is read-only, its cubes are not in the sets inserts look at.
+        bool insert(const uint64_t *key, int n) {
+            assert(!frozen);
+            auto h = hashPackedWords(key, packedWords(n));
+            return byhash[shard(h)].insert(key, n, h);
+        }
+
+        // shard of a polycube with hashPackedWords() h. two shifts, so no shard bits shift by 64
+        size_t shard(uint64_t h) const { return h >> (63 - bits) >> 1; }
+
+        // insert count packed polycubes with n cubes each, grouped by shard so every shard
+        // is taken only once. returns how many were inserted.
+        size_t insertMany(const uint64_t *keys, size_t count, int n) {
+            assert(!frozen);
+            thread_local std::vector<uint64_t> hashes, grouped, groupedHashes;
+            thread_local std::vector<size_t> starts;
+            const size_t words = packedWords(n), shards = byhash.size();
+            hashes.resize(count);
+            starts.assign(shards + 1, 0);
+            for (size_t i = 0; i < count; ++i) {
+                hashes[i] = hashPackedWords(keys + i * words, words);
+                starts[shard(hashes[i]) + 1]++;
+            }
+            for (size_t s = 0; s < shards; ++s) starts[s + 1] += starts[s];
+            grouped.resize(count * words);
+            groupedHashes.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                const size_t j = starts[shard(hashes[i])]++;
+                std::copy(keys + i * words, keys + (i + 1) * words, &grouped[j * words]);
+                groupedHashes[j] = hashes[i];
+            }
+            // starts[s] is the end of shard s now
+            size_t inserted = 0;
+            for (size_t s = 0, begin = 0; s < shards; begin = starts[s++]) {
+                if (starts[s] > begin) inserted += byhash[s].set.insertMany(&grouped[begin * words], &groupedHashes[begin], starts[s] - begin, n);
+            }
+            return inserted;
+        }
+
+        // polycube with n cubes contained, in the sets or the frozen shape
+        bool contains(const uint64_t *key, int n) const {
+            if (frozen) {
+                XYZ points[127];
+                unpackXYZs(key, n, points);
+                return frozen->contains(points);
+            }
+            auto h = hashPackedWords(key, packedWords(n));
+            return byhash.sets[shard(h)].contains(key, n, h);
         }
 
         auto size() {
-            size_t sum = 0;
+            size_t sum = frozenSize.load(std::memory_order_relaxed);
             for (auto &set : byhash) {
                 auto part = set.size();
                 sum += part;
             }
             return sum;
         }
+
+        // the tables of the shards
+        std::vector<const FlatCubeSet *> sets() const {
+            std::vector<const FlatCubeSet *> out;
+            for (auto &set : byhash) out.push_back(&set.set);
+            return out;
+        }
+
+        // Move the cubes of a finished shape into a FrozenShape and drop the sets. Only call
+        // once nothing inserts any more, the set is read-only from then on.
+        void freeze(int n, XYZ shape) {
+            if (frozen) return;
+            frozen = std::make_shared<FrozenShape>(sets(), n, shape);
+            frozenSize = frozen->size();
+            for (auto &set : byhash) set.set.clear();
+        }
+
+        int bits;
+        std::shared_ptr<FrozenShape> frozen;
+        std::atomic<size_t> frozenSize{0};
+        struct Shards {
+            std::unique_ptr<Subsubhashy[]> sets;
+            size_t count;
+            Subsubhashy &operator[](size_t i) { return sets[i]; }
+            Subsubhashy *begin() { return sets.get(); }
+            Subsubhashy *end() { return sets.get() + count; }
+            const Subsubhashy *begin() const { return sets.get(); }
+            const Subsubhashy *end() const { return sets.get() + count; }
+            size_t size() const { return count; }
+        } byhash;
     };
 
-    std::map<XYZ, Subhashy<32>> byshape;
+    std::map<XYZ, Subhashy> byshape;
+
+    // Bits of the shard index for sets expected to hold about expectedPerShape cubes each:
+    // a few shards per thread so inserting threads rarely share a lock, but no shards of
+    // less than MIN_SHARD_SIZE cubes, which would waste memory on tables for a few cubes.
+    static constexpr uint64_t MIN_SHARD_SIZE = 4096;
+    static int shardBits(int threads, uint64_t expectedPerShape) {
+        int bits = 0;
+        while (bits < Subhashy::MAX_BITS && (1 << bits) < 4 * threads) ++bits;
+        while (bits > 0 && (expectedPerShape >> bits) < MIN_SHARD_SIZE) --bits;
+        return bits;
+    }
 
     static std::vector<XYZ> generateShapes(int n) {
         std::vector<XYZ> out;
@@ -83,16 +150,22 @@ struct Hashy {
         return out;
     }
 
-    void init(int n) {
-        // create all subhashy which will be needed for N
-        for (auto s : generateShapes(n)) byshape[s].size();
+    // create all subhashy which will be needed for N, each with 2^bits shards
+    void init(int n, int bits = Subhashy::DEFAULT_BITS) {
+        for (auto s : generateShapes(n)) byshape.try_emplace(s, bits);
         std::printf("%ld sets by shape for N=%d\n\r", byshape.size(), n);
     }
 
-    template <typename CubeT>
-    void insert(CubeT &&c, XYZ shape) {
-        auto &set = byshape[shape];
-        set.insert(std::forward<CubeT>(c));
+    // c must be sorted. prefer the PackedCube overload in hot loops.
+    bool insert(const Cube &c, XYZ shape) {
+        uint64_t key[MAX_PACKED_WORDS];
+        packXYZs(c.data(), c.size(), key);
+        return byshape[shape].insert(key, c.size());
+    }
+
+    template <int N>
+    bool insert(const PackedCube<N> &c, XYZ shape) {
+        return byshape[shape].insert(c.words, N);
     }
 
     auto size() {
@@ -0,0 +1,115 @@
+#pragma once
+#ifndef OPENCUBES_INPUTPIPELINE_HPP
+#define OPENCUBES_INPUTPIPELINE_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cube.hpp"
+#include "newCache.hpp"
+
+/**
+ * Readahead over the mapped cache file of a CacheReader, ahead of the expanding workers.
+ *
+ * Ranges are queued in the order their pairs are submitted. A background thread asks the
+ * kernel for them with madvise(MADV_WILLNEED), one window at a time and never more than
+ * `ahead` bytes beyond what the workers have consumed, so cold files are read in large
+ * sequential requests instead of page faults all over the mapping. Once no queued range
+ * uses the pages of a finished one any more they are dropped with MADV_DONTNEED, which
+ * only unmaps them: the page cache keeps them for later pairs of the same input shape.
+ */
+class Readahead {
+   public:
+    Readahead(uint64_t window, uint64_t ahead, bool hugePages);
+    ~Readahead();
+
+    Readahead(const Readahead &) = delete;
+    Readahead &operator=(const Readahead &) = delete;
+
+    // range will be read next, after the ones queued before. returns its id for done().
+    size_t queue(ShapeRange range);
+    // the workers went through bytes more of the queued ranges, called once per chunk. wakes
+    // the thread if it waits for the workers to catch up.
+    void consumed(uint64_t bytes);
+    // all cubes of range id are expanded
+    void done(size_t id);
+
+   private:
+    struct Range {
+        uint8_t *begin, *end;
+        uint8_t *advised;  // everything before was asked for
+        bool done = false;
+    };
+    void run();
+
+    const uint64_t window_, ahead_;
+    const bool hugePages_;
+    std::deque<Range> ranges_;
+    size_t next_ = 0;          // first range not completely asked for
+    uint64_t advised_ = 0;     // bytes asked for
+    std::vector<Range> drop_;  // finished, to be dropped by the thread
+    std::atomic<uint64_t> consumed_{0};
+    std::atomic<uint64_t> wakeAt_{UINT64_MAX};  // consumed_ the thread waits for
+    bool stop_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
+
+/**
+ * Reads ranges of a cache file without mapping it: large blocks of whole cubes are read by
+ * a background thread with pread (O_DIRECT if asked for and supported) into a ring of
+ * buffers, and every block is handed out as a ShapeRange as soon as it is read, while the
+ * next ones are read already. A block goes back to the ring when it is released, read()
+ * waits while all of them are in use.
+ */
+class BlockStream {
+   public:
+    // handle one block, release() once its cubes are not used any more
+    using Consumer = std::function<void(ShapeRange block, std::function<void()> release)>;
+
+    BlockStream(const std::string &path, uint64_t blockBytes, int slots, bool direct);
+    ~BlockStream();
+
+    BlockStream(const BlockStream &) = delete;
+    BlockStream &operator=(const BlockStream &) = delete;
+
+    bool isOpen() const { return fd_ >= 0; }
+
+    // hand the cubes (n XYZs each, of shape) in [offset, offset + bytes) of the file to
+    // consume block by block, in order. returns when the last block was handed out.
+    void read(uint64_t offset, uint64_t bytes, int n, XYZ shape, const Consumer &consume);
+
+    static constexpr uint64_t ALIGNMENT = 4096;
+
+   private:
+    enum class State { Free, Reading, Full, InUse };
+    struct Slot {
+        std::unique_ptr<uint8_t[]> mem;
+        uint8_t *buf;   // aligned start of mem
+        uint8_t *data;  // first cube of the block
+        uint64_t offset, bytes;
+        State state = State::Free;
+    };
+    void run();
+    void readSlot(Slot &slot);
+
+    int fd_ = -1;
+    bool direct_ = false;
+    uint64_t blockBytes_;
+    std::vector<Slot> slots_;
+    std::deque<Slot *> requests_;
+    bool stop_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
+
+#endif
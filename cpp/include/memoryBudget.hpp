@@ -0,0 +1,51 @@
+#pragma once
+#ifndef OPENCUBES_MEMORYBUDGET_HPP
+#define OPENCUBES_MEMORYBUDGET_HPP
+#include <cstdint>
+
+#include "hashes.hpp"
+
+/**
+ * Memory budget of gen(): what the process may use, and how close it is.
+ *
+ * Usage is the resident set of the process, so it covers the sets, the FlatCache of N-1,
+ * unpacked inputs and the mapped pages of the cache file alike, as the cgroup sees them.
+ * Past HIGH of the limit gen() queues fewer shape pairs at once and spills finished shapes
+ * to split cache files instead of keeping them; past CRITICAL only one pair runs at a time.
+ * Before a level is generated in memory its sets are estimated and N-1 goes through its
+ * cache file if both levels would not fit.
+ */
+class MemoryBudget {
+   public:
+    enum class Pressure { Low, High, Critical };
+
+    // limit in bytes, 0 for detectLimit()
+    explicit MemoryBudget(uint64_t limit = 0);
+
+    // memory limit of the cgroup, or the physical memory if there is none
+    static uint64_t detectLimit();
+
+    uint64_t limit() const { return limit_; }
+    // resident bytes of the process
+    static uint64_t resident();
+    uint64_t headroom() const;
+    Pressure pressure() const;
+    // bytes still fit below the HIGH mark
+    bool fits(uint64_t bytes) const;
+
+    // bytes of the tables and frozen shapes of hashes, with n cubes each
+    static uint64_t setBytes(Hashy &hashes, int n);
+    // rough size of cubes polycubes with n cubes in the sets, tables half full
+    static uint64_t estimateSets(int n, uint64_t cubes);
+
+    // one line of the resident bytes, sets and headroom, prefixed with when
+    void report(const char *when, uint64_t sets) const;
+
+    static constexpr double HIGH = 0.75;
+    static constexpr double CRITICAL = 0.9;
+
+   private:
+    uint64_t limit_;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #ifndef OPENCUBES_NEWCACHE_HPP
 #define OPENCUBES_NEWCACHE_HPP
 #include <cstring>
+#include <memory>
 #include <string>
 
 #include "cube.hpp"
@@ -33,7 +34,7 @@ class CubeIterator {
         return *this;
     }
 
-    CubeIterator& operator+=(int incr) {
+    CubeIterator& operator+=(difference_type incr) {
         m_ptr += n * incr;
         return *this;
     }
@@ -50,6 +51,7 @@ class CubeIterator {
     friend bool operator>(const CubeIterator& a, const CubeIterator& b) { return a.m_ptr > b.m_ptr; };
     friend bool operator!=(const CubeIterator& a, const CubeIterator& b) { return a.m_ptr != b.m_ptr; };
     friend class Workset;
+    friend class ShapeRange;
 
    private:
     uint32_t n;
@@ -66,6 +68,9 @@ class ShapeRange {
 
     XYZ& shape() { return shape_; }
     auto size() const { return size_; }
+    // the XYZs of the cubes
+    XYZ* data() const { return b.m_ptr; }
+    uint64_t bytes() const { return (uint8_t*)e.m_ptr - (uint8_t*)b.m_ptr; }
 
    private:
     CubeIterator b, e;
@@ -96,11 +101,22 @@ class CacheReader : public ICache {
 
     size_t size() override { return header->numPolycubes; };
     uint32_t numShapes() override { return header->numShapes; };
+    // where the cubes of shape i start in the file
+    uint64_t shapeOffset(uint32_t i) const { return shapes[i].offset; }
+    const std::string& path() const { return path_; }
+    // polycubes with n() cubes
+    uint32_t n() const { return header->n; }
+    XYZ shape(uint32_t i) const { return XYZ(shapes[i].dim0, shapes[i].dim1, shapes[i].dim2); }
+    // the cubes of shape i are sorted by their XYZs, see FrozenShape
+    bool isSorted(uint32_t i) const { return shapes[i].flags & SORTED; }
+    // drop the pages only holding cubes of shape i, they are read again if still needed
+    void releaseShape(uint32_t i);
     operator bool() { return fileLoaded_; }
 
     static constexpr uint32_t MAGIC = 0x42554350;
     static constexpr uint32_t XYZ_SIZE = 3;
     static constexpr uint32_t ALL_SHAPES = -1;
+    static constexpr uint8_t SORTED = 1;
 
     struct Header {
         uint32_t magic = MAGIC;  // shoud be "PCUB" = 0x42554350
@@ -112,21 +128,11 @@ class CacheReader : public ICache {
         uint8_t dim0;      // offset by -1
         uint8_t dim1;      // offset by -1
         uint8_t dim2;      // offset by -1
-        uint8_t reserved;  // for alignment
+        uint8_t flags;     // SORTED, otherwise 0
         uint64_t offset;   // from beginning of file
         uint64_t size;     // in bytes should be multiple of XYZ_SIZE
     };
 
-    CubeIterator begin() {
-        uint8_t* start = filePointer + shapes[0].offset;
-        return CubeIterator(header->n, (XYZ*)start);
-    }
-
-    CubeIterator end() {
-        uint8_t* stop = filePointer + shapes[0].offset + header->numPolycubes * header->n * XYZ_SIZE;
-        return CubeIterator(header->n, (XYZ*)stop);
-    }
-
     ShapeRange getCubesByShape(uint32_t i) override;
 
    private:
@@ -141,34 +147,35 @@ class CacheReader : public ICache {
 };
 
 class FlatCache : public ICache {
-    std::vector<XYZ> allXYZs;
+    // the cubes filled through shapeData(), mapped rather than allocated so they are first
+    // touched by the threads filling them
+    struct Unmap {
+        size_t bytes;
+        void operator()(XYZ* p) const;
+    };
+    std::unique_ptr<XYZ, Unmap> allXYZs;
     std::vector<ShapeRange> shapes;
+    // the shapes of a Hashy, referred to rather than copied
+    std::vector<std::shared_ptr<FrozenShape>> frozen;
+    uint64_t count = 0;
     uint8_t n = 0;
 
+    void allocate(uint64_t xyzs);
+
    public:
     FlatCache() {}
-    FlatCache(Hashy& hashes, uint8_t n) : n(n) {
-        allXYZs.reserve(hashes.size() * n);
-        shapes.reserve(hashes.byshape.size());
-        // std::printf("Flatcache %d %p %p\n", n, (void*)allXYZs.data(), (void*)shapes.data());
-        for (auto& [shape, set] : hashes.byshape) {
-            auto begin = allXYZs.data() + allXYZs.size();
-            for (auto& subset : set.byhash) {
-                for (auto& cube : subset.set)
-                    // allXYZs.emplace_back(allXYZs.end(), subset.set.begin(), subset.set.end());
-                    std::copy(cube.begin(), cube.end(), std::back_inserter(allXYZs));
-            }
-            auto end = allXYZs.data() + allXYZs.size();
-            // std::printf("  SR %p %p\n", (void*)begin, (void*)end);
-            shapes.emplace_back(begin, end, n, shape);
-        }
-    }
+    // the shapes of hashes, the ones not frozen yet are frozen by threads, a shape per job
+    FlatCache(Hashy& hashes, uint8_t n, int threads = 1);
+    // room for counts[i] cubes of shapes[i], filled through shapeData()
+    FlatCache(uint8_t n, const std::vector<XYZ>& shapeList, const std::vector<uint64_t>& counts);
+    XYZ* shapeData(uint32_t i) { return shapes[i].data(); }
+
     ShapeRange getCubesByShape(uint32_t i) override {
         if (i >= shapes.size()) return ShapeRange{nullptr, nullptr, 0, XYZ(0, 0, 0)};
         return shapes[i];
     };
     uint32_t numShapes() override { return shapes.size(); };
-    size_t size() override { return allXYZs.size() / n / sizeof(XYZ); }
+    size_t size() override { return count; }
 };
 
 #endif
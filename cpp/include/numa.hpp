@@ -0,0 +1,95 @@
+#pragma once
+#ifndef OPENCUBES_NUMA_HPP
+#define OPENCUBES_NUMA_HPP
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hashes.hpp"
+
+/**
+ * The NUMA nodes of the machine and the cpus of each this process may run on, read from
+ * /sys/devices/system/node. Machines without it are one node with all allowed cpus.
+ */
+class NumaTopology {
+   public:
+    NumaTopology();
+    explicit NumaTopology(std::vector<std::vector<int>> nodeCpus) : cpus_(std::move(nodeCpus)) {}
+
+    static NumaTopology detect();
+
+    int nodes() const { return cpus_.size(); }
+    const std::vector<int> &cpus(int node) const { return cpus_[node]; }
+
+    // keep the calling thread on cpus, returns false if that is not possible
+    static bool pin(const std::vector<int> &cpus);
+
+    // "0-3,8,10-11" as in the cpulist files
+    static std::vector<int> parseCpuList(const std::string &list);
+
+   private:
+    std::vector<std::vector<int>> cpus_;
+};
+
+/**
+ * Routes inserts into the shards of a Hashy to the NUMA node owning them.
+ *
+ * The shards of every shape are split into contiguous blocks by node. A worker inserts into
+ * the shards of its own node right away and batches the others per node; full batches go
+ * to the queue of their node, which its workers drain between chunks. The sets of a shard
+ * are then only grown, and so first touched, by the threads of its node. Every batch is
+ * counted in the pending counter of the caller until it is inserted, finish() waits for it.
+ *
+ * Duplicates found by an insert are returned by the call doing it, so they are counted by
+ * whichever worker that was.
+ */
+class InsertRouter {
+   public:
+    static constexpr size_t BATCH = 256;  // cubes
+
+    // worker i runs on node workerNode[i], see WorkPool::node()
+    InsertRouter(int nodes, std::vector<int> workerNode);
+
+    InsertRouter(const InsertRouter &) = delete;
+    InsertRouter &operator=(const InsertRouter &) = delete;
+
+    int nodes() const { return queues_.size(); }
+    int node(int worker) const { return workerNode_[worker]; }
+    // node owning shard i of a set with count shards
+    int owner(size_t shard, size_t count) const { return shard * nodes() / count; }
+
+    // insert the packed cube with n cubes into set on worker. returns the duplicates found.
+    uint64_t insert(int worker, Hashy::Subhashy &set, const uint64_t *key, int n, std::atomic<int> &pending);
+    // queue every batch of worker, call before it moves on to another set or pending counter
+    void flush(int worker);
+    // insert the queued batches of node, returns the duplicates found
+    uint64_t drain(int node);
+    // insert everything counted in pending, from any node. call after every worker adding
+    // to pending has flushed. returns the duplicates found.
+    uint64_t finish(std::atomic<int> &pending);
+
+   private:
+    struct Batch {
+        Hashy::Subhashy *set = nullptr;
+        std::atomic<int> *pending = nullptr;
+        int n = 0;
+        std::vector<uint64_t> words, hashes;
+    };
+    struct alignas(64) Queue {
+        std::mutex mu;
+        std::deque<Batch> batches;
+    };
+    static uint64_t insertBatch(Batch &b);
+    void push(int node, Batch &b);
+    bool pop(int node, Batch &b);
+
+    std::vector<int> workerNode_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::vector<Batch>> outbox_;  // by worker and node
+};
+
+#endif
@@ -0,0 +1,145 @@
+#pragma once
+#ifndef OPENCUBES_PACKEDCUBE_HPP
+#define OPENCUBES_PACKEDCUBE_HPP
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include "cube.hpp"
+
+/**
+ * Bit-packed XYZ lists.
+ *
+ * A polycube with n cubes has no coordinate larger than n - 1, so every coordinate
+ * gets just enough bits for that (4 bits for n <= 16). A point is packed
+ * as (x, y, z) big-endian and the points follow each other starting at the most significant
+ * bit of the first word. For sorted XYZ lists comparing the words gives the
+ * same order as comparing the lists with Cube::operator<.
+ */
+
+// bits per coordinate for polycubes with n cubes
+constexpr int packedCoordBits(int n) {
+    int b = 1;
+    while ((1 << b) < n) ++b;
+    return b;
+}
+
+// number of 64 bit words used for a polycube with n cubes
+constexpr int packedWords(int n) { return (n * 3 * packedCoordBits(n) + 63) / 64; }
+
+// Cube can hold up to 127 cubes
+constexpr int MAX_PACKED_WORDS = packedWords(127);
+
+inline void packXYZs(const XYZ* points, int n, uint64_t* out) {
+    const int bits = packedCoordBits(n);
+    const int pointBits = 3 * bits;
+    uint64_t acc = 0;  // bits not yet flushed to out, right aligned
+    int filled = 0;
+    for (int i = 0; i < n; ++i) {
+        const auto& p = points[i];
+        uint64_t key = ((uint64_t)(uint8_t)p.x() << (2 * bits)) | ((uint64_t)(uint8_t)p.y() << bits) | (uint8_t)p.z();
+        if (filled + pointBits < 64) {
+            acc = (acc << pointBits) | key;
+            filled += pointBits;
+        } else {
+            // point continues in the next word
+            int rest = filled + pointBits - 64;
+            *out++ = (acc << (64 - filled)) | (key >> rest);
+            acc = key & ((1ULL << rest) - 1);
+            filled = rest;
+        }
+    }
+    if (filled) *out = acc << (64 - filled);
+}
+
+inline void unpackXYZs(const uint64_t* in, int n, XYZ* points) {
+    const int bits = packedCoordBits(n);
+    const int pointBits = 3 * bits;
+    const uint64_t coordMask = (1u << bits) - 1;
+    const uint64_t pointMask = (1u << pointBits) - 1;
+    // work on a padded copy, so reading ahead never leaves the input
+    uint64_t buf[MAX_PACKED_WORDS + 1] = {0};
+    std::memcpy(buf, in, packedWords(n) * sizeof(uint64_t));
+    int w = 0;
+    uint64_t word = buf[0];
+    int avail = 64;  // bits of word not yet consumed, left aligned
+    for (int i = 0; i < n; ++i) {
+        uint64_t key;
+        if (pointBits <= avail) {
+            key = word >> (64 - pointBits);
+            word <<= pointBits;
+            avail -= pointBits;
+        } else {
+            int rest = pointBits - avail;
+            key = avail ? word >> (64 - avail) << rest : 0;
+            word = buf[++w];
+            key |= word >> (64 - rest);
+            word <<= rest;
+            avail = 64 - rest;
+        }
+        key &= pointMask;
+        points[i] = XYZ((key >> (2 * bits)) & coordMask, (key >> bits) & coordMask, key & coordMask);
+    }
+}
+
+// 64x64 -> 128 bit multiply folded to 64 bits, the mixing step of wyhash
+inline uint64_t foldedMultiply(uint64_t a, uint64_t b) {
+    const unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// wyhash style hash of packed words: every bit of the result depends on every input bit,
+// so the sets can take shards from the high bits and slots from the low bits of it.
+inline size_t hashPackedWords(const uint64_t* words, int count) {
+    constexpr uint64_t K0 = 0xa0761d6478bd642fULL, K1 = 0xe7037ed1a0b428dbULL, K2 = 0x8ebc6af09c88c6e3ULL;
+    uint64_t h = K0 ^ count;
+    int i = 0;
+    // one multiply per two words
+    for (; i + 1 < count; i += 2) h = foldedMultiply(words[i] ^ K1, words[i + 1] ^ h);
+    if (i < count) h = foldedMultiply(words[i] ^ K1, h ^ K2);
+    return foldedMultiply(h ^ K2, (uint64_t)count ^ K1);
+}
+
+// packed polycube with N cubes
+template <int N>
+struct PackedCube {
+    static constexpr int WORDS = packedWords(N);
+    uint64_t words[WORDS];
+
+    PackedCube() : words{} {}
+
+    // points must be sorted
+    explicit PackedCube(const XYZ* points) { packXYZs(points, N, words); }
+    explicit PackedCube(const Cube& c) : PackedCube(c.data()) {}
+
+    void unpack(XYZ* points) const { unpackXYZs(words, N, points); }
+
+    Cube toCube() const {
+        Cube c(N);
+        unpack(c.data());
+        return c;
+    }
+
+    bool operator==(const PackedCube& b) const {
+        uint64_t diff = 0;
+        for (int i = 0; i < WORDS; ++i) diff |= words[i] ^ b.words[i];
+        return diff == 0;
+    }
+    bool operator!=(const PackedCube& b) const { return !(*this == b); }
+
+    bool operator<(const PackedCube& b) const {
+        // the first differing word decides, evaluated without branches from the back.
+        bool less = false;
+        for (int i = WORDS - 1; i >= 0; --i) less = (words[i] < b.words[i]) | ((words[i] == b.words[i]) & less);
+        return less;
+    }
+
+    size_t hash() const { return hashPackedWords(words, WORDS); }
+};
+
+template <int N>
+struct std::hash<PackedCube<N>> {
+    size_t operator()(const PackedCube<N>& c) const { return c.hash(); }
+};
+
+#endif
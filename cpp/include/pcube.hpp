@@ -0,0 +1,151 @@
+#pragma once
+#ifndef OPENCUBES_PCUBE_HPP
+#define OPENCUBES_PCUBE_HPP
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cube.hpp"
+#include "hashes.hpp"
+#include "newCache.hpp"
+
+/**
+ * .pcube files as used by the Rust and Python implementations.
+ *
+ *   magic CB EC CB EC, uint8_t orientation, uint8_t compression (0 none, 1 gzip),
+ *   LEB128 number of cubes, then every cube as its three dimensions followed by the
+ *   occupancy bits (x major, least significant bit first), gzipped as a whole for compression 1.
+ *
+ * PCubeWriter compresses every shape as its own block: a fresh deflate state ending on a full
+ * flush, so the blocks simply concatenate to the one gzip member other readers expect. The gzip
+ * extra field carries a block index ("PC" subfield), which lets PCube::load inflate all shapes
+ * in parallel and seek straight to any of them. Files without the index are read sequentially.
+ */
+struct PCube {
+    static constexpr uint8_t MAGIC[4] = {0xCB, 0xEC, 0xCB, 0xEC};
+    enum Compression : uint8_t { NONE = 0, GZIP = 1 };
+
+    // block index in the gzip extra field
+    static constexpr uint8_t INDEX_ID[2] = {'P', 'C'};
+    static constexpr uint32_t INDEX_VERSION = 1;
+    struct IndexHeader {
+        uint32_t version;
+        uint32_t n;
+        uint32_t numShapes;
+    };
+    struct BlockEntry {
+        uint8_t dim0, dim1, dim2;  // offset by -1, like Cache::ShapeEntry
+        uint8_t reserved;
+        uint64_t count;   // cubes in the block
+        uint64_t offset;  // of the compressed block from beginning of file
+        uint64_t size;    // compressed bytes
+    };
+    // the extra field has a 16 bit length
+    static constexpr uint32_t MAX_INDEXED_SHAPES = (0xffff - 4 - sizeof(IndexHeader)) / sizeof(BlockEntry);
+
+    // bytes of one cube with shape, dimensions included
+    static size_t recordSize(XYZ shape) { return 3 + ((shape.x() + 1) * (shape.y() + 1) * (shape.z() + 1) + 7) / 8; }
+    // points have to be within shape
+    static void encode(const XYZ *points, int n, XYZ shape, uint8_t *record);
+    // writes the points in sorted order, returns the shape or XYZ(-1, -1, -1) if there are not n.
+    static XYZ decode(const uint8_t *record, int n, XYZ *points);
+
+    // Loads a .pcube file with polycubes of size n. Files from PCubeWriter are inflated by
+    // threads in parallel. Cubes from other files are canonicalized and grouped by shape first.
+    // returns false if the file can not be read, without a message if it does not exist.
+    static bool load(const std::string &path, int n, int threads, FlatCache &out);
+};
+
+class PCubeWriter {
+   public:
+    PCubeWriter() = default;
+    ~PCubeWriter();
+
+    PCubeWriter(const PCubeWriter &) = delete;
+    PCubeWriter &operator=(const PCubeWriter &) = delete;
+
+    // create path for polycubes with n cubes, shapes is the sorted shape table.
+    bool open(const std::string &path, uint8_t n, const std::vector<XYZ> &shapes, PCube::Compression compression = PCube::GZIP, int level = 6);
+
+    // encode and compress all cubes of shape, every shape at most once. thread safe, different
+    // shapes are compressed concurrently.
+    template <class ShapeSet>
+    void writeShape(XYZ shape, ShapeSet &set) {
+        if (set.frozen) return writeFrozen(shape, *set.frozen);
+        Block block(*this, shape);
+        std::vector<XYZ> points(n_);
+        for (auto &subset : set.byhash)
+            for (const auto &c : subset.set) {
+                c.unpack(points.data());
+                block.add(points.data());
+            }
+        append(block);
+    }
+
+    // the cubes of a frozen shape, in their order. shapes of another N than the file are refused.
+    void writeFrozen(XYZ shape, const FrozenShape &frozen) {
+        if (frozen.n() != n_) {
+            std::printf("ERROR frozen shape [%2d %2d %2d] has %d cubes, the cache file is for N = %d\n\r", shape.x(), shape.y(), shape.z(), frozen.n(), n_);
+            return;
+        }
+        Block block(*this, shape);
+        for (uint64_t i = 0; i < frozen.size(); ++i) block.add(frozen.cube(i));
+        append(block);
+    }
+
+    // the packed cubes fill(add) passes to add (one at a time) as shape. blocks carry no
+    // order flag, the last parameter is only there to match CacheWriter.
+    template <class Fill>
+    void writeShapeWith(XYZ shape, Fill fill, bool /*sorted*/ = false) {
+        Block block(*this, shape);
+        std::vector<XYZ> points(n_);
+        fill([&](const uint64_t *words) {
+            unpackXYZs(words, n_, points.data());
+            block.add(points.data());
+        });
+        append(block);
+    }
+
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+
+   private:
+    // one shape, records are compressed in chunks as they come
+    struct Block {
+        Block(PCubeWriter &w, XYZ shape);
+        ~Block();
+        void add(const XYZ *points);
+        // compress the records in raw, last ends the block on a full flush
+        void compress(bool last);
+
+        PCubeWriter &w;
+        XYZ shape;
+        size_t recordSize;
+        uint64_t count = 0;
+        std::vector<uint8_t> raw;  // records not compressed yet
+        std::vector<uint8_t> out;  // compressed (or raw without compression)
+        uint32_t crc;
+        uint64_t rawSize = 0;
+        void *stream = nullptr;  // z_stream
+    };
+    void append(Block &block);
+
+    int fd_ = -1;
+    std::string path_;
+    uint8_t n_ = 0;
+    PCube::Compression compression_ = PCube::GZIP;
+    int level_ = 6;
+    bool indexed_ = false;
+    uint64_t countPos_ = 0;  // LEB128 cube count
+    uint64_t indexPos_ = 0;  // block index entries
+    uint64_t offset_ = 0;    // end of file
+    std::vector<PCube::BlockEntry> table_;
+    uint64_t numPolycubes_ = 0;
+    uint32_t crc_ = 0;
+    uint64_t rawSize_ = 0;
+    std::mutex mu_;
+};
+
+#endif
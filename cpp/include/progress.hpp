@@ -0,0 +1,99 @@
+#pragma once
+#ifndef OPENCUBES_PROGRESS_HPP
+#define OPENCUBES_PROGRESS_HPP
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cube.hpp"
+#include "hashes.hpp"
+
+/**
+ * Live progress of gen(n): counters of every worker and the shape pairs being expanded,
+ * reported as one JSON object per line by a background thread.
+ *
+ * Every worker only writes its own counters, which live on their own cache line, with
+ * relaxed loads and stores instead of read-modify-writes. The reporter reads them relaxed
+ * as well, so counting adds no contention to the workers or the sets.
+ */
+class Progress {
+   public:
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> parents{0};     // cubes expanded
+        std::atomic<uint64_t> candidates{0};  // children generated
+        std::atomic<uint64_t> rotations{0};   // valid rotations of the children canonicalised
+        std::atomic<uint64_t> inserts{0};     // children inserted into the sets, or counted by hashless runs
+        std::atomic<uint64_t> duplicates{0};  // inserts that found the child already in its set
+
+        // only the owning worker adds, so this needs no atomic read-modify-write
+        static void add(std::atomic<uint64_t> &c, uint64_t v) { c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed); }
+    };
+
+    // one (input shape -> output shape) pair of shapePairs(n)
+    struct Pair {
+        XYZ shape, target;
+        uint64_t size;                    // input cubes
+        std::atomic<uint64_t> done{0};    // input cubes expanded
+        std::atomic<int64_t> startNs{0};  // steady clock time of the first finished chunk
+        Pair(XYZ shape, XYZ target, uint64_t size) : shape(shape), target(target), size(size) {}
+        // a chunk of count cubes is done, called once per chunk
+        void advance(uint64_t count);
+    };
+
+    // hashes are read for the load factors, they may be null for hashless runs
+    Progress(int n, int workers, Hashy *hashes);
+    ~Progress();
+
+    Progress(const Progress &) = delete;
+    Progress &operator=(const Progress &) = delete;
+
+    Counters &worker(int i) { return counters_[i]; }
+    // duplicates found by a thread without counters of its own
+    void addDuplicates(uint64_t v) { sharedDuplicates_.fetch_add(v, std::memory_order_relaxed); }
+
+    // register a pair before its cubes are expanded, returns it with a stable address
+    Pair *addPair(XYZ shape, XYZ target, uint64_t size);
+
+    // append a line to the file at path (stderr if empty) every interval seconds until
+    // stop(). returns false if the file can not be opened.
+    bool start(const std::string &path, double interval);
+    // write the final line and stop the reporter
+    void stop();
+
+    // resident set size of this process in bytes, 0 if unknown
+    static uint64_t rss();
+
+   private:
+    struct Totals {
+        uint64_t parents = 0, candidates = 0, rotations = 0, inserts = 0, duplicates = 0;
+    };
+    Totals totals() const;
+    void report(bool final);
+    void run();
+
+    int n_;
+    Hashy *hashes_;
+    std::vector<Counters> counters_;
+    std::atomic<uint64_t> sharedDuplicates_{0};
+    std::mutex pairsMu_;
+    std::deque<Pair> pairs_;
+    uint64_t queued_ = 0;  // input cubes of all pairs
+
+    std::FILE *out_ = nullptr;
+    std::chrono::duration<double> interval_{1.0};
+    std::chrono::steady_clock::time_point begin_, last_;
+    Totals lastTotals_;
+    bool stop_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
+
+#endif
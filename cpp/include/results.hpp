@@ -14,4 +14,15 @@ static void checkResult(uint32_t n, uint64_t count) {
         }
     }
 }
+
+// polycubes with mirror images identified, OEIS A038119
+uint64_t freeResults[] = {1, 1, 2, 7, 23, 112, 607, 3811, 25413, 178083, 1279537, 9356866, 69513546, 520878101, 3951353343, 30160086649};
+static void checkFreeResult(uint32_t n, uint64_t count) {
+    if (sizeof(freeResults) / sizeof(freeResults[0]) > ((uint64_t)(n - 1)) && n > 1) {
+        if (freeResults[n - 1] != count) {
+            std::printf("ERROR: free polycubes do not equal the table (%lu)!\n\r", freeResults[n - 1]);
+            std::exit(-1);
+        }
+    }
+}
 #endif
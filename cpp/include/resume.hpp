@@ -0,0 +1,77 @@
+#pragma once
+#ifndef OPENCUBES_RESUME_HPP
+#define OPENCUBES_RESUME_HPP
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cube.hpp"
+#include "hashes.hpp"
+#include "shards.hpp"
+
+/**
+ * Resume state of a long gen(n) run: a folder with one snapshot per output shape, holding the
+ * cubes found so far and the (output shape, input shape) pairs (ids into shapePairs(n)) that are
+ * completely in it, with their counts for hashless runs.
+ *
+ * Inserting is idempotent, so a snapshot taken while other pairs of the shape still run is
+ * fine: on resume its cubes are loaded and only the pairs it does not list run again.
+ *
+ * Snapshots are written by a background thread whenever more pairs of a shape are finished.
+ * The sets are copied one subset at a time while the workers go on inserting, and every
+ * snapshot replaces the previous one with a rename once it is on disk.
+ */
+class ResumeWriter {
+   public:
+    // done are the pairs of shapePairs(n) already in the snapshots of dir (from load)
+    ResumeWriter(const std::string &dir, int n, Hashy &hashes, const std::vector<ShapePair> &pairs, const std::map<uint32_t, uint64_t> &done);
+    // writes all snapshots that are still queued
+    ~ResumeWriter();
+
+    ResumeWriter(const ResumeWriter &) = delete;
+    ResumeWriter &operator=(const ResumeWriter &) = delete;
+
+    // all cubes of pair (count of them for hashless) are in the set of target
+    void pairDone(XYZ target, uint32_t pair, uint64_t count);
+    // all pairs of target are done, then() runs on the writer thread after its last snapshot
+    void targetDone(XYZ target, std::function<void()> then);
+    // wait until everything queued is written
+    void flush();
+    // delete the resume state after the run succeeded
+    void remove();
+
+    // folder of the resume state for n
+    static std::string folder(const std::string &basePath, int n);
+    // load the snapshots in dir into hashes and the pairs they include into done.
+    // returns false if there are none.
+    static bool load(const std::string &dir, int n, Hashy &hashes, std::map<uint32_t, uint64_t> &done);
+
+   private:
+    struct Shape {
+        std::vector<std::pair<uint32_t, uint64_t>> pairs;  // done pairs with counts
+        bool queued = false;
+        std::function<void()> then;
+    };
+    void queue(XYZ target, Shape &s);
+    void run();
+    void write(XYZ shape, const std::vector<std::pair<uint32_t, uint64_t>> &pairs);
+
+    std::string dir_;
+    int n_;
+    Hashy &hashes_;
+    std::map<XYZ, Shape> shapes_;
+    std::deque<XYZ> queue_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::mutex mu_;
+    std::condition_variable cv_, idleCv_;
+    std::thread thread_;
+};
+
+#endif
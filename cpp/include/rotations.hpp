@@ -2,6 +2,8 @@
 #ifndef OPENCUBES_ROTATIONS_HPP
 #define OPENCUBES_ROTATIONS_HPP
 #include <array>
+#include <cstdint>
+#include <utility>
 
 #include "cube.hpp"
 
@@ -14,6 +16,54 @@ struct Rotations {
         {1, 2, 0, -1, 1, -1}, {1, 2, 0, 1, -1, -1},  {1, 2, 0, 1, 1, 1},   {2, 0, 1, -1, -1, 1},  {2, 0, 1, -1, 1, -1}, {2, 0, 1, 1, -1, -1},
         {2, 0, 1, 1, 1, 1},   {2, 1, 0, -1, -1, -1}, {2, 1, 0, -1, 1, 1},  {2, 1, 0, 1, -1, 1},   {2, 1, 0, 1, 1, -1},
     };
-    static std::pair<XYZ, bool> rotate(int i, XYZ shape, const Cube &orig, Cube &dest);
+
+    // LUT entry R with its permutation and mirroring as constants, so rotating a point has
+    // no branches and no table loads, and the key of a rotated point folds into it.
+    template <int R>
+    struct Rotation {
+        static constexpr int ix = LUT[R][0], iy = LUT[R][1], iz = LUT[R][2];
+        static constexpr bool mx = LUT[R][3] < 0, my = LUT[R][4] < 0, mz = LUT[R][5] < 0;
+
+        static XYZ shape(XYZ s) { return XYZ(s[ix], s[iy], s[iz]); }
+        static bool keepsSorted(XYZ s) { return s[ix] <= s[iy] && s[iy] <= s[iz]; }
+
+        static XYZ apply(XYZ s, XYZ p) {
+            return XYZ(mx ? s[ix] - p[ix] : p[ix], my ? s[iy] - p[iy] : p[iy], mz ? s[iz] - p[iz] : p[iz]);
+        }
+        // Canonical::key() of the rotated point
+        static int32_t key(XYZ s, XYZ p) { return (uint32_t)apply(s, p); }
+
+        static std::pair<XYZ, bool> rotate(XYZ s, const Cube &orig, Cube &dest) {
+            if (!keepsSorted(s)) return {shape(s), false};  // return here because violating shape
+            auto put = dest.begin();
+            for (const auto &o : orig) *put++ = apply(s, o);
+            return {shape(s), true};
+        }
+    };
+
+    using RotateFn = std::pair<XYZ, bool> (*)(XYZ shape, const Cube &orig, Cube &dest);
+
+    template <size_t... Rs>
+    static constexpr std::array<RotateFn, sizeof...(Rs)> makeRotateTable(std::index_sequence<Rs...>) {
+        return {&Rotation<Rs>::rotate...};
+    }
+
+    // rotation i of shape and orig into dest, if it keeps the shape sorted (x <= y <= z)
+    static std::pair<XYZ, bool> rotate(int i, XYZ shape, const Cube &orig, Cube &dest) {
+        static constexpr auto table = makeRotateTable(std::make_index_sequence<24>());
+        return table[i](shape, orig, dest);
+    }
+
+    // f(std::integral_constant<int, R>()) for all 24 rotations, unrolled
+    template <typename F>
+    static void forEach(F &&f) {
+        forEach(f, std::make_index_sequence<24>());
+    }
+
+   private:
+    template <typename F, size_t... Rs>
+    static void forEach(F &f, std::index_sequence<Rs...>) {
+        (f(std::integral_constant<int, Rs>()), ...);
+    }
 };
 #endif
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef OPENCUBES_SHAPESCHEDULE_HPP
+#define OPENCUBES_SHAPESCHEDULE_HPP
+#include <cstdint>
+#include <vector>
+
+#include "shards.hpp"
+
+/**
+ * Order in which gen() expands the shape pairs of N.
+ *
+ * The pairs form a DAG from the input shapes of N - 1 to the output shapes of N: every
+ * output shape is fed by at most four input shapes, itself and the shapes one smaller in a
+ * single dimension (see shapePairs()). An input shape can be released once the last output
+ * shape using it is expanded.
+ *
+ * With freeEarly the output shapes are picked greedily: next is the one that maps the
+ * fewest cubes of input shapes not in use yet, minus those of the input shapes it is the
+ * last user of, the larger one on a tie. All pairs stay in their own order if that keeps
+ * fewer cubes in use. Otherwise memory does not depend on the order and
+ * all pairs go largest first, so the end of a level is not left with one large pair. The
+ * greedy order expands the pairs of an output shape largest first.
+ */
+class ShapeSchedule {
+   public:
+    // todo are the ids of the pairs to expand, weights the number of cubes of every input
+    // shape (by sid)
+    ShapeSchedule(const std::vector<ShapePair> &pairs, const std::vector<uint32_t> &todo, const std::vector<uint64_t> &weights, bool freeEarly);
+
+    // pair ids in the order they are expanded
+    const std::vector<uint32_t> &order() const { return order_; }
+    // pairs the input shape sid is expanded in
+    uint32_t users(uint32_t sid) const { return sid < users_.size() ? users_[sid] : 0; }
+    // most cubes of input shapes in use at the same time
+    uint64_t peak() const { return peak_; }
+
+    // the same for any pair order, if every input shape is held from its first to its last pair
+    static uint64_t peak(const std::vector<ShapePair> &pairs, const std::vector<uint32_t> &order, const std::vector<uint64_t> &weights);
+
+   private:
+    std::vector<uint32_t> order_;
+    std::vector<uint32_t> users_;
+    uint64_t peak_ = 0;
+};
+
+#endif
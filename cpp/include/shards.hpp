@@ -0,0 +1,105 @@
+#pragma once
+#ifndef OPENCUBES_SHARDS_HPP
+#define OPENCUBES_SHARDS_HPP
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cube.hpp"
+#include "newCache.hpp"
+
+struct GenOptions;
+
+// one (output shape, input shape) pair expanded by gen()
+struct ShapePair {
+    XYZ target;          // output shape
+    uint32_t sid;        // index of the input shape in the N-1 cache
+    XYZ shape;           // input shape
+    XYZ expandDim;       // dimensions growing from shape to target
+    bool notSameShape;   // target is one larger than shape
+};
+
+// all pairs for polycubes with n cubes, grouped by output shape in sorted order
+std::vector<ShapePair> shapePairs(int n);
+
+// cubes [begin, end) of the input shape of a pair
+struct WorkUnit {
+    uint32_t pair;
+    uint64_t begin, end;
+};
+
+/**
+ * Deterministic split of gen(n) into work units, the input of every pair is cut into ranges
+ * of at most unitSize cubes. Every node with the same N-1 input and unitSize numbers the units
+ * the same way, so shards can be addressed by unit id alone.
+ */
+class ShardPlan {
+   public:
+    // hashless units only count, the others write their cubes to unit files
+    ShardPlan(int n, ICache &base, uint64_t unitSize, bool hashless);
+
+    int n() const { return n_; }
+    uint64_t unitSize() const { return unitSize_; }
+    bool hashless() const { return hashless_; }
+    const std::vector<ShapePair> &pairs() const { return pairs_; }
+    const std::vector<WorkUnit> &units() const { return units_; }
+
+    // units of shard "i/k" (every k-th unit starting at i). false if spec is malformed.
+    bool selectShard(const std::string &spec, std::vector<uint32_t> &ids) const;
+    // units listed in a text file, one id or range "a-b" per line, '#' starts a comment.
+    bool selectList(const std::string &path, std::vector<uint32_t> &ids) const;
+
+    // partial output of a unit, the polycubes it generated for its output shape
+    std::string unitFile(const std::string &basePath, uint32_t id) const;
+    // checkpoint of the units selected by shard spec or unit list
+    std::string checkpointFile(const std::string &basePath, const std::string &shard, const std::string &unitList) const;
+
+   private:
+    int n_;
+    uint64_t unitSize_;
+    bool hashless_;
+    std::vector<ShapePair> pairs_;
+    std::vector<WorkUnit> units_;
+};
+
+/**
+ * Text log of finished units. The first line identifies the plan (N, unit size, number of
+ * units and hashless), then every finished unit is appended as "<id> <count>" and synced to
+ * disk once its output file is in place, so a killed shard resumes without redoing them.
+ */
+class Checkpoint {
+   public:
+    Checkpoint() = default;
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint &) = delete;
+    Checkpoint &operator=(const Checkpoint &) = delete;
+
+    // read the finished units of path (if it exists) and open it for appending.
+    // returns false if it was written for a different plan.
+    bool open(const std::string &path, const ShardPlan &plan);
+    // only read path, false if it does not exist or belongs to a different plan
+    static bool read(const std::string &path, const ShardPlan &plan, std::map<uint32_t, uint64_t> &finished);
+
+    bool done(uint32_t id) const { return finished_.count(id) != 0; }
+    void record(uint32_t id, uint64_t count);
+    const std::map<uint32_t, uint64_t> &finished() const { return finished_; }
+
+   private:
+    std::FILE *file_ = nullptr;
+    std::string path_;
+    std::map<uint32_t, uint64_t> finished_;
+};
+
+// unit size in the plan line of the first checkpoint for N in basePath, 0 if there is none.
+// -m merges with it, the shards may have run with another -z than the merge.
+uint64_t shardUnitSize(const std::string &basePath, int n);
+
+// Combine the checkpoints and unit files of all shards in opts.base_path into the result for
+// N, written to the cache file with opts.write_cache. counts are summed for hashless plans,
+// unit files are merged shape by shape otherwise. returns false if units are missing.
+bool mergeShards(const ShardPlan &plan, const GenOptions &opts, uint64_t &totalSum);
+
+#endif
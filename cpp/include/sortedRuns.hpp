@@ -0,0 +1,87 @@
+#pragma once
+#ifndef OPENCUBES_SORTEDRUNS_HPP
+#define OPENCUBES_SORTEDRUNS_HPP
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cube.hpp"
+
+/**
+ * Deduplicates the polycubes of one output shape by sorting instead of a hash set.
+ *
+ * Every worker appends packed cubes to its own buffer. A full buffer is sorted and
+ * deduplicated into a run, and when the runs of all shapes together exceed the memory
+ * budget, the runs of the shape adding the last one are merged into a file next to the
+ * cache. Once the shape is finished, merge() combines the runs in memory and on disk with
+ * a k-way merge that drops duplicates, so the cubes come out sorted, ready to be written as
+ * the block of the shape.
+ */
+class SortedRuns {
+   public:
+    // bytes of runs and buffers of all shapes
+    struct Budget {
+        uint64_t limit = 0;  // 0 for no limit
+        std::atomic<uint64_t> used{0};
+        std::atomic<uint64_t> spilled{0};  // bytes written to run files
+    };
+    using Sink = std::function<void(const uint64_t *words)>;
+
+    // runs of polycubes with n cubes of shape, from workers threads. run files go to folder.
+    SortedRuns(int n, XYZ shape, int workers, Budget &budget, const std::string &folder);
+    ~SortedRuns();
+
+    SortedRuns(const SortedRuns &) = delete;
+    SortedRuns &operator=(const SortedRuns &) = delete;
+
+    // append count packed cubes (packedWords(n) words each) on worker
+    void add(int worker, const uint64_t *keys, size_t count);
+
+    // pass all distinct cubes to sink in ascending order and return their number, with up
+    // to threads threads. only call once, after the last add().
+    uint64_t merge(const Sink &sink, int threads);
+
+    // sort count records of words words each and drop duplicates, returns how many are left
+    static size_t sortUnique(uint64_t *records, size_t count, int words);
+
+    // records are compared word by word, like PackedCube
+    static bool less(const uint64_t *a, const uint64_t *b, int words) {
+        for (int i = 0; i < words; ++i)
+            if (a[i] != b[i]) return a[i] < b[i];
+        return false;
+    }
+
+    // buffers are sealed into runs at this size, or less with a small budget
+    static constexpr uint64_t RUN_BYTES = 16 << 20;
+    // targets with fewer cubes are merged by one thread
+    static constexpr uint64_t PARALLEL_MERGE = 1 << 20;
+
+   private:
+    struct Run {
+        std::vector<uint64_t> records;  // in memory
+        std::string file;               // or on disk
+        uint64_t count = 0;
+    };
+    // a sorted range of records, mapped if the run is on disk
+    struct Span {
+        const uint64_t *begin, *end;
+    };
+    void seal(std::vector<uint64_t> &buffer);
+    void spill();
+    static uint64_t mergeSpans(std::vector<Span> spans, int words, const Sink &sink);
+
+    const int n_, words_;
+    const XYZ shape_;
+    Budget &budget_;
+    const std::string folder_;
+    uint64_t runBytes_;
+    std::vector<std::vector<uint64_t>> buffers_;  // by worker
+    std::mutex mu_;
+    std::vector<Run> runs_;
+    int files_ = 0;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+#ifndef OPENCUBES_WORKPOOL_HPP
+#define OPENCUBES_WORKPOOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Persistent thread pool with per worker deques and work stealing.
+ *
+ * A job is a range of items [0, count). It is queued as a single task and split lazily:
+ * a worker taking a task larger than the job's grain pushes the upper half back to its
+ * own deque and continues with the lower half. Workers pop their own deque from the back
+ * (small, recently split ranges) and steal from the front of other deques (the largest
+ * ranges that are left), so chunks shrink as the remaining work runs out and no worker
+ * idles while any job still has items left.
+ *
+ * With a NumaTopology every worker is pinned to the cpus of a node, jobs start with one
+ * slice per node and workers steal from the workers of their own node first, so the items
+ * of a job are mostly processed on the node that started with them.
+ */
+class NumaTopology;
+
+class WorkPool {
+   public:
+    // processes items [begin, end) of a job on worker number worker
+    using Body = std::function<void(size_t begin, size_t end, int worker)>;
+
+    explicit WorkPool(int threads, const NumaTopology *numa = nullptr);
+    ~WorkPool();
+
+    WorkPool(const WorkPool &) = delete;
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    // queue items [0, count) for body. done (if set) runs once on the worker finishing the
+    // last item, or right away if count is 0. both have to stay valid until wait() returned.
+    void submit(size_t count, Body body, std::function<void()> done = {});
+    // blocks until all submitted items are processed
+    void wait();
+
+    int threads() const { return workers_.size(); }
+    // NUMA node of worker, always 0 without topology
+    int node(int worker) const { return node_[worker]; }
+
+    // chunks get never smaller or larger than this, unless a job is smaller
+    static constexpr size_t MIN_GRAIN = 16;
+    static constexpr size_t MAX_GRAIN = 512;
+
+   private:
+    struct Job {
+        Job(Body body, std::function<void()> done, size_t grain, size_t count) : body(std::move(body)), done(std::move(done)), grain(grain), remaining(count) {}
+        Body body;
+        std::function<void()> done;
+        size_t grain;
+        std::atomic<size_t> remaining;
+    };
+    struct Task {
+        Job *job;
+        size_t begin, end;
+    };
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> tasks;
+    };
+
+    void push(int worker, Task t);
+    bool pop(int worker, Task &t);
+    bool steal(int worker, Task &t);
+    void run(int worker);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::vector<int> node_;                // by worker
+    std::vector<std::vector<int>> byNode_;  // workers of every node
+    std::vector<int> nextQueue_;           // by node
+    size_t nextNode_ = 0;
+    std::deque<Job> jobs_;  // stable addresses, released in wait()
+
+    std::atomic<size_t> queued_{0};       // tasks in all queues
+    std::atomic<size_t> outstanding_{0};  // items not yet processed
+    std::atomic<int> idle_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex sleepMu_;
+    std::condition_variable sleepCv_;
+    std::mutex doneMu_;
+    std::condition_variable doneCv_;
+};
+
+#endif
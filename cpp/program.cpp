@@ -1,22 +1,113 @@
 #include <iostream>
 
+#include "cache.hpp"
+#include "canonical.hpp"
 #include "cmdparser.hpp"
 #include "cubes.hpp"
 
 void configure_arguments(cli::Parser& parser) {
-    parser.set_required<int>("n", "cube_size", "the size of polycube to generate up to");
+    parser.set_required<int>("n", "cube_size", "the size of polycube to generate up to, at most 32");
     parser.set_optional<int>("t", "threads", 1, "the number of threads to use while generating");
     parser.set_optional<bool>("c", "use_cache", false, "whether to load cache files");
     parser.set_optional<bool>("w", "write_cache", false, "wheather to save cache files");
     parser.set_optional<bool>("s", "split_cache", false, "wheather to save in sparate cache files per output shape");
     parser.set_optional<bool>("u", "use_split_cache", false, "use separate cachefile by input shape");
+    parser.set_optional<bool>("l", "hashless", false, "count N by canonical parent without storing the generated cubes");
+    parser.set_optional<bool>("o", "count_only", false, "only count N, with chiral pairs and symmetry classes, storing nothing but N-1");
+    parser.set_optional<bool>("d", "direct_io", false, "write cache files (and stream them in with -i stream) with O_DIRECT, bypassing the page cache");
+    parser.set_optional<bool>("p", "pcube", false, "use compressed .pcube cache files, readable by the rust and python versions");
+    parser.set_optional<std::string>("k", "shard", "", "run only work units i, i+k, i+2k, ... of N, given as i/k");
+    parser.set_optional<std::string>("L", "unit_list", "", "run only the work units of N listed in this file");
+    parser.set_optional<int>("z", "unit_size", 1 << 20, "input cubes per work unit of a shard");
+    parser.set_optional<bool>("m", "merge", false, "combine the finished work units of all shards of N");
+    parser.set_optional<bool>("C", "checkpoint", false, "keep snapshots of the sets while generating, to continue a killed run with -r");
+    parser.set_optional<bool>("r", "resume", false, "continue from the snapshots of a killed run (and keep writing them)");
+    parser.set_optional<double>("P", "progress", 0, "write json progress lines every this many seconds (fractions allowed), 0 for none");
+    parser.set_optional<std::string>("O", "progress_file", "", "append the progress lines to this file instead of stderr");
+    parser.set_optional<std::string>("i", "input", "readahead", "how to read the cache file of N-1: mmap, readahead or stream");
+    parser.set_optional<bool>("H", "huge_pages", false, "ask for transparent huge pages on the mapped cache file of N-1");
+    parser.set_optional<bool>("N", "numa", false, "pin the threads to NUMA nodes and insert every cube on the node owning its set");
+    parser.set_optional<std::string>("D", "dedup", "hash", "deduplicate with hash sets, or sort: sorted runs merged per output shape (needs -w)");
+    parser.set_optional<int>("M", "mem_limit", 0, "MiB of sorted runs kept in memory before they are spilled to disk, 0 for no limit");
+    parser.set_optional<bool>("x", "pipeline", false, "generate N-1 next to N and expand its shapes as they are finished, without a cache in between");
+    parser.set_optional<bool>("S", "sorted_cache", false, "sort the cubes of every shape in the cache files, so cubes can be looked up in them");
+    parser.set_optional<int>("B", "mem_budget", 0, "MiB the run may use, -1 for the cgroup limit or physical memory: throttles, spills and streams N-1 to stay below, 0 for none");
+    parser.set_optional<bool>("Y", "symmetry", false, "expand only one of the cells a symmetry of the parent maps onto each other");
+    parser.set_optional<bool>("G", "gpu", false, "expand the cubes on the gpu, needs a build with -DCUBES_CUDA=ON");
+    parser.set_optional<bool>("V", "verify", false, "only load the cache file of N, dropping duplicates and non-canonical cubes, and count it");
     parser.set_optional<std::string>("f", "cache_file_folder", "./cache/", "where to store cache files");
+    parser.set_optional<std::string>("e", "engine", "auto", "canonicalisation engine: scalar, avx2, avx512 or auto for the fastest the cpu supports");
 }
 
 int main(int argc, char** argv) {
     cli::Parser parser(argc, argv);
     configure_arguments(parser);
     parser.run_and_exit_if_error();
-    gen(parser.get<int>("n"), parser.get<int>("t"), parser.get<bool>("c"), parser.get<bool>("w"), parser.get<bool>("s"), parser.get<bool>("u"), parser.get<std::string>("f"));
+    if (!Canonical::select(parser.get<std::string>("e"))) {
+        std::printf("canonicalisation engine \"%s\" is not available\n", parser.get<std::string>("e").c_str());
+        return 1;
+    }
+    std::printf("canonicalisation engine: %s\n", Canonical::selected().name);
+    GenOptions opts;
+    opts.threads = parser.get<int>("t");
+    opts.use_cache = parser.get<bool>("c");
+    opts.write_cache = parser.get<bool>("w");
+    opts.split_cache = parser.get<bool>("s");
+    opts.use_split_cache = parser.get<bool>("u");
+    opts.base_path = parser.get<std::string>("f");
+    opts.hashless = parser.get<bool>("l");
+    opts.count_only = parser.get<bool>("o");
+    opts.direct_io = parser.get<bool>("d");
+    opts.pcube = parser.get<bool>("p");
+    opts.shard = parser.get<std::string>("k");
+    opts.unit_list = parser.get<std::string>("L");
+    opts.unit_size = parser.get<int>("z");
+    opts.merge = parser.get<bool>("m");
+    opts.checkpoint = parser.get<bool>("C");
+    opts.resume = parser.get<bool>("r");
+    opts.progress = parser.get<double>("P");
+    opts.progress_file = parser.get<std::string>("O");
+    opts.input = parser.get<std::string>("i");
+    opts.huge_pages = parser.get<bool>("H");
+    opts.numa = parser.get<bool>("N");
+    opts.dedup = parser.get<std::string>("D");
+    opts.pipeline = parser.get<bool>("x");
+    opts.sorted_cache = parser.get<bool>("S");
+    opts.gpu = parser.get<bool>("G");
+    opts.symmetry = parser.get<bool>("Y");
+    opts.mem_budget = parser.get<int>("B");
+    if (opts.dedup != "hash" && opts.dedup != "sort") {
+        std::printf("deduplication \"%s\" is not available\n", opts.dedup.c_str());
+        return 1;
+    }
+    if (parser.get<int>("M") < 0) {
+        std::printf("the memory limit of the sorted runs (-M) can not be negative\n");
+        return 1;
+    }
+    opts.mem_limit = parser.get<int>("M");
+    if (opts.dedup == "sort" && (!opts.write_cache || opts.hashless || opts.count_only)) {
+        std::printf("sort deduplication needs -w and can not be combined with -l or -o\n");
+        return 1;
+    }
+    if (opts.gpu && opts.symmetry) {
+        std::printf("the gpu expansion does not prune symmetric parents, -G can not be combined with -Y\n");
+        return 1;
+    }
+    if (opts.input != "mmap" && opts.input != "readahead" && opts.input != "stream") {
+        std::printf("input mode \"%s\" is not available\n", opts.input.c_str());
+        return 1;
+    }
+    if (parser.get<bool>("V")) {
+        const int n = parser.get<int>("n");
+        const std::string path = opts.base_path + "cubes_" + std::to_string(n) + ".bin";
+        auto hashes = Cache::load(path, Cache::ALL_SHAPES, opts.threads, true);
+        if (hashes.byshape.empty()) {
+            std::printf("could not load %s\n", path.c_str());
+            return 1;
+        }
+        std::printf("%s holds %lu valid cubes\n", path.c_str(), hashes.size());
+        return 0;
+    }
+    gen(parser.get<int>("n"), opts);
     return 0;
 }
@@ -1,11 +1,14 @@
 #include "cache.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
-#include <fstream>
-#include <limits>
+#include <atomic>
 #include <string>
-#include <unordered_set>
 
+#include "cacheWriter.hpp"
+#include "workPool.hpp"
 #include "utils.hpp"
 
 /*
@@ -25,8 +28,9 @@ shapeEntry {
     uint8_t dim0 // offset by -1
     uint8_t dim1 // offset by -1
     uint8_t dim2 // offset by -1
-    uint8_t reserved
+    uint8_t flags // 1 if the XYZs of the shape are sorted (as FrozenShape sorts them), else 0
     uint64_t offset in file
+    uint64_t size in bytes
 }
 shapeEntry[numShapes]
 
@@ -34,62 +38,46 @@ shapeEntry[numShapes]
 ====================
 XYZ data
 ====================
+the blocks of the shapes, in any order (CacheWriter writes them as they are finished)
 
 */
 
 void Cache::save(std::string path, Hashy &hashes, uint8_t n) {
     if (hashes.size() == 0) return;
-    std::ofstream ofs(path, std::ios::binary);
-    Header header;
-    header.magic = MAGIC;
-    header.n = n;
-    header.numShapes = hashes.byshape.size();
-    header.numPolycubes = hashes.size();
-    ofs.write((const char *)&header, sizeof(header));
-
     std::vector<XYZ> keys;
-    keys.reserve(header.numShapes);
+    keys.reserve(hashes.byshape.size());
     for (auto &pair : hashes.byshape) keys.push_back(pair.first);
     std::sort(keys.begin(), keys.end());
-    uint64_t offset = sizeof(Header) + header.numShapes * sizeof(ShapeEntry);
-    for (auto &key : keys) {
-        ShapeEntry se;
-        se.dim0 = key.x();
-        se.dim1 = key.y();
-        se.dim2 = key.z();
-        se.reserved = 0;
-        se.offset = offset;
-        se.size = hashes.byshape[key].size() * XYZ_SIZE * n;
-        offset += se.size;
-        ofs.write((const char *)&se, sizeof(ShapeEntry));
-    }
-    // put XYZs
-    for (auto &key : keys) {
-        for (auto &subset : hashes.byshape[key].byhash)
-            for (const auto &c : subset.set) {
-                if constexpr (sizeof(XYZ) == XYZ_SIZE) {
-                    ofs.write((const char *)c.data(), sizeof(XYZ) * c.size());
-                } else {
-                    for (const auto &p : c) {
-                        ofs.write((const char *)p.data, XYZ_SIZE);
-                    }
-                }
-            }
-    }
+    // loaded shapes are frozen and know their N, it wins over the one passed
+    for (auto &[shape, set] : hashes.byshape)
+        if (set.frozen) n = set.frozen->n();
+    CacheWriter writer;
+    if (!writer.open(path, n, keys)) return;
+    for (auto &key : keys) writer.writeShape(key, hashes.byshape[key]);
+    writer.close();
+}
 
-    std::printf("saved %s\n\r", path.c_str());
+// read exactly len bytes at offset
+static bool preadAll(int fd, void *buf, size_t len, uint64_t offset) {
+    auto p = (uint8_t *)buf;
+    while (len) {
+        auto r = pread(fd, p, len, offset);
+        if (r <= 0) return false;
+        p += r;
+        len -= r;
+        offset += r;
+    }
+    return true;
 }
 
-Hashy Cache::load(std::string path, uint32_t extractShape) {
+Hashy Cache::load(std::string path, uint32_t extractShape, int threads, bool verify) {
     Hashy cubes;
-    auto ifs = std::ifstream(path, std::ios::binary);
-    if (!ifs.is_open()) return cubes;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return cubes;
     Header header;
-    if (!ifs.read((char *)&header, sizeof(header))) {
-        return cubes;
-    }
     // check magic
-    if (header.magic != MAGIC) {
+    if (!preadAll(fd, &header, sizeof(header), 0) || header.magic != MAGIC) {
+        close(fd);
         return cubes;
     }
 #ifdef CACHE_LOAD_HEADER_ONLY
@@ -99,12 +87,14 @@ Hashy Cache::load(std::string path, uint32_t extractShape) {
     auto cubeSize = XYZ_SIZE * header.n;
     DEBUG_PRINTF("cubeSize: %u\n\r", cubeSize);
 
+    std::vector<ShapeEntry> shapeEntries(header.numShapes);
+    if (!preadAll(fd, shapeEntries.data(), shapeEntries.size() * sizeof(ShapeEntry), sizeof(header))) {
+        std::printf("ERROR reading the shape table of %s\n\r", path.c_str());
+        exit(-1);
+    }
+    std::vector<uint32_t> selected;
     for (uint32_t i = 0; i < header.numShapes; ++i) {
-        ShapeEntry shapeEntry;
-        if (!ifs.read((char *)&shapeEntry, sizeof(shapeEntry))) {
-            std::printf("ERROR reading ShapeEntry %u\n\r", i);
-            exit(-1);
-        }
+        auto &shapeEntry = shapeEntries[i];
         if (ALL_SHAPES != extractShape && i != extractShape) continue;
 #ifdef CACHE_PRINT_SHAPEENTRIES
         std::printf("ShapeEntry %3u: [%2d %2d %2d] offset: 0x%08lx size: 0x%08lx (%ld polycubes)\n\r", i, shapeEntry.dim0, shapeEntry.dim1, shapeEntry.dim2,
@@ -114,50 +104,35 @@ Hashy Cache::load(std::string path, uint32_t extractShape) {
             std::printf("ERROR shape block is not divisible by cubeSize!\n\r");
             exit(-1);
         }
+        selected.push_back(i);
+        cubes.byshape.try_emplace(XYZ(shapeEntry.dim0, shapeEntry.dim1, shapeEntry.dim2), 0);
+    }
 #ifndef CACHE_LOAD_HEADER_ONLY
-        // remember pos in file
-        auto pos = ifs.tellg();
-
-        // read XYZ contents
-        ifs.seekg(shapeEntry.offset);
-        const uint32_t CHUNK_SIZE = 512 * XYZ_SIZE;
-        uint8_t buf[CHUNK_SIZE] = {0};
-        uint64_t buf_offset = 0;
-        uint32_t numCubes = shapeEntry.size / cubeSize;
-        XYZ shape(shapeEntry.dim0, shapeEntry.dim1, shapeEntry.dim2);
-        uint64_t readsize = shapeEntry.size - buf_offset;
-        if (readsize > CHUNK_SIZE) readsize = CHUNK_SIZE;
-        if (!ifs.read((char *)&buf, readsize)) {
-            std::printf("ERROR reading XYZs for Shape %u\n\r", i);
-            exit(-1);
-        }
-        for (uint32_t j = 0; j < numCubes; ++j) {
-            Cube next(header.n);
-            for (uint32_t k = 0; k < header.n; ++k) {
-                // check if buf contains next XYZ
-                uint64_t curr_offset = j * cubeSize + k * XYZ_SIZE;
-                if (curr_offset >= buf_offset + CHUNK_SIZE) {
-                    // std::printf("reload buffer\n\r");
-                    buf_offset += CHUNK_SIZE;
-                    readsize = shapeEntry.size - buf_offset;
-                    if (readsize > CHUNK_SIZE) readsize = CHUNK_SIZE;
-                    if (!ifs.read((char *)&buf, readsize)) {
-                        std::printf("ERROR reading XYZs for Shape %u\n\r", i);
-                        exit(-1);
-                    }
-                }
-
-                next.data()[k].data[0] = buf[curr_offset - buf_offset + 0];
-                next.data()[k].data[1] = buf[curr_offset - buf_offset + 1];
-                next.data()[k].data[2] = buf[curr_offset - buf_offset + 2];
+    // Every block is read in one go and frozen as it is: the file has no duplicates, so the
+    // cubes are not inserted one by one. Blocks not written sorted are sorted, and with verify
+    // duplicates and cubes that are not canonical are dropped.
+    std::atomic<uint64_t> dropped = 0;
+    WorkPool pool(threads);
+    pool.submit(selected.size(), [&](size_t begin, size_t end, int) {
+        for (size_t k = begin; k < end; ++k) {
+            auto &shapeEntry = shapeEntries[selected[k]];
+            XYZ shape(shapeEntry.dim0, shapeEntry.dim1, shapeEntry.dim2);
+            std::vector<XYZ> xyzs(shapeEntry.size / XYZ_SIZE);
+            if (!preadAll(fd, xyzs.data(), shapeEntry.size, shapeEntry.offset)) {
+                std::printf("ERROR reading XYZs for Shape %u\n\r", selected[k]);
+                exit(-1);
             }
-            cubes.insert(next, shape);
+            auto frozen = std::make_shared<FrozenShape>(std::move(xyzs), header.n, shape, shapeEntry.flags & SORTED);
+            if (verify) dropped += frozen->removeInvalid();
+            auto &set = cubes.byshape[shape];
+            set.frozenSize = frozen->size();
+            set.frozen = std::move(frozen);
         }
-
-        // restore pos
-        ifs.seekg(pos);
+    });
+    pool.wait();
+    if (dropped) std::printf("  dropped %lu duplicate or invalid cubes\n\r", dropped.load());
 #endif
-    }
+    close(fd);
     std::printf("  loaded %lu cubes\n\r", cubes.size());
     return cubes;
 }
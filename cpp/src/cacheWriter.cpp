@@ -0,0 +1,172 @@
+#include "cacheWriter.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+static_assert(sizeof(XYZ) == Cache::XYZ_SIZE, "cache files store XYZs as they are in memory");
+
+void CacheWriter::Free::operator()(uint8_t *p) const { std::free(p); }
+
+CacheWriter::CacheWriter() : buf_((uint8_t *)std::aligned_alloc(ALIGNMENT, BUFFER_SIZE)) {}
+
+CacheWriter::~CacheWriter() { close(); }
+
+bool CacheWriter::open(const std::string &path, uint8_t n, const std::vector<XYZ> &shapes, bool direct) {
+    close();
+    direct_ = false;
+    if (direct) {
+#ifdef O_DIRECT
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        direct_ = fd_ >= 0;
+#endif
+        if (!direct_) std::printf("O_DIRECT not available for %s, using buffered writes\n\r", path.c_str());
+    }
+    if (fd_ < 0) fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        std::printf("ERROR could not create cache file %s\n\r", path.c_str());
+        return false;
+    }
+    path_ = path;
+    n_ = n;
+    numPolycubes_ = 0;
+    table_.clear();
+    for (auto &s : shapes) {
+        Cache::ShapeEntry se;
+        std::memset(&se, 0, sizeof(se));
+        se.dim0 = s.x();
+        se.dim1 = s.y();
+        se.dim2 = s.z();
+        table_.push_back(se);
+    }
+    // the data starts behind the shape table, aligned for O_DIRECT
+    fileOffset_ = sizeof(Cache::Header) + table_.size() * sizeof(Cache::ShapeEntry);
+    if (direct_) fileOffset_ = (fileOffset_ + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+    fill_ = 0;
+    return true;
+}
+
+void CacheWriter::beginShape(XYZ shape) {
+    current_ = nullptr;
+    for (auto &se : table_)
+        if (XYZ(se.dim0, se.dim1, se.dim2) == shape) current_ = &se;
+    if (!current_ || current_->offset != 0) {
+        std::printf("ERROR shape [%2d %2d %2d] is not in the shape table of %s or already written\n\r", shape.x(), shape.y(), shape.z(), path_.c_str());
+        exit(-1);
+    }
+    current_->offset = fileOffset_ + fill_;
+}
+
+void CacheWriter::append(const FlatCubeSet::Entry &c) {
+    const size_t bytes = c.size() * Cache::XYZ_SIZE;
+    if (fill_ + bytes > BUFFER_SIZE) flush(false);
+    c.unpack((XYZ *)(buf_.get() + fill_));
+    fill_ += bytes;
+    current_->size += bytes;
+    numPolycubes_++;
+}
+
+void CacheWriter::append(const XYZ *xyzs, uint64_t count, int n) {
+    const uint8_t *src = (const uint8_t *)xyzs;
+    uint64_t bytes = count * n * Cache::XYZ_SIZE;
+    current_->size += bytes;
+    numPolycubes_ += count;
+    while (bytes > 0) {
+        if (fill_ == BUFFER_SIZE) flush(false);
+        const size_t part = std::min<uint64_t>(bytes, BUFFER_SIZE - fill_);
+        std::memcpy(buf_.get() + fill_, src, part);
+        fill_ += part;
+        src += part;
+        bytes -= part;
+    }
+}
+
+void CacheWriter::writeFrozen(XYZ shape, const FrozenShape &frozen) {
+    // the block is copied as it is, so it has to hold cubes of the file's N
+    assert(frozen.n() == n_);
+    if (frozen.n() != n_) {
+        std::printf("ERROR frozen shape [%2d %2d %2d] has %d cubes, the cache file is for N = %d\n\r", shape.x(), shape.y(), shape.z(), frozen.n(), n_);
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    beginShape(shape);
+    append(frozen.data(), frozen.size(), frozen.n());
+    endShape(true);
+}
+
+void CacheWriter::endShape(bool sorted) {
+    if (sorted) current_->flags |= Cache::SORTED;
+    // empty shapes keep offset 0 like the table entries that are never written
+    if (current_->size == 0) current_->offset = 0;
+    current_ = nullptr;
+}
+
+void CacheWriter::flush(bool final) {
+    size_t len = fill_ & ~(ALIGNMENT - 1);
+    if (final && fill_ > len) {
+        if (direct_) {
+            // O_DIRECT writes whole blocks, the padding is cut off again in close()
+            len = (fill_ + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+            std::memset(buf_.get() + fill_, 0, len - fill_);
+        } else {
+            len = fill_;
+        }
+    }
+    if (len) writeAll(buf_.get(), len, fileOffset_);
+    if (len >= fill_) {
+        fileOffset_ += fill_;
+        fill_ = 0;
+    } else {
+        std::memmove(buf_.get(), buf_.get() + len, fill_ - len);
+        fileOffset_ += len;
+        fill_ -= len;
+    }
+}
+
+void CacheWriter::writeAll(const uint8_t *data, size_t len, uint64_t offset) {
+    while (len) {
+        auto w = pwrite(fd_, data, len, offset);
+        if (w <= 0) {
+            std::printf("ERROR writing cache file %s: %s\n\r", path_.c_str(), std::strerror(errno));
+            exit(-1);
+        }
+        data += w;
+        len -= w;
+        offset += w;
+    }
+}
+
+void CacheWriter::close() {
+    if (fd_ < 0) return;
+    flush(true);
+    if (direct_) {
+        if (ftruncate(fd_, fileOffset_) != 0) {
+            std::printf("ERROR truncating cache file %s\n\r", path_.c_str());
+            exit(-1);
+        }
+        // header and table are not block aligned
+        ::close(fd_);
+        fd_ = ::open(path_.c_str(), O_WRONLY);
+        if (fd_ < 0) {
+            std::printf("ERROR reopening cache file %s\n\r", path_.c_str());
+            exit(-1);
+        }
+        direct_ = false;
+    }
+    Cache::Header header;
+    std::memset((void *)&header, 0, sizeof(header));  // no stray bytes in the padding
+    header.magic = Cache::MAGIC;
+    header.n = n_;
+    header.numShapes = table_.size();
+    header.numPolycubes = numPolycubes_;
+    writeAll((const uint8_t *)&header, sizeof(header), 0);
+    writeAll((const uint8_t *)table_.data(), table_.size() * sizeof(Cache::ShapeEntry), sizeof(header));
+    ::close(fd_);
+    fd_ = -1;
+    std::printf("saved %s\n\r", path_.c_str());
+}
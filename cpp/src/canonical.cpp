@@ -0,0 +1,108 @@
+#include "canonical.hpp"
+
+#include <algorithm>
+#include <climits>
+
+XYZ Canonical::scalar(const XYZ *points, int n, XYZ shape, XYZ *out) {
+    const auto &K = ROTATION_KEYS;
+    const int cls = rotationClass(shape);
+    int32_t keys[128], best[128];
+    int bestRot = -1;
+    for (int j = 0; j < ROTATION_CLASSES.count[cls]; ++j) {
+        const int r = ROTATION_CLASSES.rot[cls][j];
+        const int32_t off = shape.x() * K.offx[r] + shape.y() * K.offy[r] + shape.z() * K.offz[r];
+        int32_t lowest = INT32_MAX;
+        for (int i = 0; i < n; ++i) {
+            keys[i] = points[i].x() * K.mx[r] + points[i].y() * K.my[r] + points[i].z() * K.mz[r] + off;
+            lowest = std::min(lowest, keys[i]);
+        }
+        // the smallest key comes first when sorted, a smaller one can not win
+        if (bestRot >= 0 && lowest < best[0]) continue;
+        std::sort(keys, keys + n);
+        if (bestRot < 0 || std::lexicographical_compare(best, best + n, keys, keys + n)) {
+            std::copy(keys, keys + n, best);
+            bestRot = r;
+        }
+    }
+    for (int i = 0; i < n; ++i) out[i] = fromKey(best[i]);
+    return rotatedShape(bestRot, shape);
+}
+
+uint32_t Canonical::stabiliser(const XYZ *canonical, int n, XYZ shape) {
+    const auto &K = ROTATION_KEYS;
+    const uint32_t valid = validRotations(shape);
+    int32_t self[128], keys[128];
+    for (int i = 0; i < n; ++i) self[i] = key(canonical[i]);
+    // the identity always does. a rotation keeping the polycube has to keep its (sorted) shape.
+    uint32_t mask = 1;
+    for (int r = 1; r < 24; ++r) {
+        if (!(valid & (1u << r))) continue;
+        const int32_t off = shape.x() * K.offx[r] + shape.y() * K.offy[r] + shape.z() * K.offz[r];
+        int32_t lowest = INT32_MAX;
+        for (int i = 0; i < n; ++i) {
+            keys[i] = canonical[i].x() * K.mx[r] + canonical[i].y() * K.my[r] + canonical[i].z() * K.mz[r] + off;
+            lowest = std::min(lowest, keys[i]);
+        }
+        // the smallest key has to stay the first one
+        if (lowest != self[0]) continue;
+        std::sort(keys, keys + n);
+        if (std::equal(keys, keys + n, self)) mask |= 1u << r;
+    }
+    return mask;
+}
+
+Canonical::Symmetry Canonical::symmetry(const XYZ *canonical, int n, XYZ shape) {
+    Symmetry sym{__builtin_popcount(stabiliser(canonical, n, shape)), true};
+    XYZ mirrored[128], mirroredCanonical[128];
+    for (int i = 0; i < n; ++i) mirrored[i] = XYZ(shape.x() - canonical[i].x(), canonical[i].y(), canonical[i].z());
+    canonicalize(mirrored, n, shape, mirroredCanonical);
+    sym.chiral = !std::equal(mirroredCanonical, mirroredCanonical + n, canonical);
+    return sym;
+}
+
+#ifndef CUBES_X86_KERNELS
+// no SIMD kernels for this architecture
+XYZ Canonical::avx2(const XYZ *points, int n, XYZ shape, XYZ *out) { return scalar(points, n, shape, out); }
+XYZ Canonical::avx512(const XYZ *points, int n, XYZ shape, XYZ *out) { return scalar(points, n, shape, out); }
+#endif
+
+static bool always() { return true; }
+
+#ifdef CUBES_X86_KERNELS
+static bool hasAVX2() { return __builtin_cpu_supports("avx2"); }
+static bool hasAVX512() { return __builtin_cpu_supports("avx512f"); }
+#endif
+
+const std::vector<Canonical::Engine> &Canonical::engines() {
+    static const std::vector<Engine> all = {
+        {"scalar", &Canonical::scalar, &always},
+#ifdef CUBES_X86_KERNELS
+        {"avx2", &Canonical::avx2, &hasAVX2},
+        {"avx512", &Canonical::avx512, &hasAVX512},
+#endif
+    };
+    return all;
+}
+
+const Canonical::Engine &Canonical::best() {
+    const Engine *fastest = &engines().front();
+    for (auto &e : engines())
+        if (e.supported()) fastest = &e;
+    return *fastest;
+}
+
+bool Canonical::select(const std::string &name) {
+    if (name == "auto") {
+        current = &best();
+        return true;
+    }
+    for (auto &e : engines()) {
+        if (name == e.name && e.supported()) {
+            current = &e;
+            return true;
+        }
+    }
+    return false;
+}
+
+const Canonical::Engine *Canonical::current = &Canonical::best();
@@ -0,0 +1,104 @@
+// compiled with -mavx2, only called when the cpu supports it.
+#include <immintrin.h>
+
+#include <utility>
+
+#include "canonical.hpp"
+
+namespace {
+
+inline void cmpSwap(__m256i &a, __m256i &b) {
+    __m256i lo = _mm256_min_epi32(a, b);
+    b = _mm256_max_epi32(a, b);
+    a = lo;
+}
+
+// sort each lane of keys[0..N) with a fully unrolled sorting network
+template <int N, size_t... Is>
+inline void sortLanes(__m256i *keys, std::index_sequence<Is...>) {
+    [[maybe_unused]] static constexpr auto net = makeSortingNetwork(N);
+    (cmpSwap(keys[net.a[Is]], keys[net.b[Is]]), ...);
+}
+
+// maximum of all lanes, broadcast to all lanes
+inline __m256i hmax(__m256i v) {
+    __m256i m = _mm256_max_epi32(v, _mm256_permute2x128_si256(v, v, 1));
+    m = _mm256_max_epi32(m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm256_max_epi32(m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+// canonicalize with 8 rotations per vector, 3 batches for all 24.
+template <int N>
+XYZ kernel(const XYZ *points, XYZ shape, XYZ *out) {
+    static constexpr int NET_SIZE = makeSortingNetwork(N).size;
+    const auto &K = Canonical::ROTATION_KEYS;
+    const uint32_t valid = Canonical::validRotations(shape);
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i none = _mm256_set1_epi32(-1);
+    alignas(32) int32_t lanes[N][8];
+    int32_t best[N] = {};
+    int bestRot = -1;
+
+    for (int batch = 0; batch < 3; ++batch) {
+        uint32_t cand = (valid >> (8 * batch)) & 0xff;
+        if (!cand) continue;  // no rotation in this batch keeps the shape sorted
+        const int r0 = 8 * batch;
+        const __m256i mx = _mm256_loadu_si256((const __m256i *)(K.mx + r0));
+        const __m256i my = _mm256_loadu_si256((const __m256i *)(K.my + r0));
+        const __m256i mz = _mm256_loadu_si256((const __m256i *)(K.mz + r0));
+        const __m256i off = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(shape.x()), _mm256_loadu_si256((const __m256i *)(K.offx + r0))),
+                                                              _mm256_mullo_epi32(_mm256_set1_epi32(shape.y()), _mm256_loadu_si256((const __m256i *)(K.offy + r0)))),
+                                             _mm256_mullo_epi32(_mm256_set1_epi32(shape.z()), _mm256_loadu_si256((const __m256i *)(K.offz + r0))));
+        __m256i keys[N] = {};
+        for (int k = 0; k < N; ++k) {
+            __m256i x = _mm256_mullo_epi32(_mm256_set1_epi32(points[k].x()), mx);
+            __m256i y = _mm256_mullo_epi32(_mm256_set1_epi32(points[k].y()), my);
+            __m256i z = _mm256_mullo_epi32(_mm256_set1_epi32(points[k].z()), mz);
+            keys[k] = _mm256_add_epi32(_mm256_add_epi32(x, y), _mm256_add_epi32(z, off));
+        }
+        if (bestRot >= 0) {
+            // lanes whose smallest key is below the best one can not win, skip the sort if that is all of them
+            __m256i lowest = keys[0];
+            for (int k = 1; k < N; ++k) lowest = _mm256_min_epi32(lowest, keys[k]);
+            cand &= ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(best[0]), lowest)));
+            if (!cand) continue;
+        }
+        sortLanes<N>(keys, std::make_index_sequence<NET_SIZE>());
+
+        // narrow the candidates down to the lexicographically greatest lane
+        for (int k = 0; k < N && (cand & (cand - 1)); ++k) {
+            __m256i candMask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(cand), laneBits), laneBits);
+            __m256i v = _mm256_blendv_epi8(none, keys[k], candMask);
+            cand &= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, hmax(v))));
+        }
+        const int lane = __builtin_ctz(cand);
+        for (int k = 0; k < N; ++k) _mm256_store_si256((__m256i *)lanes[k], keys[k]);
+
+        bool greater = bestRot < 0;
+        for (int k = 0; k < N && !greater; ++k) {
+            if (lanes[k][lane] != best[k]) {
+                greater = lanes[k][lane] > best[k];
+                break;
+            }
+        }
+        if (greater) {
+            for (int k = 0; k < N; ++k) best[k] = lanes[k][lane];
+            bestRot = r0 + lane;
+        }
+    }
+    for (int k = 0; k < N; ++k) out[k] = Canonical::fromKey(best[k]);
+    return Canonical::rotatedShape(bestRot, shape);
+}
+
+template <size_t... Ns>
+constexpr std::array<XYZ (*)(const XYZ *, XYZ, XYZ *), sizeof...(Ns)> makeKernels(std::index_sequence<Ns...>) {
+    return {&kernel<Ns + 1>...};
+}
+
+}  // namespace
+
+XYZ Canonical::avx2(const XYZ *points, int n, XYZ shape, XYZ *out) {
+    static constexpr auto kernels = makeKernels(std::make_index_sequence<MAX_POINTS>());
+    if (n < 1 || n > MAX_POINTS) return scalar(points, n, shape, out);
+    return kernels[n - 1](points, shape, out);
+}
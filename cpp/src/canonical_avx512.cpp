@@ -0,0 +1,97 @@
+// compiled with -mavx512f, only called when the cpu supports it.
+// gcc warns about the deliberately undefined pass-through operands inside the AVX-512 intrinsics.
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+
+#include <utility>
+
+#include "canonical.hpp"
+
+namespace {
+
+inline void cmpSwap(__m512i &a, __m512i &b) {
+    __m512i lo = _mm512_min_epi32(a, b);
+    b = _mm512_max_epi32(a, b);
+    a = lo;
+}
+
+// sort each lane of keys[0..N) with a fully unrolled sorting network
+template <int N, size_t... Is>
+inline void sortLanes(__m512i *keys, std::index_sequence<Is...>) {
+    [[maybe_unused]] static constexpr auto net = makeSortingNetwork(N);
+    (cmpSwap(keys[net.a[Is]], keys[net.b[Is]]), ...);
+}
+
+// canonicalize with 16 rotations per vector, 2 batches for all 24.
+template <int N>
+XYZ kernel(const XYZ *points, XYZ shape, XYZ *out) {
+    static constexpr int NET_SIZE = makeSortingNetwork(N).size;
+    const auto &K = Canonical::ROTATION_KEYS;
+    const uint32_t valid = Canonical::validRotations(shape);
+    const __m512i none = _mm512_set1_epi32(-1);
+    alignas(64) int32_t lanes[N][16];
+    int32_t best[N] = {};
+    int bestRot = -1;
+
+    for (int batch = 0; batch < 2; ++batch) {
+        __mmask16 cand = (valid >> (16 * batch)) & 0xffff;
+        if (!cand) continue;  // no rotation in this batch keeps the shape sorted
+        const int r0 = 16 * batch;
+        const __m512i mx = _mm512_loadu_si512(K.mx + r0);
+        const __m512i my = _mm512_loadu_si512(K.my + r0);
+        const __m512i mz = _mm512_loadu_si512(K.mz + r0);
+        const __m512i off = _mm512_add_epi32(_mm512_add_epi32(_mm512_mullo_epi32(_mm512_set1_epi32(shape.x()), _mm512_loadu_si512(K.offx + r0)),
+                                                              _mm512_mullo_epi32(_mm512_set1_epi32(shape.y()), _mm512_loadu_si512(K.offy + r0))),
+                                             _mm512_mullo_epi32(_mm512_set1_epi32(shape.z()), _mm512_loadu_si512(K.offz + r0)));
+        __m512i keys[N] = {};
+        for (int k = 0; k < N; ++k) {
+            __m512i x = _mm512_mullo_epi32(_mm512_set1_epi32(points[k].x()), mx);
+            __m512i y = _mm512_mullo_epi32(_mm512_set1_epi32(points[k].y()), my);
+            __m512i z = _mm512_mullo_epi32(_mm512_set1_epi32(points[k].z()), mz);
+            keys[k] = _mm512_add_epi32(_mm512_add_epi32(x, y), _mm512_add_epi32(z, off));
+        }
+        if (bestRot >= 0) {
+            // lanes whose smallest key is below the best one can not win, skip the sort if that is all of them
+            __m512i lowest = keys[0];
+            for (int k = 1; k < N; ++k) lowest = _mm512_min_epi32(lowest, keys[k]);
+            cand &= _mm512_cmpge_epi32_mask(lowest, _mm512_set1_epi32(best[0]));
+            if (!cand) continue;
+        }
+        sortLanes<N>(keys, std::make_index_sequence<NET_SIZE>());
+
+        // narrow the candidates down to the lexicographically greatest lane
+        for (int k = 0; k < N && (cand & (cand - 1)); ++k) {
+            __m512i v = _mm512_mask_blend_epi32(cand, none, keys[k]);
+            cand &= _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32(_mm512_reduce_max_epi32(v)));
+        }
+        const int lane = __builtin_ctz(cand);
+        for (int k = 0; k < N; ++k) _mm512_store_si512(lanes[k], keys[k]);
+
+        bool greater = bestRot < 0;
+        for (int k = 0; k < N && !greater; ++k) {
+            if (lanes[k][lane] != best[k]) {
+                greater = lanes[k][lane] > best[k];
+                break;
+            }
+        }
+        if (greater) {
+            for (int k = 0; k < N; ++k) best[k] = lanes[k][lane];
+            bestRot = r0 + lane;
+        }
+    }
+    for (int k = 0; k < N; ++k) out[k] = Canonical::fromKey(best[k]);
+    return Canonical::rotatedShape(bestRot, shape);
+}
+
+template <size_t... Ns>
+constexpr std::array<XYZ (*)(const XYZ *, XYZ, XYZ *), sizeof...(Ns)> makeKernels(std::index_sequence<Ns...>) {
+    return {&kernel<Ns + 1>...};
+}
+
+}  // namespace
+
+XYZ Canonical::avx512(const XYZ *points, int n, XYZ shape, XYZ *out) {
+    static constexpr auto kernels = makeKernels(std::make_index_sequence<MAX_POINTS>());
+    if (n < 1 || n > MAX_POINTS) return scalar(points, n, shape, out);
+    return kernels[n - 1](points, shape, out);
+}
@@ -0,0 +1,97 @@
+#include "cubeQuery.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include "canonical.hpp"
+#include "frozenShape.hpp"
+#include "workPool.hpp"
+
+CubeQuery::CubeQuery(CacheReader &cache) : cache_(cache), n_(cache.n()) {
+    for (uint32_t i = 0; i < cache.numShapes(); ++i) sids_[cache.shape(i)] = i;
+}
+
+XYZ CubeQuery::canonicalize(const XYZ *points, XYZ *out) const {
+    // move to the origin, Canonical wants the points within their shape
+    XYZ moved[MAX_QUERY_POINTS];
+    XYZ lo = points[0], hi = points[0];
+    for (int i = 0; i < n_; ++i)
+        for (int d = 0; d < 3; ++d) {
+            lo[d] = std::min(lo[d], points[i][d]);
+            hi[d] = std::max(hi[d], points[i][d]);
+        }
+    for (int i = 0; i < n_; ++i)
+        for (int d = 0; d < 3; ++d) moved[i][d] = points[i][d] - lo[d];
+    return Canonical::canonicalize(moved, n_, XYZ(hi.x() - lo.x(), hi.y() - lo.y(), hi.z() - lo.z()), out);
+}
+
+CubeQuery::Result CubeQuery::find(const XYZ *points, XYZ *canonical) const {
+    XYZ out[MAX_QUERY_POINTS];
+    const XYZ shape = canonicalize(points, out);
+    if (canonical) std::copy(out, out + n_, canonical);
+    return search(out, shape, 0);
+}
+
+CubeQuery::Result CubeQuery::search(const XYZ *canonical, XYZ shape, uint64_t from) const {
+    Result r;
+    r.shape = shape;
+    auto it = sids_.find(shape);
+    if (it == sids_.end()) return r;
+    r.sid = it->second;
+    auto range = cache_.getCubesByShape(r.sid);
+    const XYZ *cubes = range.data();
+    if (!cache_.isSorted(r.sid)) {
+        for (uint64_t i = 0; i < range.size(); ++i)
+            if (FrozenShape::compare(cubes + i * n_, canonical, n_) == 0) {
+                r.found = true;
+                r.index = i;
+                return r;
+            }
+        return r;
+    }
+    uint64_t lo = from, hi = range.size();
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (FrozenShape::compare(cubes + mid * n_, canonical, n_) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    r.index = lo;
+    r.found = lo < range.size() && FrozenShape::compare(cubes + lo * n_, canonical, n_) == 0;
+    return r;
+}
+
+std::vector<CubeQuery::Result> CubeQuery::findMany(const XYZ *points, size_t count, int threads) const {
+    std::vector<Result> results(count);
+    std::vector<XYZ> canonical(count * n_);
+    WorkPool pool(threads);
+    pool.submit(count, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; ++i) results[i].shape = canonicalize(points + i * n_, &canonical[i * n_]);
+    });
+    pool.wait();
+
+    // by shape and then in the order of the sorted blocks
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (!(results[a].shape == results[b].shape)) return results[a].shape < results[b].shape;
+        return FrozenShape::compare(&canonical[a * n_], &canonical[b * n_], n_) < 0;
+    });
+    std::vector<size_t> groups;
+    for (size_t i = 0; i < count; ++i)
+        if (i == 0 || !(results[order[i]].shape == results[order[i - 1]].shape)) groups.push_back(i);
+    groups.push_back(count);
+    pool.submit(groups.size() - 1, [&](size_t begin, size_t end, int) {
+        for (size_t g = begin; g < end; ++g) {
+            uint64_t from = 0;
+            for (size_t i = groups[g]; i < groups[g + 1]; ++i) {
+                const size_t q = order[i];
+                results[q] = search(&canonical[q * n_], results[q].shape, from);
+                from = results[q].index;
+            }
+        }
+    });
+    pool.wait();
+    return results;
+}
@@ -1,60 +1,135 @@
 #include "cubes.hpp"
 
+#include <sys/mman.h>
+
 #include <algorithm>
+#include <array>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <utility>
 
 #include "cache.hpp"
+#include "candidateGrid.hpp"
+#include "cacheWriter.hpp"
+#include "canonical.hpp"
 #include "cube.hpp"
+#include "gpuExpand.hpp"
 #include "hashes.hpp"
+#include "inputPipeline.hpp"
+#include "memoryBudget.hpp"
 #include "newCache.hpp"
+#include "numa.hpp"
+#include "packedCube.hpp"
+#include "pcube.hpp"
+#include "progress.hpp"
 #include "results.hpp"
+#include "resume.hpp"
 #include "rotations.hpp"
+#include "shapeSchedule.hpp"
+#include "shards.hpp"
+#include "sortedRuns.hpp"
+#include "workPool.hpp"
 
 const int PERF_STEP = 500;
+// largest N there is a PackedCube<N> expansion instantiated for
+const int MAX_N = Canonical::MAX_POINTS;
+// input pipeline of gen(), see inputPipeline.hpp
+const uint64_t READAHEAD_WINDOW = 8 << 20;
+const uint64_t READAHEAD_AHEAD = 64 << 20;
+const uint64_t STREAM_BLOCK = 16 << 20;
+// pairs queued per thread at the same time, see ShapeSchedule
+const int PAIRS_IN_FLIGHT = 4;
+
+// Buffers of Workset::expand<N>(), one per worker thread and N. They keep their capacity
+// between calls, so expanding a cube does not allocate once they have grown.
+template <int N>
+struct ExpandScratch {
+    std::vector<XYZ> candidates, tmp;
+    Cube newCube = Cube(N);
+    Cube lowestHashCube = Cube(N);
+    // scratch space and distinct results for the canonical parent check
+    Cube parentCube = Cube(N - 1), parentCanonical = Cube(N - 1);
+    std::vector<PackedCube<N>> accepted;
+    // children of the current chunk not yet inserted, see Workset::flushStaged()
+    std::vector<PackedCube<N>> staged;
+    // children of a batch expanded on the gpu
+    GpuExpander::Output gpu;
+
+    static ExpandScratch &local() {
+        thread_local ExpandScratch scratch;
+        return scratch;
+    }
+};
+
+// What worksets count. Every worker has its own, they are only added up when a workset
+// is done.
+struct alignas(64) CountStats {
+    uint64_t count = 0;  // hashless
+    // children inserted into the sets, or accepted by their canonical parent when hashless
+    uint64_t inserts = 0;
+    // with count_only: polycubes that differ from their mirror image, and all by the number
+    // of rotations mapping them onto themselves
+    uint64_t chiral = 0;
+    uint64_t byOrder[25] = {};
+
+    CountStats &operator+=(const CountStats &o) {
+        count += o.count;
+        inserts += o.inserts;
+        chiral += o.chiral;
+        for (int i = 0; i < 25; ++i) byOrder[i] += o.byOrder[i];
+        return *this;
+    }
+};
 
 struct Workset {
-    std::mutex mu;
-    CubeIterator _begin_total;
-    CubeIterator _begin;
-    CubeIterator _end;
+    ShapeRange data;
     Hashy &hashes;
     XYZ targetShape, shape, expandDim;
     bool notSameShape;
-    Workset(ShapeRange &data, Hashy &hashes, XYZ targetShape, XYZ shape, XYZ expandDim, bool notSameShape)
-        : _begin_total(data.begin())
-        , _begin(data.begin())
-        , _end(data.end())
-        , hashes(hashes)
-        , targetShape(targetShape)
-        , shape(shape)
-        , expandDim(expandDim)
-        , notSameShape(notSameShape) {}
-
-    struct Subset {
-        CubeIterator _begin, _end;
-        bool valid;
-        float percent;
-        auto begin() { return _begin; }
-        auto end() { return _end; }
-    };
+    bool hashless;
+    bool symmetries = false;          // also fill in chiral and byOrder of the counts
+    bool symmetry = false;            // expand one candidate per orbit of the parent's symmetries
+    std::vector<CountStats> counts;  // by worker
+    CandidateGrid grid;
+    Progress *progress = nullptr;  // counts the work of every worker if set
+    InsertRouter *router = nullptr;  // inserts go to the NUMA node owning their shard if set
+    std::atomic<int> routed{0};      // batches of the router not yet inserted
+    Hashy::Subhashy *targetSet;
+    SortedRuns *runs = nullptr;  // the children go to sorted runs instead of targetSet if set
+    GpuExpander *gpu = nullptr;  // expands the cubes instead of expand() if set
+    // children staged per worker before they are inserted
+    static constexpr size_t STAGE = 1024;
+    Workset(ShapeRange &data, Hashy &hashes, XYZ targetShape, XYZ shape, XYZ expandDim, bool notSameShape, bool hashless, int workers = 1)
+        : data(data),
+          hashes(hashes),
+          targetShape(targetShape),
+          shape(shape),
+          expandDim(expandDim),
+          notSameShape(notSameShape),
+          hashless(hashless),
+          counts(workers),
+          grid(shape, expandDim, notSameShape),
+          targetSet(&hashes.byshape[targetShape]) {}
 
-    Subset getPart() {
-        std::lock_guard<std::mutex> g(mu);
-        auto a = _begin;
-        _begin += 500;
-        if (_begin > _end) _begin = _end;
-        return {a, _begin, a < _end, 100 * (float)((uint64_t)a.m_ptr - (uint64_t)_begin_total.m_ptr) / ((uint64_t)_end.m_ptr - (uint64_t)_begin_total.m_ptr)};
+    CountStats total() const {
+        CountStats sum;
+        for (auto &c : counts) sum += c;
+        return sum;
     }
 
-    void expand(const Cube &c) {
-        std::vector<XYZ> candidates, tmp;
-        candidates.reserve(c.size() * 6);
-
+    // free cells next to c that give the target shape, for shapes too large for the grid
+    void neighbours(const Cube &c, std::vector<XYZ> &candidates, std::vector<XYZ> &tmp) const {
+        candidates.clear();
         if (notSameShape) {
             for (const auto &p : c) {
                 if (expandDim.x() == 1) {
@@ -83,15 +158,57 @@ struct Workset {
         std::sort(candidates.begin(), candidates.end());
         auto end = std::unique(candidates.begin(), candidates.end());
         // Copy XYZ not in Cube into tmp
-        tmp.reserve(std::distance(candidates.begin(), end));
+        tmp.clear();
         std::set_difference(candidates.begin(), end, c.begin(), c.end(), std::back_inserter(tmp));
-        candidates = std::move(tmp);
+        std::swap(candidates, tmp);
+    }
+
+    // Drop the candidates that a symmetry of c maps to a smaller candidate: c plus either of
+    // them is the same polycube, rotated. c is canonical, so its symmetries keep shape and
+    // map the cells next to the box onto cells next to the box.
+    void pruneSymmetric(const Cube &c, std::vector<XYZ> &candidates, std::vector<XYZ> &tmp) const {
+        const uint32_t symmetries = Canonical::stabiliser(c.data(), c.size(), shape) & ~1u;
+        if (!symmetries) return;
+        // the grid lists cells in its own bit order (-1 first), sorted they are searched
+        std::sort(candidates.begin(), candidates.end());
+        tmp.clear();
+        for (const auto &p : candidates) {
+            bool keep = true;
+            for (uint32_t m = symmetries; m && keep; m &= m - 1) {
+                const auto &L = Rotations::LUT[__builtin_ctz(m)];
+                XYZ q;
+                for (int d = 0; d < 3; ++d) q[d] = L[3 + d] < 0 ? shape[L[d]] - p[L[d]] : p[L[d]];
+                keep = !(q < p && std::binary_search(candidates.begin(), candidates.end(), q));
+            }
+            if (keep) tmp.push_back(p);
+        }
+        std::swap(candidates, tmp);
+    }
+
+    // expand c into cubes of size N
+    template <int N>
+    void expand(const Cube &c, CountStats &stats, Progress::Counters *counters, int worker) {
+        auto &scratch = ExpandScratch<N>::local();
+        auto &candidates = scratch.candidates;
+        auto &tmp = scratch.tmp;
+        if (grid.fits()) {
+            grid.candidates(c, candidates);
+        } else {
+            neighbours(c, candidates, tmp);
+        }
+        if (symmetry) pruneSymmetric(c, candidates, tmp);
 
         DEBUG_PRINTF("candidates: %lu\n\r", candidates.size());
 
-        Cube newCube(c.size() + 1);
-        Cube lowestHashCube(newCube.size());
-        Cube rotatedCube(newCube.size());
+        auto &newCube = scratch.newCube;
+        auto &lowestHashCube = scratch.lowestHashCube;
+        PackedCube<N> lowestPacked;
+        auto &parentCube = scratch.parentCube;
+        auto &parentCanonical = scratch.parentCanonical;
+        PackedCube<N - 1> parentPacked(c);
+        auto &accepted = scratch.accepted;
+        accepted.clear();
+        uint64_t rotations = 0, inserts = 0, duplicates = 0;
 
         for (const auto &p : candidates) {
             DEBUG_PRINTF("(%2d %2d %2d)\n\r", p.x(), p.y(), p.z());
@@ -111,154 +228,853 @@ struct Workset {
                 *put++ = XYZ(nx, ny, nz);
             }
             // check rotations
-            XYZ lowestShape;
-            bool none_set = true;
-            for (int i = 0; i < 24; ++i) {
-                auto [res, ok] = Rotations::rotate(i, shape, newCube, rotatedCube);
-                if (!ok) continue;  // rotation generated violating shape
-
-                std::sort(rotatedCube.begin(), rotatedCube.end());
-
-                if (none_set || lowestHashCube < rotatedCube) {
-                    none_set = false;
-                    swap(lowestHashCube, rotatedCube);
-                    lowestShape = res;
+            XYZ lowestShape = canonicalize(shape, newCube, lowestHashCube, lowestPacked);
+            if (counters) rotations += Canonical::ROTATION_CLASSES.count[Canonical::rotationClass(shape)];
+            if (hashless) {
+                if (isCanonicalParent(lowestHashCube, parentPacked, parentCube, parentCanonical)) accepted.push_back(lowestPacked);
+            } else {
+                if (lowestShape == targetShape) {
+                    scratch.staged.push_back(lowestPacked);
+                    if (scratch.staged.size() >= STAGE) duplicates += flushStaged<N>(worker);
+                } else {
+                    duplicates += !hashes.insert(lowestPacked, lowestShape);
                 }
+                inserts++;
             }
-            hashes.insert(lowestHashCube, lowestShape);
+        }
+        if (hashless && !accepted.empty()) {
+            // a symmetric parent produces the same child from several candidates
+            std::sort(accepted.begin(), accepted.end());
+            auto last = std::unique(accepted.begin(), accepted.end());
+            stats.count += std::distance(accepted.begin(), last);
+            inserts = std::distance(accepted.begin(), last);
+            if (symmetries) {
+                for (auto it = accepted.begin(); it != last; ++it) {
+                    it->unpack(newCube.data());
+                    XYZ childShape(0, 0, 0);
+                    for (const auto &p : newCube)
+                        for (int d = 0; d < 3; ++d) childShape[d] = std::max(childShape[d], p[d]);
+                    auto sym = Canonical::symmetry(newCube.data(), N, childShape);
+                    stats.chiral += sym.chiral;
+                    stats.byOrder[sym.order]++;
+                }
+            }
+        }
+        stats.inserts += inserts;
+        if (counters) {
+            Progress::Counters::add(counters->parents, 1);
+            Progress::Counters::add(counters->candidates, candidates.size());
+            Progress::Counters::add(counters->rotations, rotations);
+            Progress::Counters::add(counters->inserts, inserts);
+            Progress::Counters::add(counters->duplicates, duplicates);
         }
     }
-};
 
-struct Worker {
-    Workset &ws;
-    int id;
-    Worker(Workset &ws_, int id_) : ws(ws_), id(id_) {}
-    void run() {
-        // std::printf("start %d\n", id);
-        auto subset = ws.getPart();
-        while (subset.valid) {
-            if (id == 0) {
-                std::printf("  %5.2f%%\r", subset.percent);
-                std::flush(std::cout);
+    // expand cubes [begin, end) of data on the gpu, the host only inserts or counts the
+    // canonical children it returns
+    template <int N>
+    void expandGpu(size_t begin, size_t end, CountStats &stats, Progress::Counters *counters, int worker) {
+        auto &scratch = ExpandScratch<N>::local();
+        auto &out = scratch.gpu;
+        const auto mode = !hashless ? GpuExpander::Mode::Insert : symmetries ? GpuExpander::Mode::Accept : GpuExpander::Mode::Count;
+        gpu->expand(worker, {shape, targetShape, expandDim, notSameShape}, data.data() + begin * (N - 1), end - begin, mode, out);
+        uint64_t duplicates = 0;
+        stats.inserts += out.count;
+        if (hashless) {
+            stats.count += out.count;
+            if (symmetries) {
+                for (uint64_t i = 0; i < out.count; ++i) {
+                    auto sym = Canonical::symmetry(&out.children[i * N], N, out.shapes[i]);
+                    stats.chiral += sym.chiral;
+                    stats.byOrder[sym.order]++;
+                }
+            }
+        } else {
+            for (uint64_t i = 0; i < out.count; ++i) {
+                PackedCube<N> packed(&out.children[i * N]);
+                if (out.shapes[i] == targetShape) {
+                    scratch.staged.push_back(packed);
+                    if (scratch.staged.size() >= STAGE) duplicates += flushStaged<N>(worker);
+                } else {
+                    duplicates += !hashes.insert(packed, out.shapes[i]);
+                }
+            }
+        }
+        if (counters) {
+            Progress::Counters::add(counters->parents, end - begin);
+            Progress::Counters::add(counters->inserts, out.count);
+            Progress::Counters::add(counters->duplicates, duplicates);
+        }
+    }
+
+    // Insert the staged children of worker in one batch per shard (or through the router),
+    // so the expansion does not touch the sets in between. Children staged twice are found
+    // by the set, inserting them grouped by shard makes that as cheap as deduplicating here.
+    // returns the duplicates found.
+    template <int N>
+    uint64_t flushStaged(int worker) {
+        static_assert(sizeof(PackedCube<N>) == PackedCube<N>::WORDS * sizeof(uint64_t), "staged cubes are read as one array of words");
+        auto &staged = ExpandScratch<N>::local().staged;
+        if (staged.empty()) return 0;
+        uint64_t duplicates = 0;
+        if (runs) {
+            // duplicates are only dropped when the runs are sorted
+            runs->add(worker, staged[0].words, staged.size());
+        } else if (router) {
+            for (auto &c : staged) duplicates += router->insert(worker, *targetSet, c.words, N, routed);
+        } else {
+            duplicates += staged.size() - targetSet->insertMany(staged[0].words, staged.size(), N);
+        }
+        staged.clear();
+        return duplicates;
+    }
+
+    // Canonical orientation of c (with N cubes) in out and outPacked, see canonical.hpp.
+    template <int N>
+    static XYZ canonicalize(XYZ shape, const Cube &c, Cube &out, PackedCube<N> &outPacked) {
+        XYZ lowestShape = Canonical::canonicalize(c.data(), N, shape, out.data());
+        outPacked = PackedCube<N>(out);
+        return lowestShape;
+    }
+
+    // Points of a sorted cube are connected by faces.
+    static bool isConnected(const Cube &c) {
+        bool visited[128] = {false};
+        uint8_t stack[128];
+        int top = 0;
+        size_t found = 1;
+        visited[0] = true;
+        stack[top++] = 0;
+        while (top > 0) {
+            auto p = c.data()[stack[--top]];
+            for (int d = 0; d < 3; ++d) {
+                for (int s = -1; s <= 1; s += 2) {
+                    XYZ n = p;
+                    n[d] += s;
+                    auto it = std::lower_bound(c.begin(), c.end(), n);
+                    if (it == c.end() || !(*it == n)) continue;
+                    auto idx = std::distance(c.begin(), it);
+                    if (visited[idx]) continue;
+                    visited[idx] = true;
+                    stack[top++] = idx;
+                    found++;
+                }
             }
-            // std::cout << id << " next subset " << &*subset.begin() << " to " << &*subset.end() << "\n";
-            for (auto &c : subset) {
-                // std::printf("%p\n", (void *)&c);
-                // c.print();
-                ws.expand(c);
+        }
+        return found == c.size();
+    }
+
+    // The canonical parent of a canonical child is what remains after removing the last
+    // cube (in canonical order) that does not disconnect it. Each child has exactly one,
+    // so counting only children whose canonical parent is the expanded cube needs no set.
+    template <int N>
+    bool isCanonicalParent(const Cube &child, const PackedCube<N> &parent, Cube &rest, Cube &out) const {
+        const int n = child.size();
+        for (int r = n - 1; r >= 0; --r) {
+            std::copy(child.begin(), child.begin() + r, rest.begin());
+            std::copy(child.begin() + r + 1, child.end(), rest.begin() + r);
+            if (isConnected(rest)) break;
+        }
+        XYZ lo(127, 127, 127), hi(0, 0, 0);
+        for (const auto &p : rest) {
+            for (int d = 0; d < 3; ++d) {
+                lo[d] = std::min(lo[d], p[d]);
+                hi[d] = std::max(hi[d], p[d]);
             }
-            subset = ws.getPart();
         }
-        // std::printf("finished %d\n", id);
+        for (auto &p : rest) {
+            for (int d = 0; d < 3; ++d) p[d] -= lo[d];
+        }
+        XYZ restShape(hi.x() - lo.x(), hi.y() - lo.y(), hi.z() - lo.z());
+        // cheap reject: the parent has to have the shape this workset expands
+        XYZ sorted = restShape;
+        std::sort(sorted.data, sorted.data + 3);
+        if (!(sorted == shape)) return false;
+        PackedCube<N> restPacked;
+        canonicalize(restShape, rest, out, restPacked);
+        return restPacked == parent;
+    }
+};
+
+struct Worker {
+    // expands cubes [begin, end) of ws into cubes of size N on worker
+    template <int N>
+    static void run(Workset &ws, size_t begin, size_t end, int worker) {
+        auto it = ws.data.begin();
+        it += begin;
+        auto &stats = ws.counts[worker];
+        auto counters = ws.progress ? &ws.progress->worker(worker) : nullptr;
+        for (size_t i = begin; i < end; ++i, ++it) ws.expand<N>(*it, stats, counters, worker);
+        flush<N>(ws, worker, counters);
+    }
+
+    // run() with the cubes expanded by ws.gpu
+    template <int N>
+    static void runGpu(Workset &ws, size_t begin, size_t end, int worker) {
+        auto counters = ws.progress ? &ws.progress->worker(worker) : nullptr;
+        ws.expandGpu<N>(begin, end, ws.counts[worker], counters, worker);
+        flush<N>(ws, worker, counters);
+    }
+
+    // the chunk is only done once its children are in the sets
+    template <int N>
+    static void flush(Workset &ws, int worker, Progress::Counters *counters) {
+        uint64_t duplicates = ws.flushStaged<N>(worker);
+        if (counters) Progress::Counters::add(counters->duplicates, duplicates);
+        if (ws.router) {
+            // the batches of other nodes go out, the ones for this node are inserted
+            ws.router->flush(worker);
+            duplicates = ws.router->drain(ws.router->node(worker));
+            if (counters) Progress::Counters::add(counters->duplicates, duplicates);
+        }
+    }
+
+    using RunFn = void (*)(Workset &, size_t, size_t, int);
+
+    template <size_t... Ns>
+    static constexpr std::array<RunFn, sizeof...(Ns)> makeRunTable(std::index_sequence<Ns...>) {
+        return {&Worker::run<Ns + 2>...};
+    }
+
+    template <size_t... Ns>
+    static constexpr std::array<RunFn, sizeof...(Ns)> makeRunGpuTable(std::index_sequence<Ns...>) {
+        return {&Worker::runGpu<Ns + 2>...};
+    }
+
+    // run() instantiation for generating cubes of size n (2 <= n <= MAX_N)
+    static RunFn runFor(int n) {
+        static constexpr auto table = makeRunTable(std::make_index_sequence<MAX_N - 1>());
+        return table[n - 2];
+    }
+
+    // runGpu() instantiation for generating cubes of size n (2 <= n <= MAX_N)
+    static RunFn runGpuFor(int n) {
+        static constexpr auto table = makeRunGpuTable(std::make_index_sequence<MAX_N - 1>());
+        return table[n - 2];
     }
 };
 
-FlatCache gen(int n, int threads, bool use_cache, bool write_cache, bool split_cache, bool use_split_cache, std::string base_path) {
+// stop if the cache holds another shape where the pair expects its input shape
+static void checkShape(ShapeRange &s, XYZ expected) {
+    if (s.shape() == expected) return;
+    std::printf("ERROR caches shape [%2d %2d %2d] does not match expected shape [%2d %2d %2d]!\n\r", s.shape().x(), s.shape().y(), s.shape().z(), expected.x(),
+                expected.y(), expected.z());
+    exit(-1);
+}
+
+// Progress reporter of a run if opts.progress is set, else null.
+static std::unique_ptr<Progress> startProgress(int n, int workers, Hashy *hashes, const GenOptions &opts) {
+    if (opts.progress <= 0) return nullptr;
+    auto progress = std::make_unique<Progress>(n, workers, hashes);
+    if (!progress->start(opts.progress_file, opts.progress)) exit(-1);
+    return progress;
+}
+
+// Runs the work units of one shard and records each in its checkpoint, see shards.hpp.
+// Units run one after the other, each on all threads.
+static void runShard(const ShardPlan &plan, ICache &base, const GenOptions &opts) {
+    const int n = plan.n();
+    const bool hashless = plan.hashless();
+    std::vector<uint32_t> ids;
+    if (!(opts.shard.empty() ? plan.selectList(opts.unit_list, ids) : plan.selectShard(opts.shard, ids))) exit(-1);
+    Checkpoint checkpoint;
+    if (!checkpoint.open(plan.checkpointFile(opts.base_path, opts.shard, opts.unit_list), plan)) exit(-1);
+    uint32_t remaining = 0;
+    for (auto id : ids) remaining += !checkpoint.done(id);
+    std::printf("N = %d || %lu work units of up to %lu cubes, %lu in this shard, %u left to do\n\r", n, plan.units().size(), plan.unitSize(), ids.size(), remaining);
+
+    WorkPool pool(opts.threads);
+    const auto run = Worker::runFor(n);
+    const auto allShapes = Hashy::generateShapes(n);
+    // every unit has its own sets, so there are no load factors
+    auto progress = startProgress(n, pool.threads(), nullptr, opts);
+    auto start = std::chrono::steady_clock::now();
+    for (auto id : ids) {
+        if (checkpoint.done(id)) continue;
+        const auto &unit = plan.units()[id];
+        const auto &pair = plan.pairs()[unit.pair];
+        auto s = base.getCubesByShape(pair.sid);
+        checkShape(s, pair.shape);
+        Hashy hashes;
+        // all sets exist before the workers insert, like after init()
+        for (auto shape : allShapes) hashes.byshape[shape];
+        Workset ws(s, hashes, pair.target, pair.shape, pair.expandDim, pair.notSameShape, hashless, pool.threads());
+        ws.progress = progress.get();
+        ws.symmetry = opts.symmetry;
+        auto tracked = progress ? progress->addPair(pair.shape, pair.target, unit.end - unit.begin) : nullptr;
+        pool.submit(unit.end - unit.begin, [&ws, &unit, run, tracked](size_t begin, size_t end, int worker) {
+            run(ws, unit.begin + begin, unit.begin + end, worker);
+            if (tracked) tracked->advance(end - begin);
+        });
+        pool.wait();
+        auto &set = hashes.byshape[pair.target];
+        uint64_t count = hashless ? ws.total().count : set.size();
+        if (!hashless) {
+            // only complete unit files get their final name
+            auto file = plan.unitFile(opts.base_path, id);
+            CacheWriter writer;
+            if (!writer.open(file + ".tmp", n, {pair.target}, opts.direct_io)) exit(-1);
+            writer.writeShape(pair.target, set);
+            writer.close();
+            std::filesystem::rename(file + ".tmp", file);
+        }
+        checkpoint.record(id, count);
+        std::printf("  unit %u [%2d %2d %2d] -> [%2d %2d %2d] cubes %lu-%lu num: %lu\n\r", id, pair.shape.x(), pair.shape.y(), pair.shape.z(), pair.target.x(),
+                    pair.target.y(), pair.target.z(), unit.begin, unit.end, count);
+    }
+    if (progress) progress->stop();
+    auto dt_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::printf("took %.2f s\033[0K\n\r", dt_ms / 1000.f);
+    std::printf("shard finished, merge all shards with -m\n\r");
+}
+
+uint64_t expandAll(int n, ICache &base, Hashy &hashes, bool hashless, int threads, bool symmetry, uint64_t *inserts) {
+    WorkPool pool(threads);
+    const auto run = Worker::runFor(n);
+    std::deque<Workset> worksets;
+    for (const auto &pair : shapePairs(n)) {
+        auto s = base.getCubesByShape(pair.sid);
+        checkShape(s, pair.shape);
+        auto &ws = worksets.emplace_back(s, hashes, pair.target, pair.shape, pair.expandDim, pair.notSameShape, hashless, pool.threads());
+        ws.symmetry = symmetry;
+        pool.submit(s.size(), [&ws, run](size_t begin, size_t end, int worker) { run(ws, begin, end, worker); });
+    }
+    pool.wait();
+    CountStats sum;
+    for (auto &ws : worksets) sum += ws.total();
+    if (inserts) *inserts = sum.inserts;
+    return hashless ? sum.count : hashes.size();
+}
+
+// Called for every output shape of a level once it is final, from the thread finishing it.
+// The set is dropped right after, so the pipelined next level copies the cubes it needs.
+using ShapeFeed = std::function<void(XYZ shape, Hashy::Subhashy &set)>;
+
+static FlatCache genLevel(int n, const GenOptions &opts, const ShapeFeed &feed) {
+    const int threads = opts.threads;
+    const bool use_cache = opts.use_cache, split_cache = opts.split_cache, use_split_cache = opts.use_split_cache, hashless = opts.hashless || opts.count_only;
+    bool write_cache = opts.write_cache;
+    const std::string &base_path = opts.base_path;
     if (!std::filesystem::is_directory(base_path)) {
         std::filesystem::create_directory(base_path);
     }
     Hashy hashes;
     if (n < 1)
         return {};
-    else if (n == 1) {
+    else if (n > MAX_N) {
+        std::printf("N = %d is not supported, MAX_N is %d\n\r", n, MAX_N);
+        return {};
+    } else if (n == 1) {
         hashes.init(n);
         hashes.insert(Cube{{XYZ(0, 0, 0)}}, XYZ(0, 0, 0));
         std::printf("%ld elements for %d\n\r", hashes.size(), n);
-        if (write_cache) {
+        if (write_cache && opts.pcube) {
+            PCubeWriter pw;
+            if (pw.open(base_path + "cubes_" + std::to_string(n) + ".pcube", n, {XYZ(0, 0, 0)})) pw.writeShape(XYZ(0, 0, 0), hashes.byshape[XYZ(0, 0, 0)]);
+        } else if (write_cache) {
             Cache::save(base_path + "cubes_" + std::to_string(n) + ".bin", hashes, n);
         }
+        if (feed) {
+            feed(XYZ(0, 0, 0), hashes.byshape[XYZ(0, 0, 0)]);
+            return {};
+        }
         return FlatCache(hashes, n);
     }
 
     CacheReader cr;
-    if (use_cache && !use_split_cache) {
-        std::string cachefile = base_path + "cubes_" + std::to_string(n - 1) + ".bin";
-        cr.loadFile(cachefile);
-        cr.printHeader();
-    }
     FlatCache fc;
     ICache *base = &cr;
-    if (!cr && !use_split_cache) {
-        fc = gen(n - 1, threads, use_cache, write_cache, false);
+    std::unique_ptr<MemoryBudget> budget;
+    if (opts.mem_budget) budget = std::make_unique<MemoryBudget>(opts.mem_budget > 0 ? (uint64_t)opts.mem_budget << 20 : 0);
+    const int known = sizeof(results) / sizeof(results[0]);
+    std::string prevCachefile = base_path + "cubes_" + std::to_string(n - 1) + (opts.pcube ? ".pcube" : ".bin");
+    // .pcube files are inflated into memory, PCUB files are mapped
+    auto loadPrev = [&]() {
+        if (opts.pcube) {
+            base = &fc;
+            return PCube::load(prevCachefile, n - 1, threads, fc);
+        }
+        base = &cr;
+        if (cr.loadFile(prevCachefile) != 0) return false;
+        cr.printHeader();
+        return true;
+    };
+    bool loaded = use_cache && !use_split_cache && loadPrev();
+    // with the pipeline N - 1 is generated next to N instead of before it, see below
+    const bool sharded = opts.merge || !opts.shard.empty() || !opts.unit_list.empty();
+    const bool pipelined = opts.pipeline && !loaded && !use_split_cache && !sharded;
+    if (pipelined) {
+        base = nullptr;
+    } else if (!loaded && !use_split_cache) {
+        GenOptions prevOpts = opts;
+        prevOpts.split_cache = prevOpts.use_split_cache = prevOpts.hashless = prevOpts.count_only = false;
+        prevOpts.merge = false;
+        prevOpts.shard.clear();
+        prevOpts.unit_list.clear();
+        prevOpts.spill = false;
+        // N - 1 is kept in memory while N grows, unless it goes through its cache file
+        if (budget && !prevOpts.write_cache && n - 1 <= known) {
+            uint64_t need = MemoryBudget::estimateSets(n - 1, results[n - 2]);
+            if (!hashless && !write_cache && n <= known) need += MemoryBudget::estimateSets(n, results[n - 1]);
+            if (!budget->fits(need)) {
+                std::printf("N = %d and N = %d need about %lu MiB, more than the budget, N = %d goes through its cache file\n\r", n - 1, n, need >> 20, n - 1);
+                prevOpts.write_cache = true;
+            }
+        }
+        fc = gen(n - 1, prevOpts);
         base = &fc;
+        // N - 1 was streamed to its cache file instead of being kept in memory
+        if (prevOpts.write_cache && !loadPrev()) {
+            std::printf("ERROR could not load %s\n\r", prevCachefile.c_str());
+            exit(-1);
+        }
+    }
+    if (hashless && write_cache) {
+        std::printf("hashless mode only counts, no cache file for N = %d will be written\n\r", n);
+        write_cache = false;
+    }
+    if (sharded) {
+        uint64_t unitSize = opts.unit_size;
+        if (opts.merge) {
+            const uint64_t shardSize = shardUnitSize(opts.base_path, n);
+            if (shardSize && shardSize != unitSize) std::printf("merging with the unit size %lu of the shards\n\r", shardSize);
+            if (shardSize) unitSize = shardSize;
+        }
+        ShardPlan plan(n, *base, unitSize, hashless);
+        uint64_t totalSum;
+        if (opts.merge && mergeShards(plan, opts, totalSum))
+            checkResult(n, totalSum);
+        else if (!opts.merge)
+            runShard(plan, *base, opts);
+        return {};
     }
-    std::printf("N = %d || generating new cubes from %lu base cubes.\n\r", n, base->size());
-    hashes.init(n);
-    uint64_t totalSum = 0;
+    const uint64_t baseSize = base ? base->size() : n - 1 <= known ? results[n - 2] : 0;
+    if (base)
+        std::printf("N = %d || generating new cubes from %lu base cubes.\n\r", n, baseSize);
+    else
+        std::printf("N = %d || generating new cubes from N = %d while it is generated.\n\r", n, n - 1);
+    if (budget) budget->report("at the start", 0);
+    // shards by the expected size of the sets, past the table about 8 children per parent
+    const uint64_t expected = n <= known ? results[n - 1] : baseSize * 8;
+    hashes.init(n, hashless ? 0 : Hashy::shardBits(threads, expected / Hashy::generateShapes(n).size()));
+    std::atomic<uint64_t> totalSum = 0;
     auto start = std::chrono::steady_clock::now();
     uint32_t totalOutputShapes = hashes.byshape.size();
     uint32_t outShapeCount = 0;
-    auto prevShapes = Hashy::generateShapes(n - 1);
-    for (auto &tup : hashes.byshape) {
-        outShapeCount++;
-        XYZ targetShape = tup.first;
-        std::printf("process output shape %3d/%d [%2d %2d %2d]\n\r", outShapeCount, totalOutputShapes, targetShape.x(), targetShape.y(), targetShape.z());
-        for (uint32_t sid = 0; sid < prevShapes.size(); ++sid) {
-            auto &shape = prevShapes[sid];
-            int diffx = targetShape.x() - shape.x();
-            int diffy = targetShape.y() - shape.y();
-            int diffz = targetShape.z() - shape.z();
-            int abssum = abs(diffx) + abs(diffy) + abs(diffz);
-            if (abssum > 1 || diffx < 0 || diffy < 0 || diffz < 0) {
-                continue;
-            }
-            // handle symmetry cases
-            if (diffz == 1) {
-                if (shape.z() == shape.y()) diffy = 1;
-            }
-            if (diffy == 1)
-                if (shape.y() == shape.x()) diffx = 1;
+    auto pairs = shapePairs(n);
+    std::vector<XYZ> outShapes;
+    for (auto &tup : hashes.byshape) outShapes.push_back(tup.first);
+
+    // sorted runs only make sense if the merged shapes are written, program.cpp rejects
+    // -D sort without -w, the levels that do not write fall back to hash sets
+    const bool sortDedup = opts.dedup == "sort" && !hashless && write_cache;
+    SortedRuns::Budget runBudget;
+    runBudget.limit = opts.mem_limit << 20;
+    // without -M the runs get a quarter of the memory budget
+    if (!runBudget.limit && budget) runBudget.limit = budget->limit() / 4;
+    const std::string runFolder = base_path + "cubes_" + std::to_string(n) + "_runs/";
+
+    // pairs already in the resume state are not expanded again
+    std::map<uint32_t, uint64_t> donePairs;
+    std::unique_ptr<ResumeWriter> resume;
+    // the resume state only has the counts, not the symmetries, and snapshots sets
+    if (opts.count_only && (opts.checkpoint || opts.resume)) std::printf("count-only runs are not checkpointed\n\r");
+    if (sortDedup && (opts.checkpoint || opts.resume)) std::printf("runs with sort deduplication are not checkpointed\n\r");
+    if ((opts.checkpoint || opts.resume) && !opts.count_only && !sortDedup) {
+        const auto dir = ResumeWriter::folder(base_path, n);
+        if (opts.resume && ResumeWriter::load(dir, n, hashes, donePairs))
+            std::printf("resuming N = %d from %s, %lu of %lu shape pairs are done\n\r", n, dir.c_str(), donePairs.size(), pairs.size());
+        else
+            std::filesystem::remove_all(dir);
+        resume = std::make_unique<ResumeWriter>(dir, n, hashes, pairs, donePairs);
+    }
 
-            std::printf("  shape %d %d %d\n\r", shape.x(), shape.y(), shape.z());
+    CacheWriter writer;
+    PCubeWriter pcubeWriter;
+    if (write_cache && !split_cache && opts.pcube)
+        pcubeWriter.open(base_path + "cubes_" + std::to_string(n) + ".pcube", n, outShapes);
+    else if (write_cache && !split_cache)
+        writer.open(base_path + "cubes_" + std::to_string(n) + ".bin", n, outShapes, opts.direct_io);
 
-            if (use_split_cache) {
-                // load cache file only for this shape
-                std::string cachefile = base_path + "cubes_" + std::to_string(n - 1) + "_" + std::to_string(prevShapes[sid].x()) + "-" +
-                                        std::to_string(prevShapes[sid].y()) + "-" + std::to_string(prevShapes[sid].z()) + ".bin";
-                cr.loadFile(cachefile);
-                // cr.printHeader();
+    // A target shape is finished when the last of its input shapes is expanded. Then it is
+    // counted and, when it goes to a cache file or the split cache, written and dropped.
+    struct Target {
+        XYZ shape;
+        std::atomic<int> pending{0};  // pairs left, all counted before the first is queued
+        bool started = false;
+        std::mutex mu;
+        CountStats counts;  // hashless
+        std::unique_ptr<SortedRuns> runs;  // instead of its set with -D sort
+        explicit Target(XYZ shape) : shape(shape) {}
+    };
+    std::mutex statsMu;
+    CountStats totalStats;
+    std::atomic<int> spilled = 0;
+    auto finishTarget = [&](Target &target) {
+        XYZ targetShape = target.shape;
+        auto &set = hashes.byshape[targetShape];
+        // a shape kept for the returned cache goes to its split cache file instead when memory is short
+        const bool kept = !hashless && !split_cache && !writer.isOpen() && !pcubeWriter.isOpen() && !feed;
+        const bool spill = kept && budget && opts.spill && budget->pressure() != MemoryBudget::Pressure::Low;
+        // sorted runs are counted while they are merged into the cache file
+        uint64_t merged = 0;
+        auto writeTo = [&](auto &w) {
+            // the runs are merged in order
+            if (target.runs)
+                w.writeShapeWith(targetShape, [&](auto add) { merged = target.runs->merge(add, threads); }, true);
+            else if (opts.sorted_cache && !set.frozen)
+                w.writeFrozen(targetShape, FrozenShape(set.sets(), n, targetShape));
+            else
+                w.writeShape(targetShape, set);
+        };
+        if ((write_cache && split_cache) || spill) {
+            CacheWriter splitWriter;
+            if (splitWriter.open(base_path + "cubes_" + std::to_string(n) + "_" + std::to_string(targetShape.x()) + "-" + std::to_string(targetShape.y()) + "-" +
+                                     std::to_string(targetShape.z()) + ".bin",
+                                 n, outShapes, opts.direct_io)) {
+                writeTo(splitWriter);
+                splitWriter.close();
             }
-            auto s = base->getCubesByShape(sid);
-            if (shape != s.shape()) {
-                std::printf("ERROR caches shape does not match expected shape!\n");
+        } else if (writer.isOpen()) {
+            writeTo(writer);
+        } else if (pcubeWriter.isOpen()) {
+            writeTo(pcubeWriter);
+        }
+        uint64_t targetCount = hashless ? target.counts.count : target.runs ? merged : set.size();
+        target.runs.reset();
+        if (opts.count_only)
+            std::printf("  shape [%2d %2d %2d] num: %lu chiral: %lu\n\r", targetShape.x(), targetShape.y(), targetShape.z(), targetCount, target.counts.chiral);
+        else
+            std::printf("  shape [%2d %2d %2d] num: %lu\n\r", targetShape.x(), targetShape.y(), targetShape.z(), targetCount);
+        if (spill) {
+            std::printf("  spilled shape [%2d %2d %2d] to its split cache file, memory is short\n\r", targetShape.x(), targetShape.y(), targetShape.z());
+            spilled++;
+        }
+        if (budget) budget->report("after the shape", MemoryBudget::setBytes(hashes, n));
+        totalSum += targetCount;
+        if (hashless) {
+            std::lock_guard<std::mutex> lk(statsMu);
+            totalStats += target.counts;
+        }
+        if (feed) feed(targetShape, set);
+        std::function<void()> drop;
+        if (split_cache || writer.isOpen() || pcubeWriter.isOpen() || feed || spill) {
+            drop = [&set]() {
+                for (auto &subset : set.byhash) subset.set.clear();
+            };
+        } else if (!hashless) {
+            // kept for the FlatCache of N, which refers to the frozen cubes
+            drop = [&set, n, targetShape]() { set.freeze(n, targetShape); };
+        }
+        // the set is only dropped or frozen once the resume state has all of it
+        if (resume)
+            resume->targetDone(targetShape, drop);
+        else if (drop)
+            drop();
+    };
+    auto release = [&](Target &target) {
+        if (--target.pending == 0) finishTarget(target);
+    };
+
+    // The pairs are expanded in the order of the schedule, see shapeSchedule.hpp. Its order
+    // only keeps few input shapes in use if they can be released: a mapped cache file drops
+    // the pages of a shape, and the pipeline its unpacked cubes. Dropped targets also finish
+    // earlier when they are expanded one after the other.
+    const bool mapped = base == &cr && !use_split_cache;
+    std::vector<uint32_t> todo;
+    for (uint32_t pi = 0; pi < pairs.size(); ++pi)
+        if (!donePairs.count(pi)) todo.push_back(pi);
+    std::vector<uint64_t> weights;
+    if (base && !use_split_cache)
+        for (uint32_t sid = 0; sid < base->numShapes(); ++sid) weights.push_back(base->getCubesByShape(sid).size());
+    const ShapeSchedule schedule(pairs, todo, weights, mapped || pipelined || split_cache || writer.isOpen() || pcubeWriter.isOpen());
+    // this many pairs are queued at most, so the pool keeps close to the order
+    const int inFlightLimit = PAIRS_IN_FLIGHT * threads;
+    int inFlight = 0;
+    std::mutex inFlightMu;
+    std::condition_variable inFlightCv;
+    // close to the memory budget fewer targets grow at the same time
+    MemoryBudget::Pressure lastPressure = MemoryBudget::Pressure::Low;
+    auto pairLimit = [&]() {
+        if (!budget) return inFlightLimit;
+        const auto pressure = budget->pressure();
+        if (pressure != lastPressure) {
+            const char *names[] = {"low", "high", "critical"};
+            std::printf("  memory pressure %s, %lu MiB headroom\n\r", names[(int)pressure], budget->headroom() >> 20);
+            lastPressure = pressure;
+        }
+        return pressure == MemoryBudget::Pressure::Critical ? 1 : pressure == MemoryBudget::Pressure::High ? threads : inFlightLimit;
+    };
+
+    // With the pipeline the shapes of N - 1 arrive from the producer thread one by one and are
+    // unpacked here. The cubes are mapped rather than allocated, so they go back to the system
+    // right away instead of raising the mmap threshold of malloc for the sets of N.
+    struct Input {
+        XYZ *xyzs = nullptr;
+        size_t bytes = 0;
+        std::atomic<int> users{0};  // pairs of the shape not finished yet, then it is released
+        bool arrived = false;
+        void release() {
+            if (xyzs) munmap(xyzs, bytes);
+            xyzs = nullptr;
+        }
+        ~Input() { release(); }
+    };
+    const auto prevShapes = Hashy::generateShapes(n - 1);
+    std::deque<Input> inputs(prevShapes.size());
+    for (uint32_t sid = 0; sid < inputs.size(); ++sid) inputs[sid].users = schedule.users(sid);
+    std::mutex arrivedMu;
+    std::condition_variable arrivedCv;
+    auto receive = [&](XYZ shape, Hashy::Subhashy &set) {
+        const uint32_t sid = std::find(prevShapes.begin(), prevShapes.end(), shape) - prevShapes.begin();
+        auto &in = inputs[sid];
+        // shapes no pair expands are not kept
+        in.bytes = set.size() * (n - 1) * sizeof(XYZ);
+        if (in.users > 0 && in.bytes) {
+            void *p = mmap(nullptr, in.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                std::printf("ERROR could not allocate %lu bytes for shape [%2d %2d %2d]\n\r", in.bytes, shape.x(), shape.y(), shape.z());
                 exit(-1);
             }
-            // std::printf("starting %d threads\n\r", threads);
-            std::vector<std::thread> ts;
-            Workset ws(s, hashes, targetShape, shape, XYZ(diffx, diffy, diffz), abssum);
-            std::vector<Worker> workers;
-            ts.reserve(threads);
-            workers.reserve(threads);
-            for (int i = 0; i < threads; ++i) {
-                workers.emplace_back(ws, i);
-                ts.emplace_back(&Worker::run, std::ref(workers[i]));
-            }
-            for (int i = 0; i < threads; ++i) {
-                ts[i].join();
+            in.xyzs = (XYZ *)p;
+            auto put = in.xyzs;
+            for (auto &subset : set.byhash) {
+                for (const auto c : subset.set) {
+                    c.unpack(put);
+                    put += n - 1;
+                }
             }
         }
-        std::printf("  num: %lu\n\r", hashes.byshape[targetShape].size());
-        totalSum += hashes.byshape[targetShape].size();
-        if (write_cache && split_cache) {
-            Cache::save(base_path + "cubes_" + std::to_string(n) + "_" + std::to_string(targetShape.x()) + "-" + std::to_string(targetShape.y()) + "-" +
-                            std::to_string(targetShape.z()) + ".bin",
-                        hashes, n);
-        }
-        if (split_cache) {
-            for (auto &subset : hashes.byshape[targetShape].byhash) {
-                subset.set.clear();
-                subset.set.reserve(1);
-            }
+        std::lock_guard<std::mutex> lk(arrivedMu);
+        in.arrived = true;
+        arrivedCv.notify_all();
+    };
+
+    // A pair is expanded as one workset, or one per block when its cubes are streamed in.
+    struct PairRun {
+        size_t pi;
+        Target &target;
+        std::atomic<int> blocks{1};  // worksets left, plus one until all are queued
+        std::mutex mu;
+        CountStats counts;
+        PairRun(size_t pi, Target &target) : pi(pi), target(target) {}
+    };
+    auto finishPair = [&](PairRun &run) {
+        if (--run.blocks != 0) return;
+        {
+            std::lock_guard<std::mutex> lk(run.target.mu);
+            run.target.counts += run.counts;
+        }
+        if (resume) resume->pairDone(run.target.shape, run.pi, run.counts.count);
+        release(run.target);
+        const uint32_t sid = pairs[run.pi].sid;
+        if (--inputs[sid].users == 0) {
+            if (pipelined)
+                inputs[sid].release();
+            else if (mapped)
+                cr.releaseShape(sid);
+        }
+        {
+            std::lock_guard<std::mutex> lk(inFlightMu);
+            inFlight--;
+        }
+        inFlightCv.notify_one();
+    };
+
+    // How the mapped input file is read, see inputPipeline.hpp. Caches in memory and the
+    // split cache files are always expanded from memory.
+    std::unique_ptr<Readahead> readahead;
+    std::unique_ptr<BlockStream> stream;
+    if (mapped && opts.input == "readahead") {
+        readahead = std::make_unique<Readahead>(READAHEAD_WINDOW, READAHEAD_AHEAD, opts.huge_pages);
+    } else if (mapped && opts.input == "stream") {
+        stream = std::make_unique<BlockStream>(cr.path(), STREAM_BLOCK, std::max(threads, 2) + 2, opts.direct_io);
+        if (!stream->isOpen()) exit(-1);
+    }
+
+    // All (target shape, input shape) pairs go to one pool, only with -u the input shape
+    // has to be finished before the next one is loaded.
+    NumaTopology numa = opts.numa ? NumaTopology::detect() : NumaTopology();
+    if (opts.numa) std::printf("%d NUMA nodes\n\r", numa.nodes());
+    WorkPool pool(threads, opts.numa ? &numa : nullptr);
+    std::unique_ptr<InsertRouter> router;
+    if (!hashless && pool.node(pool.threads() - 1) > 0) {
+        std::vector<int> workerNode;
+        for (int i = 0; i < pool.threads(); ++i) workerNode.push_back(pool.node(i));
+        router = std::make_unique<InsertRouter>(workerNode.back() + 1, workerNode);
+    }
+    // the gpu gets batches of cubes instead of the chunks of the pool
+    std::unique_ptr<GpuExpander> gpu;
+    if (opts.gpu) {
+        gpu = GpuExpander::open(n);
+        if (!gpu) {
+            std::printf("ERROR no gpu to expand on, gpu expansion needs a build with -DCUBES_CUDA=ON\n\r");
+            exit(-1);
+        }
+        std::printf("expanding on %s\n\r", gpu->name());
+    }
+    const size_t grain = gpu ? GpuExpander::BATCH : 1;
+    const auto run = gpu ? Worker::runGpuFor(n) : Worker::runFor(n);
+    std::deque<Workset> worksets;
+    std::deque<Target> targets;
+    std::deque<PairRun> pairRuns;
+    auto progress = startProgress(n, pool.threads(), hashless ? nullptr : &hashes, opts);
+    std::atomic<uint64_t> expanded = 0, queued = 0;
+
+    // expand the cubes s of pair pi, counted in target.pending already
+    auto expandPair = [&](size_t pi, Target &target, ShapeRange s) {
+        const auto &pair = pairs[pi];
+        const auto sid = pair.sid;
+        const auto &shape = pair.shape;
+        const XYZ targetShape = target.shape;
+        auto tracked = progress ? progress->addPair(shape, targetShape, s.size()) : nullptr;
+        queued += s.size();
+        auto &pairRun = pairRuns.emplace_back(pi, target);
+        // expand the cubes of block and call done once they are
+        auto submitBlock = [&, tracked, targetShape](ShapeRange block, std::function<void()> done) {
+            auto &ws = worksets.emplace_back(block, hashes, targetShape, shape, pair.expandDim, pair.notSameShape, hashless, pool.threads());
+            ws.symmetries = opts.count_only;
+            ws.symmetry = opts.symmetry;
+            ws.progress = progress.get();
+            ws.router = router.get();
+            ws.runs = target.runs.get();
+            ws.gpu = gpu.get();
+            pairRun.blocks++;
+            const uint64_t cubeBytes = (n - 1) * sizeof(XYZ);
+            // items of the pool are batches of grain cubes
+            const size_t cubes = block.size();
+            pool.submit(
+                (cubes + grain - 1) / grain,
+                [&ws, &expanded, &queued, &readahead, run, tracked, cubeBytes, grain, cubes](size_t begin, size_t end, int worker) {
+                    begin *= grain;
+                    end = std::min(end * grain, cubes);
+                    run(ws, begin, end, worker);
+                    if (readahead) readahead->consumed((end - begin) * cubeBytes);
+                    uint64_t done = expanded += end - begin;
+                    // the progress lines replace the percentage
+                    if (tracked) {
+                        tracked->advance(end - begin);
+                    } else if (worker == 0) {
+                        std::printf("  %5.2f%%\r", 100 * (float)done / queued);
+                        std::flush(std::cout);
+                    }
+                },
+                [&ws, &pairRun, &finishPair, done]() {
+                    if (ws.router) {
+                        uint64_t duplicates = ws.router->finish(ws.routed);
+                        if (ws.progress) ws.progress->addDuplicates(duplicates);
+                    }
+                    auto counts = ws.total();
+                    if (done) done();
+                    {
+                        std::lock_guard<std::mutex> lk(pairRun.mu);
+                        pairRun.counts += counts;
+                    }
+                    finishPair(pairRun);
+                });
+        };
+        if (stream) {
+            stream->read(cr.shapeOffset(sid), s.bytes(), n - 1, shape, submitBlock);
+        } else if (readahead) {
+            const size_t id = readahead->queue(s);
+            submitBlock(s, [&readahead, id]() { readahead->done(id); });
+        } else {
+            submitBlock(s, {});
+        }
+        finishPair(pairRun);
+    };
+
+    // all targets first, the schedule can start with any of them
+    std::map<XYZ, Target *> byShape;
+    for (auto targetShape : outShapes) {
+        auto &target = targets.emplace_back(targetShape);
+        if (sortDedup) target.runs = std::make_unique<SortedRuns>(n, targetShape, pool.threads(), runBudget, runFolder);
+        byShape[targetShape] = &target;
+    }
+    for (uint32_t pi = 0; pi < pairs.size(); ++pi) {
+        auto &target = *byShape[pairs[pi].target];
+        if (donePairs.count(pi))
+            target.counts.count += donePairs[pi];
+        else
+            target.pending++;
+    }
+    for (auto &target : targets)
+        if (target.pending == 0) finishTarget(target);
+
+    // With the pipeline N - 1 runs in its own pool, each pair waits for its input shape.
+    std::thread producer;
+    if (pipelined) {
+        GenOptions prevOpts = opts;
+        prevOpts.split_cache = prevOpts.hashless = prevOpts.count_only = false;
+        // the producer hands its sets over, so they are not snapshotted or sorted
+        prevOpts.checkpoint = prevOpts.resume = false;
+        prevOpts.dedup = "hash";
+        producer = std::thread([&receive, prevOpts, n]() { genLevel(n - 1, prevOpts, receive); });
+    }
+    for (uint32_t pi : schedule.order()) {
+        const auto &pair = pairs[pi];
+        const auto sid = pair.sid;
+        const auto &shape = pair.shape;
+        auto &target = *byShape[pair.target];
+        if (!target.started) {
+            target.started = true;
+            outShapeCount++;
+            std::printf("process output shape %3d/%d [%2d %2d %2d]\n\r", outShapeCount, totalOutputShapes, pair.target.x(), pair.target.y(), pair.target.z());
+        }
+        std::printf("  shape %d %d %d\n\r", shape.x(), shape.y(), shape.z());
+        {
+            std::unique_lock<std::mutex> lk(inFlightMu);
+            inFlightCv.wait(lk, [&]() { return inFlight < pairLimit(); });
+            inFlight++;
+        }
+        if (pipelined) {
+            auto &in = inputs[sid];
+            std::unique_lock<std::mutex> lk(arrivedMu);
+            arrivedCv.wait(lk, [&in]() { return in.arrived; });
+            lk.unlock();
+            expandPair(pi, target, ShapeRange(in.xyzs, (XYZ *)((uint8_t *)in.xyzs + in.bytes), n - 1, shape));
+            continue;
         }
+
+        if (use_split_cache) {
+            // load cache file only for this shape
+            std::string cachefile = base_path + "cubes_" + std::to_string(n - 1) + "_" + std::to_string(shape.x()) + "-" + std::to_string(shape.y()) + "-" +
+                                    std::to_string(shape.z()) + ".bin";
+            cr.loadFile(cachefile);
+            // cr.printHeader();
+        }
+        auto s = base->getCubesByShape(sid);
+        checkShape(s, shape);
+        expandPair(pi, target, s);
+        if (use_split_cache) pool.wait();
     }
-    if (write_cache && !split_cache) {
-        Cache::save(base_path + "cubes_" + std::to_string(n) + ".bin", hashes, n);
+    if (producer.joinable()) producer.join();
+    pool.wait();
+    if (progress) progress->stop();
+    if (resume) resume->flush();
+    if (writer.isOpen()) writer.close();
+    if (pcubeWriter.isOpen()) pcubeWriter.close();
+    if (sortDedup) {
+        std::printf("sorted runs: %.1f MiB spilled to disk\n\r", runBudget.spilled / (1024.0 * 1024.0));
+        std::filesystem::remove_all(runFolder);
     }
     auto end = std::chrono::steady_clock::now();
     auto dt_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     std::printf("took %.2f s\033[0K\n\r", dt_ms / 1000.f);
-    std::printf("num total cubes: %lu\n\r", totalSum);
+    std::printf("num total cubes: %lu\n\r", totalSum.load());
     checkResult(n, totalSum);
-    return FlatCache(hashes, n);
+    if (opts.count_only) {
+        const uint64_t achiral = totalStats.count - totalStats.chiral;
+        std::printf("chiral: %lu in %lu mirror pairs, achiral: %lu\n\r", totalStats.chiral, totalStats.chiral / 2, achiral);
+        std::printf("free polycubes (mirror images identified): %lu\n\r", achiral + totalStats.chiral / 2);
+        for (int order = 1; order <= 24; ++order)
+            if (totalStats.byOrder[order]) std::printf("  symmetry order %2d: %lu\n\r", order, totalStats.byOrder[order]);
+        checkFreeResult(n, achiral + totalStats.chiral / 2);
+    }
+    if (resume) resume->remove();
+    if (spilled) std::printf("%d shapes were spilled to split cache files, they are not in the returned cache\n\r", spilled.load());
+    if (hashless || feed) return {};
+    return FlatCache(hashes, n, threads);
 }
+
+FlatCache gen(int n, const GenOptions &opts) { return genLevel(n, opts, {}); }
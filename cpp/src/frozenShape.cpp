@@ -0,0 +1,72 @@
+#include "frozenShape.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include "canonical.hpp"
+#include "packedCube.hpp"
+#include "sortedRuns.hpp"
+
+FrozenShape::FrozenShape(const std::vector<const FlatCubeSet *> &sets, int n, XYZ shape) : n_(n), shape_(shape) {
+    // the packed records sort in the order of their XYZs, so they are sorted packed and
+    // only unpacked once into place
+    const int words = packedWords(n);
+    std::vector<uint64_t> packed;
+    uint64_t total = 0;
+    for (auto set : sets) total += set->size();
+    packed.reserve(total * words);
+    for (auto set : sets) set->snapshot(packed);
+    size_ = SortedRuns::sortUnique(packed.data(), packed.size() / words, words);
+    xyzs_.resize(size_ * n);
+    for (uint64_t i = 0; i < size_; ++i) unpackXYZs(packed.data() + i * words, n, xyzs_.data() + i * n);
+}
+
+FrozenShape::FrozenShape(std::vector<XYZ> xyzs, int n, XYZ shape, bool sorted) : xyzs_(std::move(xyzs)), size_(xyzs_.size() / n), n_(n), shape_(shape) {
+    if (!sorted) sort();
+}
+
+void FrozenShape::sort() {
+    const int n = n_;
+    // sort indices rather than moving records of n XYZs around
+    std::vector<uint64_t> order(size_);
+    std::iota(order.begin(), order.end(), 0);
+    const XYZ *base = xyzs_.data();
+    std::sort(order.begin(), order.end(), [base, n](uint64_t a, uint64_t b) { return compare(base + a * n, base + b * n, n) < 0; });
+    std::vector<XYZ> sorted(size_ * n);
+    auto put = sorted.data();
+    for (auto i : order) {
+        std::copy(base + i * n, base + (i + 1) * n, put);
+        put += n;
+    }
+    xyzs_ = std::move(sorted);
+}
+
+uint64_t FrozenShape::removeInvalid() {
+    std::vector<XYZ> canonical(n_);
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < size_; ++i) {
+        const XYZ *c = cube(i);
+        if (kept > 0 && compare(cube(kept - 1), c, n_) == 0) continue;
+        if (!(Canonical::canonicalize(c, n_, shape_, canonical.data()) == shape_) || compare(canonical.data(), c, n_) != 0) continue;
+        std::copy(c, c + n_, xyzs_.data() + kept * n_);
+        kept++;
+    }
+    const uint64_t removed = size_ - kept;
+    size_ = kept;
+    xyzs_.resize(kept * n_);
+    return removed;
+}
+
+int64_t FrozenShape::find(const XYZ *points) const {
+    uint64_t lo = 0, hi = size_;
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        const int c = compare(cube(mid), points, n_);
+        if (c == 0) return mid;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
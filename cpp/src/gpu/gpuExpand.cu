@@ -0,0 +1,344 @@
+// CUDA backend of GpuExpander, see gpuExpand.hpp. Only built with -DCUBES_CUDA=ON.
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "canonical.hpp"
+#include "gpuExpand.hpp"
+
+namespace {
+
+constexpr int MAX_N = Canonical::MAX_POINTS;
+constexpr int THREADS_PER_BLOCK = 128;
+// bytes of device memory for the children of one batch
+constexpr size_t BATCH_BYTES = 64 << 20;
+
+#define CUDA_CHECK(call)                                                                               \
+    do {                                                                                               \
+        cudaError_t err = (call);                                                                      \
+        if (err != cudaSuccess) {                                                                      \
+            std::printf("ERROR cuda: %s at %s:%d\n\r", cudaGetErrorString(err), __FILE__, __LINE__); \
+            exit(-1);                                                                                  \
+        }                                                                                              \
+    } while (0)
+
+__constant__ RotationKeys cKeys;
+__constant__ RotationClasses cClasses;
+// component d of the rotated shape is component cPerm[r][d] of the shape
+__constant__ int8_t cPerm[24][3];
+
+struct DevicePair {
+    int shape[3], target[3], expandDim[3];
+    int notSameShape;
+};
+
+// points are kept as the keys of Canonical::key(), so sorted keys are sorted XYZs
+__device__ __forceinline__ int key(int x, int y, int z) { return x << 16 | y << 8 | z; }
+__device__ __forceinline__ int component(int k, int d) { return (k >> (16 - 8 * d)) & 0xff; }
+
+__device__ void sortKeys(int *k, int n) {
+    for (int i = 1; i < n; ++i) {
+        const int v = k[i];
+        int j = i - 1;
+        for (; j >= 0 && k[j] > v; --j) k[j + 1] = k[j];
+        k[j + 1] = v;
+    }
+}
+
+__device__ bool findKey(const int *k, int n, int v) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (k[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < n && k[lo] == v;
+}
+
+__device__ bool lexLess(const int *a, const int *b, int n) {
+    for (int i = 0; i < n; ++i)
+        if (a[i] != b[i]) return a[i] < b[i];
+    return false;
+}
+
+__device__ int rotationClass(const int s[3]) {
+    return (s[0] <= s[1]) | (s[1] <= s[2]) << 1 | (s[0] <= s[2]) << 2 | (s[1] <= s[0]) << 3 | (s[2] <= s[1]) << 4 | (s[2] <= s[0]) << 5;
+}
+
+// Canonical::scalar(): canonical keys of points (within shape s) into best, their shape into outShape
+__device__ void canonicalize(const int *points, int n, const int s[3], int *best, int outShape[3]) {
+    const int cls = rotationClass(s);
+    int keys[MAX_N];
+    int bestRot = -1;
+    for (int j = 0; j < cClasses.count[cls]; ++j) {
+        const int r = cClasses.rot[cls][j];
+        const int off = s[0] * cKeys.offx[r] + s[1] * cKeys.offy[r] + s[2] * cKeys.offz[r];
+        int lowest = 0x7fffffff;
+        for (int i = 0; i < n; ++i) {
+            keys[i] = component(points[i], 0) * cKeys.mx[r] + component(points[i], 1) * cKeys.my[r] + component(points[i], 2) * cKeys.mz[r] + off;
+            lowest = min(lowest, keys[i]);
+        }
+        if (bestRot >= 0 && lowest < best[0]) continue;
+        sortKeys(keys, n);
+        if (bestRot < 0 || lexLess(best, keys, n)) {
+            for (int i = 0; i < n; ++i) best[i] = keys[i];
+            bestRot = r;
+        }
+    }
+    for (int d = 0; d < 3; ++d) outShape[d] = s[cPerm[bestRot][d]];
+}
+
+// Workset::isConnected() of sorted keys
+__device__ bool isConnected(const int *k, int n) {
+    const int step[3] = {1 << 16, 1 << 8, 1};
+    uint32_t visited = 1;
+    int stack[MAX_N];
+    int top = 0, found = 1;
+    stack[top++] = 0;
+    while (top > 0) {
+        const int p = k[stack[--top]];
+        for (int d = 0; d < 3; ++d) {
+            for (int s = -1; s <= 1; s += 2) {
+                const int c = component(p, d) + s;
+                if (c < 0 || c > 0xff) continue;
+                const int v = p + s * step[d];
+                int lo = 0, hi = n;
+                while (lo < hi) {
+                    const int mid = (lo + hi) / 2;
+                    if (k[mid] < v)
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                if (lo == n || k[lo] != v || (visited & (1u << lo))) continue;
+                visited |= 1u << lo;
+                stack[top++] = lo;
+                found++;
+            }
+        }
+    }
+    return found == n;
+}
+
+// Workset::isCanonicalParent() of the canonical child with n keys
+__device__ bool isCanonicalParent(const int *child, int n, const int *parent, const DevicePair &pair) {
+    int rest[MAX_N];
+    for (int r = n - 1; r >= 0; --r) {
+        for (int i = 0, j = 0; i < n; ++i)
+            if (i != r) rest[j++] = child[i];
+        if (isConnected(rest, n - 1)) break;
+    }
+    int lo[3] = {0xff, 0xff, 0xff}, hi[3] = {0, 0, 0};
+    for (int i = 0; i < n - 1; ++i) {
+        for (int d = 0; d < 3; ++d) {
+            lo[d] = min(lo[d], component(rest[i], d));
+            hi[d] = max(hi[d], component(rest[i], d));
+        }
+    }
+    const int shift = key(lo[0], lo[1], lo[2]);
+    for (int i = 0; i < n - 1; ++i) rest[i] -= shift;
+    const int restShape[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+    // cheap reject: the parent has to have the shape of the pair
+    int sorted[3] = {restShape[0], restShape[1], restShape[2]};
+    sortKeys(sorted, 3);
+    for (int d = 0; d < 3; ++d)
+        if (sorted[d] != pair.shape[d]) return false;
+    int canonical[MAX_N], unused[3];
+    canonicalize(rest, n - 1, restShape, canonical, unused);
+    for (int i = 0; i < n - 1; ++i)
+        if (canonical[i] != parent[i]) return false;
+    return true;
+}
+
+// One thread per parent with n - 1 cubes. Its distinct children go to its slot of scratch
+// (n keys and the shape key each), then to the next free place of children and shapes.
+__global__ void expandKernel(const uint8_t *parents, unsigned count, int n, DevicePair pair, int mode, int *scratch, int slot, uint8_t *children,
+                             uint8_t *shapes, unsigned long long *total) {
+    const unsigned t = blockIdx.x * blockDim.x + threadIdx.x;
+    if (t >= count) return;
+    const int m = n - 1;
+    int parent[MAX_N];
+    const uint8_t *in = parents + (size_t)t * m * 3;
+    for (int i = 0; i < m; ++i) parent[i] = key(in[3 * i], in[3 * i + 1], in[3 * i + 2]);
+
+    // Workset::neighbours(), with every candidate moved by one so cells at -1 have a key
+    int candidates[6 * MAX_N];
+    int nc = 0;
+    const int one = key(1, 1, 1);
+    for (int i = 0; i < m; ++i) {
+        const int p[3] = {component(parent[i], 0), component(parent[i], 1), component(parent[i], 2)};
+        for (int d = 0; d < 3; ++d) {
+            const int step = 1 << (16 - 8 * d);
+            const bool up = pair.notSameShape ? pair.expandDim[d] == 1 && p[d] == pair.shape[d] : p[d] < pair.shape[d];
+            const bool down = pair.notSameShape ? pair.expandDim[d] == 1 && p[d] == 0 : p[d] > 0;
+            if (up) candidates[nc++] = parent[i] + one + step;
+            if (down) candidates[nc++] = parent[i] + one - step;
+        }
+    }
+    sortKeys(candidates, nc);
+
+    int *out = scratch + (size_t)t * slot;
+    int found = 0;
+    int child[MAX_N], canonical[MAX_N];
+    for (int c = 0; c < nc; ++c) {
+        if (c > 0 && candidates[c] == candidates[c - 1]) continue;
+        // moved back: the coordinates of the new cube, -1 to shape + 1
+        const int p[3] = {component(candidates[c], 0) - 1, component(candidates[c], 1) - 1, component(candidates[c], 2) - 1};
+        const bool outside = p[0] < 0 || p[1] < 0 || p[2] < 0;
+        if (!outside && findKey(parent, m, key(p[0], p[1], p[2]))) continue;
+        const int a[3] = {p[0] < 0, p[1] < 0, p[2] < 0};
+        const int shift = key(a[0], a[1], a[2]);
+        int shape[3] = {p[0] + a[0], p[1] + a[1], p[2] + a[2]};
+        child[0] = key(shape[0], shape[1], shape[2]);
+        for (int i = 0; i < m; ++i) {
+            child[i + 1] = parent[i] + shift;
+            for (int d = 0; d < 3; ++d) shape[d] = max(shape[d], component(child[i + 1], d));
+        }
+        int childShape[3];
+        canonicalize(child, n, shape, canonical, childShape);
+        if (mode != (int)GpuExpander::Mode::Insert && !isCanonicalParent(canonical, n, parent, pair)) continue;
+        // a symmetric parent produces the same child from several candidates
+        bool seen = false;
+        for (int j = 0; j < found && !seen; ++j) {
+            const int *prev = out + j * (n + 1);
+            seen = true;
+            for (int i = 0; i < n && seen; ++i) seen = prev[i] == canonical[i];
+        }
+        if (seen) continue;
+        int *put = out + found * (n + 1);
+        for (int i = 0; i < n; ++i) put[i] = canonical[i];
+        put[n] = key(childShape[0], childShape[1], childShape[2]);
+        found++;
+    }
+    if (found == 0) return;
+    const unsigned long long base = atomicAdd(total, (unsigned long long)found);
+    if (mode == (int)GpuExpander::Mode::Count) return;
+    for (int j = 0; j < found; ++j) {
+        const int *src = out + j * (n + 1);
+        uint8_t *dst = children + (base + j) * n * 3;
+        for (int i = 0; i < n; ++i)
+            for (int d = 0; d < 3; ++d) dst[3 * i + d] = component(src[i], d);
+        for (int d = 0; d < 3; ++d) shapes[(base + j) * 3 + d] = component(src[n], d);
+    }
+}
+
+class CudaExpander : public GpuExpander {
+   public:
+    CudaExpander(int n, const std::string &device) : n_(n), name_(device) {
+        // a parent has at most 6 candidates per cube
+        maxChildren_ = 6 * (n - 1);
+        slot_ = maxChildren_ * (n + 1);
+        batch_ = std::max<size_t>(1, std::min<size_t>(BATCH, BATCH_BYTES / (slot_ * sizeof(int))));
+    }
+
+    ~CudaExpander() override {
+        for (auto &[worker, s] : streams_) {
+            cudaStreamDestroy(s->stream);
+            cudaFree(s->parents);
+            cudaFree(s->scratch);
+            cudaFree(s->children);
+            cudaFree(s->shapes);
+            cudaFree(s->total);
+            cudaFreeHost(s->hostParents);
+            cudaFreeHost(s->hostTotal);
+        }
+    }
+
+    const char *name() const override { return name_.c_str(); }
+
+    void expand(int worker, const Pair &pair, const XYZ *parents, uint64_t count, Mode mode, Output &out) override {
+        auto &s = stream(worker);
+        const int m = n_ - 1;
+        DevicePair dp;
+        for (int d = 0; d < 3; ++d) {
+            dp.shape[d] = pair.shape[d];
+            dp.target[d] = pair.targetShape[d];
+            dp.expandDim[d] = pair.expandDim[d];
+        }
+        dp.notSameShape = pair.notSameShape;
+        out.count = 0;
+        out.children.clear();
+        out.shapes.clear();
+        for (uint64_t done = 0; done < count; done += batch_) {
+            const unsigned k = std::min<uint64_t>(batch_, count - done);
+            const size_t bytes = (size_t)k * m * sizeof(XYZ);
+            std::memcpy(s.hostParents, parents + done * m, bytes);
+            CUDA_CHECK(cudaMemcpyAsync(s.parents, s.hostParents, bytes, cudaMemcpyHostToDevice, s.stream));
+            CUDA_CHECK(cudaMemsetAsync(s.total, 0, sizeof(unsigned long long), s.stream));
+            const unsigned blocks = (k + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
+            expandKernel<<<blocks, THREADS_PER_BLOCK, 0, s.stream>>>(s.parents, k, n_, dp, (int)mode, s.scratch, slot_, s.children, s.shapes, s.total);
+            CUDA_CHECK(cudaGetLastError());
+            CUDA_CHECK(cudaMemcpyAsync(s.hostTotal, s.total, sizeof(unsigned long long), cudaMemcpyDeviceToHost, s.stream));
+            CUDA_CHECK(cudaStreamSynchronize(s.stream));
+            const uint64_t found = *s.hostTotal;
+            if (mode != Mode::Count && found) {
+                const size_t at = out.count;
+                out.children.resize((at + found) * n_);
+                out.shapes.resize(at + found);
+                CUDA_CHECK(cudaMemcpyAsync(out.children.data() + at * n_, s.children, found * n_ * sizeof(XYZ), cudaMemcpyDeviceToHost, s.stream));
+                CUDA_CHECK(cudaMemcpyAsync(out.shapes.data() + at, s.shapes, found * sizeof(XYZ), cudaMemcpyDeviceToHost, s.stream));
+                CUDA_CHECK(cudaStreamSynchronize(s.stream));
+            }
+            out.count += found;
+        }
+    }
+
+   private:
+    // buffers of one worker, allocated on its first batch
+    struct Stream {
+        cudaStream_t stream;
+        uint8_t *parents, *children, *shapes;
+        int *scratch;
+        unsigned long long *total;
+        uint8_t *hostParents;  // pinned
+        unsigned long long *hostTotal;
+    };
+
+    Stream &stream(int worker) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto &s = streams_[worker];
+        if (!s) {
+            s = std::make_unique<Stream>();
+            const size_t children = batch_ * maxChildren_;
+            CUDA_CHECK(cudaStreamCreateWithFlags(&s->stream, cudaStreamNonBlocking));
+            CUDA_CHECK(cudaMalloc(&s->parents, batch_ * (n_ - 1) * sizeof(XYZ)));
+            CUDA_CHECK(cudaMalloc(&s->scratch, batch_ * slot_ * sizeof(int)));
+            CUDA_CHECK(cudaMalloc(&s->children, children * n_ * sizeof(XYZ)));
+            CUDA_CHECK(cudaMalloc(&s->shapes, children * sizeof(XYZ)));
+            CUDA_CHECK(cudaMalloc(&s->total, sizeof(unsigned long long)));
+            CUDA_CHECK(cudaMallocHost(&s->hostParents, batch_ * (n_ - 1) * sizeof(XYZ)));
+            CUDA_CHECK(cudaMallocHost(&s->hostTotal, sizeof(unsigned long long)));
+        }
+        return *s;
+    }
+
+    int n_;
+    std::string name_;
+    size_t maxChildren_, slot_, batch_;
+    std::mutex mu_;
+    std::map<int, std::unique_ptr<Stream>> streams_;
+};
+
+}  // namespace
+
+std::unique_ptr<GpuExpander> GpuExpander::open(int n) {
+    if (n < 2 || n > MAX_N) return nullptr;
+    int devices = 0;
+    if (cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0) return nullptr;
+    cudaDeviceProp props;
+    CUDA_CHECK(cudaGetDeviceProperties(&props, 0));
+    int8_t perm[24][3];
+    for (int r = 0; r < 24; ++r)
+        for (int d = 0; d < 3; ++d) perm[r][d] = Rotations::LUT[r][d];
+    CUDA_CHECK(cudaMemcpyToSymbol(cKeys, &Canonical::ROTATION_KEYS, sizeof(RotationKeys)));
+    CUDA_CHECK(cudaMemcpyToSymbol(cClasses, &Canonical::ROTATION_CLASSES, sizeof(RotationClasses)));
+    CUDA_CHECK(cudaMemcpyToSymbol(cPerm, perm, sizeof(perm)));
+    return std::make_unique<CudaExpander>(n, props.name);
+}
@@ -0,0 +1,6 @@
+#include "gpuExpand.hpp"
+
+#ifndef CUBES_CUDA
+// built without the CUDA library, see CMakeLists.txt
+std::unique_ptr<GpuExpander> GpuExpander::open(int) { return nullptr; }
+#endif
@@ -0,0 +1,223 @@
+#include "inputPipeline.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static uint8_t *pageDown(const void *p, uint64_t page) { return (uint8_t *)((uintptr_t)p & ~(uintptr_t)(page - 1)); }
+static uint8_t *pageUp(const void *p, uint64_t page) { return pageDown((const uint8_t *)p + page - 1, page); }
+
+Readahead::Readahead(uint64_t window, uint64_t ahead, bool hugePages) : window_(window), ahead_(std::max(ahead, window)), hugePages_(hugePages) {
+    thread_ = std::thread(&Readahead::run, this);
+}
+
+Readahead::~Readahead() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+size_t Readahead::queue(ShapeRange range) {
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    uint8_t *begin = pageDown(range.data(), page);
+    uint8_t *end = (uint8_t *)range.data() + range.bytes();
+    // the workers take chunks of the range in any order, but the range as a whole is read once
+    if (end > begin) {
+        madvise(begin, end - begin, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        // only honoured for file mappings by kernels with read-only THP for file systems
+        if (hugePages_) madvise(begin, end - begin, MADV_HUGEPAGE);
+#endif
+    }
+    size_t id;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        id = ranges_.size();
+        ranges_.push_back({begin, end, begin});
+    }
+    cv_.notify_all();
+    return id;
+}
+
+void Readahead::done(size_t id) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        ranges_[id].done = true;
+        drop_.push_back(ranges_[id]);
+    }
+    cv_.notify_all();
+}
+
+void Readahead::consumed(uint64_t bytes) {
+    if ((consumed_ += bytes) < wakeAt_) return;
+    std::lock_guard<std::mutex> lk(mu_);
+    cv_.notify_all();
+}
+
+void Readahead::run() {
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    std::unique_lock<std::mutex> lk(mu_);
+    while (!stop_) {
+        cv_.wait(lk, [this] {
+            if (stop_ || !drop_.empty()) return true;
+            if (next_ >= ranges_.size()) {
+                wakeAt_ = UINT64_MAX;
+                return false;
+            }
+            // while the budget is used up the workers wake the thread once they consumed enough.
+            // wakeAt_ is set before consumed_ is read, so no consumed() in between is missed.
+            wakeAt_ = advised_ + 1 > ahead_ ? advised_ + 1 - ahead_ : 0;
+            if (advised_ < consumed_ + ahead_) {
+                wakeAt_ = UINT64_MAX;
+                return true;
+            }
+            return false;
+        });
+        std::vector<std::pair<uint8_t *, uint8_t *>> drop;
+        for (auto &r : drop_) {
+            // later pairs of the same input shape still need the pages
+            bool used = false;
+            for (auto &o : ranges_) used |= !o.done && o.begin < r.end && r.begin < o.end;
+            // pages on the edges may belong to the neighbouring shapes
+            uint8_t *b = pageUp(r.begin, page), *e = pageDown(r.end, page);
+            if (!used && e > b) drop.emplace_back(b, e);
+        }
+        drop_.clear();
+        while (next_ < ranges_.size() && ranges_[next_].done) ++next_;
+        std::pair<uint8_t *, uint64_t> advise(nullptr, 0);
+        if (next_ < ranges_.size() && advised_ < consumed_ + ahead_) {
+            auto &r = ranges_[next_];
+            const uint64_t len = std::min<uint64_t>(window_, r.end - r.advised);
+            advise = {r.advised, len};
+            r.advised += len;
+            advised_ += len;
+            if (r.advised == r.end) ++next_;
+        }
+        lk.unlock();
+        for (auto [b, e] : drop) madvise(b, e - b, MADV_DONTNEED);
+        if (advise.second) madvise(advise.first, advise.second, MADV_WILLNEED);
+        lk.lock();
+    }
+}
+
+BlockStream::BlockStream(const std::string &path, uint64_t blockBytes, int slots, bool direct) : blockBytes_(blockBytes) {
+    if (direct) {
+#ifdef O_DIRECT
+        fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+        direct_ = fd_ >= 0;
+#endif
+        if (!direct_) std::printf("O_DIRECT not available for %s, using buffered reads\n\r", path.c_str());
+    }
+    if (fd_ < 0) fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        std::printf("ERROR could not open cache file %s\n\r", path.c_str());
+        return;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    slots_.resize(std::max(slots, 2));
+    for (auto &slot : slots_) {
+        // an unaligned block spans one more page on either side
+        slot.mem = std::make_unique<uint8_t[]>(blockBytes_ + 3 * ALIGNMENT);
+        slot.buf = pageUp(slot.mem.get(), ALIGNMENT);
+    }
+    thread_ = std::thread(&BlockStream::run, this);
+}
+
+BlockStream::~BlockStream() {
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void BlockStream::run() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+        cv_.wait(lk, [this] { return stop_ || !requests_.empty(); });
+        if (stop_) return;
+        Slot *slot = requests_.front();
+        requests_.pop_front();
+        lk.unlock();
+        readSlot(*slot);
+        lk.lock();
+        slot->state = State::Full;
+        cv_.notify_all();
+    }
+}
+
+void BlockStream::readSlot(Slot &slot) {
+    // O_DIRECT reads whole blocks at aligned offsets
+    const uint64_t start = direct_ ? slot.offset & ~(ALIGNMENT - 1) : slot.offset;
+    const uint64_t need = slot.offset + slot.bytes - start;
+    const uint64_t len = direct_ ? (need + ALIGNMENT - 1) & ~(ALIGNMENT - 1) : need;
+    uint64_t got = 0;
+    while (got < need) {
+        ssize_t r = ::pread(fd_, slot.buf + got, len - got, start + got);
+        if (r <= 0) {
+            std::printf("ERROR could not read %lu bytes at %lu from the cache file\n\r", need, start);
+            exit(-1);
+        }
+        got += r;
+    }
+    slot.data = slot.buf + (slot.offset - start);
+}
+
+void BlockStream::read(uint64_t offset, uint64_t bytes, int n, XYZ shape, const Consumer &consume) {
+    const uint64_t cube = n * sizeof(XYZ);
+    const uint64_t block = std::max<uint64_t>(blockBytes_ / cube, 1) * cube;
+    if (block > blockBytes_ + ALIGNMENT) {
+        std::printf("ERROR blocks of %lu bytes can not hold a cube of %d\n\r", blockBytes_, n);
+        exit(-1);
+    }
+    const uint64_t end = offset + bytes;
+    uint64_t pos = offset;
+    std::deque<Slot *> inflight;  // blocks in file order, reading or read
+    auto freeSlot = [this]() -> Slot * {
+        for (auto &slot : slots_)
+            if (slot.state == State::Free) return &slot;
+        return nullptr;
+    };
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+        // keep every free buffer busy reading ahead
+        for (Slot *slot; pos < end && (slot = freeSlot());) {
+            slot->offset = pos;
+            slot->bytes = std::min(block, end - pos);
+            slot->state = State::Reading;
+            pos += slot->bytes;
+            inflight.push_back(slot);
+            requests_.push_back(slot);
+            cv_.notify_all();
+        }
+        if (inflight.empty() && pos >= end) return;
+        cv_.wait(lk, [&] { return (!inflight.empty() && inflight.front()->state == State::Full) || (pos < end && freeSlot()); });
+        if (inflight.empty() || inflight.front()->state != State::Full) continue;
+        Slot *slot = inflight.front();
+        inflight.pop_front();
+        slot->state = State::InUse;
+        lk.unlock();
+        XYZ *data = (XYZ *)slot->data;
+        consume(ShapeRange(data, (XYZ *)(slot->data + slot->bytes), n, shape), [this, slot]() {
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                slot->state = State::Free;
+            }
+            cv_.notify_all();
+        });
+        lk.lock();
+    }
+}
@@ -0,0 +1,66 @@
+#include "memoryBudget.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "packedCube.hpp"
+#include "progress.hpp"
+
+MemoryBudget::MemoryBudget(uint64_t limit) : limit_(limit ? limit : detectLimit()) {}
+
+// first number in path, 0 if there is none ("max" in cgroup v2)
+static uint64_t readLimit(const char *path) {
+    std::FILE *f = std::fopen(path, "r");
+    if (!f) return 0;
+    unsigned long long value = 0;
+    int read = std::fscanf(f, "%llu", &value);
+    std::fclose(f);
+    return read == 1 ? value : 0;
+}
+
+uint64_t MemoryBudget::detectLimit() {
+    const uint64_t physical = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    uint64_t limit = physical;
+    // cgroup v2, then v1. v1 reports a huge number without limit.
+    for (auto path : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"}) {
+        const uint64_t cgroup = readLimit(path);
+        if (cgroup) limit = std::min(limit, cgroup);
+    }
+    return limit;
+}
+
+uint64_t MemoryBudget::resident() { return Progress::rss(); }
+
+uint64_t MemoryBudget::headroom() const {
+    const uint64_t used = resident();
+    return used < limit_ ? limit_ - used : 0;
+}
+
+MemoryBudget::Pressure MemoryBudget::pressure() const {
+    const uint64_t used = resident();
+    if (used >= CRITICAL * limit_) return Pressure::Critical;
+    if (used >= HIGH * limit_) return Pressure::High;
+    return Pressure::Low;
+}
+
+bool MemoryBudget::fits(uint64_t bytes) const { return resident() + bytes < HIGH * limit_; }
+
+uint64_t MemoryBudget::setBytes(Hashy &hashes, int n) {
+    const size_t slotBytes = sizeof(uint32_t) + packedWords(n) * sizeof(uint64_t);
+    uint64_t bytes = 0;
+    for (auto &[shape, set] : hashes.byshape) {
+        bytes += set.frozenSize.load(std::memory_order_relaxed) * n * sizeof(XYZ);
+        for (auto &subset : set.byhash) bytes += subset.set.capacity() * slotBytes;
+    }
+    return bytes;
+}
+
+uint64_t MemoryBudget::estimateSets(int n, uint64_t cubes) { return cubes * 2 * (sizeof(uint32_t) + packedWords(n) * sizeof(uint64_t)); }
+
+void MemoryBudget::report(const char *when, uint64_t sets) const {
+    const uint64_t used = resident();
+    std::printf("  memory %s: %lu MiB resident of %lu MiB, sets %lu MiB, %lu MiB headroom\n\r", when, used >> 20, limit_ >> 20, sets >> 20,
+                (used < limit_ ? limit_ - used : 0) >> 20);
+}
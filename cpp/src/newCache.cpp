@@ -6,6 +6,8 @@
 
 #include <iostream>
 
+#include "workPool.hpp"
+
 CacheReader::CacheReader()
     : filePointer(nullptr), path_(""), fileDescriptor_(-1), fileSize_(0), fileLoaded_(false), dummyHeader{0, 0, 0, 0}, header(&dummyHeader), shapes(nullptr) {}
 
@@ -70,6 +72,15 @@ ShapeRange CacheReader::getCubesByShape(uint32_t i) {
     return ShapeRange(start, end, header->n, XYZ(shapes[i].dim0, shapes[i].dim1, shapes[i].dim2));
 }
 
+void CacheReader::releaseShape(uint32_t i) {
+    if (!fileLoaded_ || i >= header->numShapes) return;
+    // the pages at both ends may be shared with the neighbouring shapes
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    const uint64_t begin = (shapes[i].offset + page - 1) / page * page;
+    const uint64_t end = (shapes[i].offset + shapes[i].size) / page * page;
+    if (end > begin) madvise(filePointer + begin, end - begin, MADV_DONTNEED);
+}
+
 void CacheReader::unload() {
     // unmap file from memory
     if (fileLoaded_) {
@@ -89,3 +100,45 @@ void CacheReader::unload() {
 }
 
 CacheReader::~CacheReader() { unload(); }
+
+void FlatCache::Unmap::operator()(XYZ* p) const {
+    if (p) munmap(p, bytes);
+}
+
+void FlatCache::allocate(uint64_t xyzs) {
+    const size_t bytes = xyzs * sizeof(XYZ);
+    if (bytes == 0) return;
+    void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        std::printf("ERROR could not allocate %lu bytes for the cache of N = %d\n\r", bytes, n);
+        exit(-1);
+    }
+    allXYZs = std::unique_ptr<XYZ, Unmap>((XYZ*)p, Unmap{bytes});
+}
+
+FlatCache::FlatCache(Hashy& hashes, uint8_t n, int threads) : n(n) {
+    // gen() freezes its shapes as they finish, the rest is frozen here with a job per shape
+    WorkPool pool(threads);
+    for (auto& [shape, set] : hashes.byshape)
+        if (!set.frozen) pool.submit(1, [&set = set, shape = shape, n](size_t, size_t, int) { set.freeze(n, shape); });
+    pool.wait();
+    shapes.reserve(hashes.byshape.size());
+    for (auto& [shape, set] : hashes.byshape) {
+        frozen.push_back(set.frozen);
+        shapes.emplace_back(set.frozen->data(), set.frozen->data() + set.frozen->size() * n, n, shape);
+        count += shapes.back().size();
+    }
+}
+
+FlatCache::FlatCache(uint8_t n, const std::vector<XYZ>& shapeList, const std::vector<uint64_t>& counts) : n(n) {
+    uint64_t total = 0;
+    for (auto c : counts) total += c;
+    count = total;
+    allocate(total * n);
+    shapes.reserve(shapeList.size());
+    auto put = allXYZs.get();
+    for (size_t i = 0; i < shapeList.size(); ++i) {
+        shapes.emplace_back(put, put + counts[i] * n, n, shapeList[i]);
+        put += counts[i] * n;
+    }
+}
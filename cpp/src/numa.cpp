@@ -0,0 +1,162 @@
+#include "numa.hpp"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+// cpus the process may run on
+static std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+            if (CPU_ISSET(i, &set)) cpus.push_back(i);
+    }
+    if (cpus.empty())
+        for (unsigned i = 0; i < std::max(std::thread::hardware_concurrency(), 1u); ++i) cpus.push_back(i);
+    return cpus;
+}
+
+NumaTopology::NumaTopology() : cpus_{allowedCpus()} {}
+
+std::vector<int> NumaTopology::parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        const std::string part = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (part.empty() || !std::isdigit((unsigned char)part[0])) continue;
+        const size_t dash = part.find('-');
+        const int first = std::stoi(part);
+        const int last = dash == std::string::npos ? first : std::stoi(part.substr(dash + 1));
+        for (int c = first; c <= last; ++c) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+NumaTopology NumaTopology::detect() {
+    const std::filesystem::path root("/sys/devices/system/node");
+    std::error_code ec;
+    if (!std::filesystem::is_directory(root, ec)) return NumaTopology();
+    const auto allowed = allowedCpus();
+    std::vector<std::pair<int, std::vector<int>>> found;
+    for (auto &entry : std::filesystem::directory_iterator(root, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::isdigit((unsigned char)name[4])) continue;
+        std::ifstream in(entry.path() / "cpulist");
+        std::string list;
+        std::getline(in, list);
+        std::vector<int> cpus;
+        for (int c : parseCpuList(list))
+            if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) cpus.push_back(c);
+        // memory only nodes and nodes outside of the affinity mask get no workers
+        if (!cpus.empty()) found.emplace_back(std::stoi(name.substr(4)), cpus);
+    }
+    if (found.empty()) return NumaTopology();
+    std::sort(found.begin(), found.end());
+    std::vector<std::vector<int>> nodes;
+    for (auto &[id, cpus] : found) nodes.push_back(cpus);
+    return NumaTopology(nodes);
+}
+
+bool NumaTopology::pin(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+InsertRouter::InsertRouter(int nodes, std::vector<int> workerNode) : workerNode_(std::move(workerNode)), outbox_(workerNode_.size()) {
+    for (int i = 0; i < nodes; ++i) queues_.emplace_back(std::make_unique<Queue>());
+    for (auto &boxes : outbox_) boxes.resize(nodes);
+}
+
+uint64_t InsertRouter::insert(int worker, Hashy::Subhashy &set, const uint64_t *key, int n, std::atomic<int> &pending) {
+    const int words = packedWords(n);
+    const uint64_t h = hashPackedWords(key, words);
+    const size_t shard = set.shard(h);
+    const int node = owner(shard, set.byhash.size());
+    if (node == workerNode_[worker]) return !set.byhash[shard].insert(key, n, h);
+    auto &b = outbox_[worker][node];
+    if (b.set != &set || b.pending != &pending) {
+        push(node, b);
+        b.set = &set;
+        b.pending = &pending;
+        b.n = n;
+    }
+    b.words.insert(b.words.end(), key, key + words);
+    b.hashes.push_back(h);
+    if (b.hashes.size() >= BATCH) push(node, b);
+    return 0;
+}
+
+void InsertRouter::push(int node, Batch &b) {
+    if (b.hashes.empty()) return;
+    b.pending->fetch_add(1);
+    Batch full;
+    full.set = b.set;
+    full.pending = b.pending;
+    full.n = b.n;
+    std::swap(full.words, b.words);
+    std::swap(full.hashes, b.hashes);
+    // the next batch of this worker grows to the same size again
+    b.words.reserve(full.words.capacity());
+    b.hashes.reserve(full.hashes.capacity());
+    std::lock_guard<std::mutex> lk(queues_[node]->mu);
+    queues_[node]->batches.push_back(std::move(full));
+}
+
+bool InsertRouter::pop(int node, Batch &b) {
+    auto &q = *queues_[node];
+    std::lock_guard<std::mutex> lk(q.mu);
+    if (q.batches.empty()) return false;
+    b = std::move(q.batches.front());
+    q.batches.pop_front();
+    return true;
+}
+
+uint64_t InsertRouter::insertBatch(Batch &b) {
+    const int words = packedWords(b.n);
+    uint64_t duplicates = 0;
+    for (size_t i = 0; i < b.hashes.size(); ++i) {
+        const uint64_t h = b.hashes[i];
+        duplicates += !b.set->byhash[b.set->shard(h)].insert(&b.words[i * words], b.n, h);
+    }
+    b.pending->fetch_sub(1);
+    return duplicates;
+}
+
+void InsertRouter::flush(int worker) {
+    for (int node = 0; node < nodes(); ++node) push(node, outbox_[worker][node]);
+}
+
+uint64_t InsertRouter::drain(int node) {
+    uint64_t duplicates = 0;
+    for (Batch b; pop(node, b);) duplicates += insertBatch(b);
+    return duplicates;
+}
+
+uint64_t InsertRouter::finish(std::atomic<int> &pending) {
+    uint64_t duplicates = 0;
+    // batches taken by other threads are inserted by them
+    while (pending.load() > 0) {
+        bool any = false;
+        for (int node = 0; node < nodes(); ++node) {
+            Batch b;
+            if (pop(node, b)) {
+                duplicates += insertBatch(b);
+                any = true;
+            }
+        }
+        if (!any) std::this_thread::yield();
+    }
+    return duplicates;
+}
@@ -0,0 +1,389 @@
+#include "pcube.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "canonical.hpp"
+#include "workPool.hpp"
+
+// records are compressed in chunks of this size
+static constexpr size_t CHUNK_SIZE = 1 << 20;
+// the count is always written as 9 LEB128 bytes, so it can be patched in at the end.
+// 9 is the most the Rust reader accepts.
+static constexpr int COUNT_BYTES = 9;
+
+static void writeAll(int fd, const uint8_t *data, size_t len, uint64_t offset, const std::string &path) {
+    while (len) {
+        auto w = pwrite(fd, data, len, offset);
+        if (w <= 0) {
+            std::printf("ERROR writing %s: %s\n\r", path.c_str(), std::strerror(errno));
+            exit(-1);
+        }
+        data += w;
+        len -= w;
+        offset += w;
+    }
+}
+
+void PCube::encode(const XYZ *points, int n, XYZ shape, uint8_t *record) {
+    const int d1 = shape.x() + 1, d2 = shape.y() + 1, d3 = shape.z() + 1;
+    record[0] = d1;
+    record[1] = d2;
+    record[2] = d3;
+    std::memset(record + 3, 0, recordSize(shape) - 3);
+    for (int i = 0; i < n; ++i) {
+        const int bit = (points[i].x() * d2 + points[i].y()) * d3 + points[i].z();
+        record[3 + bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+XYZ PCube::decode(const uint8_t *record, int n, XYZ *points) {
+    const int d1 = record[0], d2 = record[1], d3 = record[2];
+    const uint8_t *bits = record + 3;
+    int found = 0;
+    for (int x = 0, bit = 0; x < d1; ++x)
+        for (int y = 0; y < d2; ++y)
+            for (int z = 0; z < d3; ++z, ++bit) {
+                if (!(bits[bit / 8] & (1 << (bit % 8)))) continue;
+                if (found == n) return XYZ(-1, -1, -1);
+                points[found++] = XYZ(x, y, z);
+            }
+    if (found != n || d1 == 0 || d2 == 0 || d3 == 0) return XYZ(-1, -1, -1);
+    return XYZ(d1 - 1, d2 - 1, d3 - 1);
+}
+
+PCubeWriter::~PCubeWriter() { close(); }
+
+bool PCubeWriter::open(const std::string &path, uint8_t n, const std::vector<XYZ> &shapes, PCube::Compression compression, int level) {
+    close();
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        std::printf("ERROR could not create %s\n\r", path.c_str());
+        return false;
+    }
+    path_ = path;
+    n_ = n;
+    compression_ = compression;
+    level_ = level;
+    numPolycubes_ = rawSize_ = 0;
+    crc_ = crc32(0, Z_NULL, 0);
+    table_.clear();
+    for (auto &s : shapes) {
+        PCube::BlockEntry e;
+        std::memset(&e, 0, sizeof(e));
+        e.dim0 = s.x();
+        e.dim1 = s.y();
+        e.dim2 = s.z();
+        table_.push_back(e);
+    }
+
+    std::vector<uint8_t> header(PCube::MAGIC, PCube::MAGIC + 4);
+    header.push_back(0);  // orientation: ours is not the Rust canonical form
+    header.push_back(compression);
+    countPos_ = header.size();
+    header.resize(header.size() + COUNT_BYTES, 0);
+    indexed_ = false;
+    if (compression == PCube::GZIP) {
+        indexed_ = table_.size() <= PCube::MAX_INDEXED_SHAPES;
+        if (!indexed_) std::printf("%lu shapes do not fit the block index of %s, it will only be readable sequentially\n\r", table_.size(), path.c_str());
+        // gzip member header: deflate, FEXTRA if indexed, no mtime, unknown os
+        const uint8_t gz[10] = {0x1f, 0x8b, 8, (uint8_t)(indexed_ ? 4 : 0), 0, 0, 0, 0, 0, 255};
+        header.insert(header.end(), gz, gz + 10);
+        if (indexed_) {
+            const uint16_t len = sizeof(PCube::IndexHeader) + table_.size() * sizeof(PCube::BlockEntry);
+            const uint16_t xlen = 4 + len;
+            header.push_back(xlen & 0xff);
+            header.push_back(xlen >> 8);
+            header.push_back(PCube::INDEX_ID[0]);
+            header.push_back(PCube::INDEX_ID[1]);
+            header.push_back(len & 0xff);
+            header.push_back(len >> 8);
+            PCube::IndexHeader ih{PCube::INDEX_VERSION, n, (uint32_t)table_.size()};
+            header.insert(header.end(), (uint8_t *)&ih, (uint8_t *)&ih + sizeof(ih));
+            indexPos_ = header.size();
+            header.resize(header.size() + table_.size() * sizeof(PCube::BlockEntry), 0);
+        }
+    }
+    writeAll(fd_, header.data(), header.size(), 0, path_);
+    offset_ = header.size();
+    return true;
+}
+
+PCubeWriter::Block::Block(PCubeWriter &w, XYZ shape) : w(w), shape(shape), recordSize(PCube::recordSize(shape)), crc(crc32(0, Z_NULL, 0)) {
+    raw.reserve(CHUNK_SIZE + recordSize);
+    if (w.compression_ == PCube::GZIP) {
+        auto *zs = new z_stream{};
+        // raw deflate, the gzip framing is written by PCubeWriter
+        if (deflateInit2(zs, w.level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            std::printf("ERROR initialising deflate\n\r");
+            exit(-1);
+        }
+        stream = zs;
+    }
+}
+
+PCubeWriter::Block::~Block() {
+    if (stream) {
+        deflateEnd((z_stream *)stream);
+        delete (z_stream *)stream;
+    }
+}
+
+void PCubeWriter::Block::add(const XYZ *points) {
+    raw.resize(raw.size() + recordSize);
+    PCube::encode(points, w.n_, shape, raw.data() + raw.size() - recordSize);
+    count++;
+    if (raw.size() >= CHUNK_SIZE) compress(false);
+}
+
+void PCubeWriter::Block::compress(bool last) {
+    crc = crc32(crc, raw.data(), raw.size());
+    rawSize += raw.size();
+    if (!stream) {
+        out.insert(out.end(), raw.begin(), raw.end());
+        raw.clear();
+        return;
+    }
+    auto *zs = (z_stream *)stream;
+    zs->next_in = raw.data();
+    zs->avail_in = raw.size();
+    do {
+        const size_t had = out.size();
+        out.resize(had + deflateBound(zs, zs->avail_in) + 64);
+        zs->next_out = out.data() + had;
+        zs->avail_out = out.size() - had;
+        // a full flush byte aligns the end and forgets the history, so the next block starts fresh
+        deflate(zs, last ? Z_FULL_FLUSH : Z_NO_FLUSH);
+        out.resize(out.size() - zs->avail_out);
+    } while (zs->avail_in > 0 || zs->avail_out == 0);
+    raw.clear();
+}
+
+void PCubeWriter::append(Block &block) {
+    if (block.count == 0) return;  // stays an empty entry
+    block.compress(true);
+    std::lock_guard<std::mutex> lk(mu_);
+    PCube::BlockEntry *entry = nullptr;
+    for (auto &e : table_)
+        if (XYZ(e.dim0, e.dim1, e.dim2) == block.shape) entry = &e;
+    if (!entry || entry->offset != 0) {
+        std::printf("ERROR shape [%2d %2d %2d] is not in the shape table of %s or already written\n\r", block.shape.x(), block.shape.y(), block.shape.z(),
+                    path_.c_str());
+        exit(-1);
+    }
+    entry->count = block.count;
+    entry->offset = offset_;
+    entry->size = block.out.size();
+    writeAll(fd_, block.out.data(), block.out.size(), offset_, path_);
+    offset_ += block.out.size();
+    crc_ = crc32_combine(crc_, block.crc, block.rawSize);
+    rawSize_ += block.rawSize;
+    numPolycubes_ += block.count;
+}
+
+void PCubeWriter::close() {
+    if (fd_ < 0) return;
+    if (compression_ == PCube::GZIP) {
+        // empty final block, then the gzip trailer
+        uint8_t tail[8 + 16];
+        z_stream zs{};
+        deflateInit2(&zs, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_out = tail;
+        zs.avail_out = 16;
+        deflate(&zs, Z_FINISH);
+        size_t len = 16 - zs.avail_out;
+        deflateEnd(&zs);
+        const uint32_t isize = rawSize_;
+        for (int i = 0; i < 4; ++i) tail[len++] = crc_ >> (8 * i);
+        for (int i = 0; i < 4; ++i) tail[len++] = isize >> (8 * i);
+        writeAll(fd_, tail, len, offset_, path_);
+        if (indexed_) writeAll(fd_, (const uint8_t *)table_.data(), table_.size() * sizeof(PCube::BlockEntry), indexPos_, path_);
+    }
+    uint8_t count[COUNT_BYTES];
+    uint64_t c = numPolycubes_;
+    for (int i = 0; i < COUNT_BYTES; ++i) {
+        count[i] = (c & 0x7f) | (i + 1 < COUNT_BYTES ? 0x80 : 0);
+        c >>= 7;
+    }
+    writeAll(fd_, count, COUNT_BYTES, countPos_, path_);
+    ::close(fd_);
+    fd_ = -1;
+    std::printf("saved %s\n\r", path_.c_str());
+}
+
+namespace {
+
+struct MappedFile {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    int fd = -1;
+    int error = 0;  // errno of open or mmap, 0 if the file is mapped or empty
+    explicit MappedFile(const std::string &path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = errno;
+            return;
+        }
+        size = lseek(fd, 0, SEEK_END);
+        if (size == 0) return;
+        void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            error = errno;
+            return;
+        }
+        data = (const uint8_t *)p;
+    }
+    ~MappedFile() {
+        if (data) munmap((void *)data, size);
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+// Pulls uncompressed bytes out of a raw deflate, gzip or uncompressed stream.
+struct Inflater {
+    z_stream zs{};
+    bool inflating;
+    const uint8_t *in, *inEnd;
+    Inflater(const uint8_t *data, size_t size, bool compressed, bool gzipFraming) : inflating(compressed), in(data), inEnd(data + size) {
+        if (inflating) {
+            inflateInit2(&zs, gzipFraming ? 15 + 16 : -15);
+            zs.next_in = (Bytef *)data;
+            zs.avail_in = size;
+        }
+    }
+    ~Inflater() {
+        if (inflating) inflateEnd(&zs);
+    }
+    // reads exactly len bytes, false at the end of the stream
+    bool read(uint8_t *out, size_t len) {
+        if (!inflating) {
+            if ((size_t)(inEnd - in) < len) return false;
+            std::memcpy(out, in, len);
+            in += len;
+            return true;
+        }
+        zs.next_out = out;
+        zs.avail_out = len;
+        while (zs.avail_out > 0) {
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END && zs.avail_out > 0) return false;
+            if (ret != Z_OK && ret != Z_STREAM_END) return false;
+        }
+        return true;
+    }
+};
+
+}  // namespace
+
+bool PCube::load(const std::string &path, int n, int threads, FlatCache &out) {
+    MappedFile file(path);
+    // a missing file is no error, the caller generates the cubes instead
+    if (file.error == ENOENT) return false;
+    if (file.error) {
+        std::printf("ERROR could not open %s: %s\n\r", path.c_str(), std::strerror(file.error));
+        return false;
+    }
+    if (file.size < 7 || std::memcmp(file.data, MAGIC, 4) != 0) {
+        std::printf("ERROR %s is not a pcube file\n\r", path.c_str());
+        return false;
+    }
+    const uint8_t *p = file.data + 4;
+    const uint8_t *end = file.data + file.size;
+    const uint8_t compression = p[1];
+    p += 2;
+    uint64_t count = 0;
+    for (int shift = 0; p < end; shift += 7) {
+        count |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) break;
+    }
+    if (compression != NONE && compression != GZIP) {
+        std::printf("ERROR unsupported compression %d in %s\n\r", compression, path.c_str());
+        return false;
+    }
+
+    // look for our block index in the gzip header
+    const uint8_t *index = nullptr;
+    if (compression == GZIP && end - p > 12 && p[0] == 0x1f && p[1] == 0x8b && (p[3] & 4)) {
+        const uint8_t *sub = p + 12;
+        const uint8_t *subEnd = sub + (p[10] | p[11] << 8);
+        while (sub + 4 <= subEnd && subEnd <= end) {
+            const uint16_t len = sub[2] | sub[3] << 8;
+            if (sub[0] == INDEX_ID[0] && sub[1] == INDEX_ID[1] && len >= sizeof(IndexHeader)) {
+                IndexHeader ih;
+                std::memcpy(&ih, sub + 4, sizeof(ih));
+                if (ih.version == INDEX_VERSION && ih.n == (uint32_t)n && len == sizeof(IndexHeader) + ih.numShapes * sizeof(BlockEntry)) index = sub + 4;
+            }
+            sub += 4 + len;
+        }
+    }
+
+    if (index) {
+        IndexHeader ih;
+        std::memcpy(&ih, index, sizeof(ih));
+        std::vector<BlockEntry> blocks(ih.numShapes);
+        std::memcpy(blocks.data(), index + sizeof(ih), blocks.size() * sizeof(BlockEntry));
+        std::vector<XYZ> shapes;
+        std::vector<uint64_t> counts;
+        for (auto &b : blocks) {
+            if (b.offset + b.size > file.size) {
+                std::printf("ERROR block index of %s points behind the end of the file\n\r", path.c_str());
+                return false;
+            }
+            shapes.emplace_back(b.dim0, b.dim1, b.dim2);
+            counts.push_back(b.count);
+        }
+        out = FlatCache(n, shapes, counts);
+        std::atomic<bool> ok = true;
+        WorkPool pool(threads);
+        for (uint32_t i = 0; i < blocks.size(); ++i) {
+            pool.submit(1, [&, i](size_t, size_t, int) {
+                auto &b = blocks[i];
+                Inflater inf(file.data + b.offset, b.size, true, false);
+                std::vector<uint8_t> record(recordSize(shapes[i]));
+                XYZ *put = out.shapeData(i);
+                for (uint64_t j = 0; j < b.count; ++j, put += n) {
+                    if (!inf.read(record.data(), record.size()) || !(decode(record.data(), n, put) == shapes[i])) {
+                        ok = false;
+                        return;
+                    }
+                }
+            });
+        }
+        pool.wait();
+        if (!ok) std::printf("ERROR corrupt block in %s\n\r", path.c_str());
+        return ok;
+    }
+
+    // any other pcube file: canonicalize every cube to find its shape table entry
+    Hashy hashes;
+    hashes.init(n);
+    Inflater inf(p, end - p, compression == GZIP, true);
+    uint8_t dims[3];
+    std::vector<uint8_t> record;
+    std::vector<XYZ> points(n), canonical(n);
+    uint64_t read = 0;
+    while ((count == 0 || read < count) && inf.read(dims, 3)) {
+        record.resize(3 + (dims[0] * dims[1] * dims[2] + 7) / 8);
+        std::memcpy(record.data(), dims, 3);
+        if (!inf.read(record.data() + 3, record.size() - 3)) break;
+        XYZ shape = decode(record.data(), n, points.data());
+        if (shape.x() < 0) {
+            std::printf("ERROR cube %lu in %s does not have %d cubes\n\r", read, path.c_str(), n);
+            return false;
+        }
+        XYZ canonicalShape = Canonical::canonicalize(points.data(), n, shape, canonical.data());
+        hashes.insert(Cube(canonical.data(), canonical.data() + n), canonicalShape);
+        read++;
+    }
+    if (count != 0 && read != count) {
+        std::printf("ERROR %s ended after %lu of %lu cubes\n\r", path.c_str(), read, count);
+        return false;
+    }
+    out = FlatCache(hashes, n, threads);
+    return true;
+}
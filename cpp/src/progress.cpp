@@ -0,0 +1,132 @@
+#include "progress.hpp"
+
+#include <unistd.h>
+
+#include "packedCube.hpp"
+
+static int64_t nowNs() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+void Progress::Pair::advance(uint64_t count) {
+    int64_t zero = 0;
+    startNs.compare_exchange_strong(zero, nowNs(), std::memory_order_relaxed);
+    done.fetch_add(count, std::memory_order_relaxed);
+}
+
+Progress::Progress(int n, int workers, Hashy *hashes) : n_(n), hashes_(hashes), counters_(std::max(workers, 1)) {}
+
+Progress::~Progress() { stop(); }
+
+Progress::Pair *Progress::addPair(XYZ shape, XYZ target, uint64_t size) {
+    std::lock_guard<std::mutex> lk(pairsMu_);
+    queued_ += size;
+    return &pairs_.emplace_back(shape, target, size);
+}
+
+bool Progress::start(const std::string &path, double interval) {
+    out_ = path.empty() ? stderr : std::fopen(path.c_str(), "a");
+    if (!out_) {
+        std::printf("ERROR could not open progress file %s\n\r", path.c_str());
+        return false;
+    }
+    interval_ = std::chrono::duration<double>(interval);
+    begin_ = last_ = std::chrono::steady_clock::now();
+    thread_ = std::thread(&Progress::run, this);
+    return true;
+}
+
+void Progress::stop() {
+    if (!thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    report(true);
+    if (out_ != stderr) std::fclose(out_);
+}
+
+void Progress::run() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (!cv_.wait_for(lk, interval_, [this] { return stop_; })) report(false);
+}
+
+uint64_t Progress::rss() {
+    std::FILE *f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    int read = std::fscanf(f, "%lu %lu", &size, &resident);
+    std::fclose(f);
+    return read == 2 ? resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+Progress::Totals Progress::totals() const {
+    Totals t;
+    t.duplicates = sharedDuplicates_.load(std::memory_order_relaxed);
+    for (auto &c : counters_) {
+        t.parents += c.parents.load(std::memory_order_relaxed);
+        t.candidates += c.candidates.load(std::memory_order_relaxed);
+        t.rotations += c.rotations.load(std::memory_order_relaxed);
+        t.inserts += c.inserts.load(std::memory_order_relaxed);
+        t.duplicates += c.duplicates.load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+void Progress::report(bool final) {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - begin_).count();
+    const double dt = std::max(std::chrono::duration<double>(now - last_).count(), 1e-9);
+    const Totals t = totals();
+    // rates over the last interval
+    const double parentRate = (t.parents - lastTotals_.parents) / dt;
+    const double cubeRate = ((t.inserts - t.duplicates) - (lastTotals_.inserts - lastTotals_.duplicates)) / dt;
+    last_ = now;
+    lastTotals_ = t;
+
+    // frozen shapes are sorted arrays without slots, only the live tables have a load factor
+    uint64_t live = 0, slots = 0, setBytes = 0, frozen = 0, frozenBytes = 0;
+    if (hashes_) {
+        const size_t slotBytes = sizeof(uint32_t) + packedWords(n_) * sizeof(uint64_t);
+        for (auto &[shape, set] : hashes_->byshape) {
+            frozen += set.frozenSize.load(std::memory_order_relaxed);
+            for (auto &subset : set.byhash) {
+                const size_t capacity = subset.set.capacity();
+                live += subset.size();
+                slots += capacity;
+                setBytes += capacity * slotBytes;
+            }
+        }
+        frozenBytes = frozen * n_ * sizeof(XYZ);
+    }
+
+    std::string pairs;
+    uint64_t queued, expanded = 0;
+    {
+        std::lock_guard<std::mutex> lk(pairsMu_);
+        queued = queued_;
+        const int64_t ns = nowNs();
+        for (auto &p : pairs_) {
+            const uint64_t done = p.done.load(std::memory_order_relaxed);
+            expanded += done;
+            const int64_t startNs = p.startNs.load(std::memory_order_relaxed);
+            // only the pairs being expanded right now
+            if (startNs == 0 || done >= p.size) continue;
+            const double seconds = (ns - startNs) / 1e9;
+            const double eta = done ? (p.size - done) * seconds / done : -1;
+            char buf[192];
+            std::snprintf(buf, sizeof(buf), "%s{\"shape\": [%d, %d, %d], \"target\": [%d, %d, %d], \"done\": %lu, \"size\": %lu, \"eta_s\": %.1f}",
+                          pairs.empty() ? "" : ", ", p.shape.x(), p.shape.y(), p.shape.z(), p.target.x(), p.target.y(), p.target.z(), done, p.size, eta);
+            pairs += buf;
+        }
+    }
+    const double eta = parentRate > 0 ? (queued - std::min(expanded, queued)) / parentRate : -1;
+
+    std::fprintf(out_,
+                 "{\"n\": %d, \"time_s\": %.2f, \"final\": %s, \"parents\": %lu, \"candidates\": %lu, \"rotations\": %lu, \"inserts\": %lu, "
+                 "\"duplicates\": %lu, \"parents_per_s\": %.0f, \"cubes_per_s\": %.0f, \"expanded\": %lu, \"queued\": %lu, \"eta_s\": %.1f, "
+                 "\"stored\": %lu, \"load_factor\": %.3f, \"set_bytes\": %lu, \"frozen\": %lu, \"frozen_bytes\": %lu, \"rss_bytes\": %lu, \"pairs\": [%s]}\n",
+                 n_, elapsed, final ? "true" : "false", t.parents, t.candidates, t.rotations, t.inserts, t.duplicates, parentRate, cubeRate, expanded, queued, eta,
+                 live + frozen, slots ? (double)live / slots : 0.0, setBytes, frozen, frozenBytes, rss(), pairs.c_str());
+    std::fflush(out_);
+}
@@ -0,0 +1,177 @@
+#include "resume.hpp"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+
+// snapshot file: header, numPairs PairEntry, then numCubes packed cubes of packedWords(n) words
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x53455250;  // "PRES"
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t n;
+    uint8_t dim0, dim1, dim2, reserved;
+    uint32_t numPairs;
+    uint64_t numCubes;
+};
+struct PairEntry {
+    uint32_t pair;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+static std::string snapshotName(XYZ shape) { return std::to_string(shape.x()) + "-" + std::to_string(shape.y()) + "-" + std::to_string(shape.z()) + ".snap"; }
+
+std::string ResumeWriter::folder(const std::string &basePath, int n) { return basePath + "cubes_" + std::to_string(n) + "_resume/"; }
+
+ResumeWriter::ResumeWriter(const std::string &dir, int n, Hashy &hashes, const std::vector<ShapePair> &pairs, const std::map<uint32_t, uint64_t> &done)
+    : dir_(dir), n_(n), hashes_(hashes) {
+    std::filesystem::create_directories(dir_);
+    for (auto &[pair, count] : done) shapes_[pairs[pair].target].pairs.emplace_back(pair, count);
+    thread_ = std::thread(&ResumeWriter::run, this);
+}
+
+ResumeWriter::~ResumeWriter() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+void ResumeWriter::queue(XYZ target, Shape &s) {
+    if (!s.queued) {
+        s.queued = true;
+        queue_.push_back(target);
+    }
+    cv_.notify_all();
+}
+
+void ResumeWriter::pairDone(XYZ target, uint32_t pair, uint64_t count) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto &s = shapes_[target];
+    s.pairs.emplace_back(pair, count);
+    queue(target, s);
+}
+
+void ResumeWriter::targetDone(XYZ target, std::function<void()> then) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto &s = shapes_[target];
+    s.then = std::move(then);
+    queue(target, s);
+}
+
+void ResumeWriter::flush() {
+    std::unique_lock<std::mutex> lk(mu_);
+    idleCv_.wait(lk, [this] { return queue_.empty() && !busy_; });
+}
+
+void ResumeWriter::remove() {
+    flush();
+    std::filesystem::remove_all(dir_);
+}
+
+void ResumeWriter::run() {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+        cv_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        XYZ shape = queue_.front();
+        queue_.pop_front();
+        auto &s = shapes_[shape];
+        s.queued = false;
+        // pairs finishing from now on go into the next snapshot
+        auto pairs = s.pairs;
+        auto then = std::move(s.then);
+        s.then = nullptr;
+        busy_ = true;
+        lk.unlock();
+        write(shape, pairs);
+        if (then) then();
+        lk.lock();
+        busy_ = false;
+        idleCv_.notify_all();
+    }
+}
+
+void ResumeWriter::write(XYZ shape, const std::vector<std::pair<uint32_t, uint64_t>> &pairs) {
+    const std::string path = dir_ + snapshotName(shape);
+    const std::string tmp = path + ".tmp";
+    std::FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f) {
+        std::printf("ERROR could not create snapshot %s\n\r", tmp.c_str());
+        exit(-1);
+    }
+    SnapshotHeader header;
+    std::memset((void *)&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.n = n_;
+    header.dim0 = shape.x();
+    header.dim1 = shape.y();
+    header.dim2 = shape.z();
+    header.numPairs = pairs.size();
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    for (auto &[pair, count] : pairs) {
+        PairEntry e{pair, 0, count};
+        ok &= std::fwrite(&e, sizeof(e), 1, f) == 1;
+    }
+    // one subset at a time, so the copy stays small
+    const size_t words = packedWords(n_);
+    std::vector<uint64_t> buf;
+    for (auto &subset : hashes_.byshape.at(shape).byhash) {
+        buf.clear();
+        subset.set.snapshot(buf);
+        // an empty buffer may have no data pointer at all, fwrite does not take null
+        if (buf.empty()) continue;
+        ok &= std::fwrite(buf.data(), sizeof(uint64_t), buf.size(), f) == buf.size();
+        header.numCubes += buf.size() / words;
+    }
+    ok &= std::fseek(f, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, f) == 1;
+    ok &= std::fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok &= std::fclose(f) == 0;
+    if (!ok) {
+        std::printf("ERROR writing snapshot %s: %s\n\r", tmp.c_str(), std::strerror(errno));
+        exit(-1);
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+bool ResumeWriter::load(const std::string &dir, int n, Hashy &hashes, std::map<uint32_t, uint64_t> &done) {
+    if (!std::filesystem::is_directory(dir)) return false;
+    const size_t words = packedWords(n);
+    std::vector<uint64_t> buf(words * 4096);
+    bool any = false;
+    for (auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() != ".snap") continue;
+        auto path = entry.path().string();
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> f(std::fopen(path.c_str(), "rb"), &std::fclose);
+        SnapshotHeader header;
+        if (!f || std::fread(&header, sizeof(header), 1, f.get()) != 1 || header.magic != SNAPSHOT_MAGIC || header.n != (uint32_t)n) {
+            std::printf("ERROR %s is not a snapshot for N = %d\n\r", path.c_str(), n);
+            exit(-1);
+        }
+        std::vector<PairEntry> pairs(header.numPairs);
+        if (std::fread(pairs.data(), sizeof(PairEntry), pairs.size(), f.get()) != pairs.size()) {
+            std::printf("ERROR snapshot %s is truncated\n\r", path.c_str());
+            exit(-1);
+        }
+        XYZ shape(header.dim0, header.dim1, header.dim2);
+        auto &set = hashes.byshape[shape];
+        for (uint64_t left = header.numCubes; left > 0;) {
+            size_t count = std::min<uint64_t>(left, buf.size() / words);
+            if (std::fread(buf.data(), words * sizeof(uint64_t), count, f.get()) != count) {
+                std::printf("ERROR snapshot %s is truncated\n\r", path.c_str());
+                exit(-1);
+            }
+            for (size_t i = 0; i < count; ++i) set.insert(buf.data() + i * words, n);
+            left -= count;
+        }
+        for (auto &e : pairs) done[e.pair] = e.count;
+        any = true;
+    }
+    return any;
+}
@@ -0,0 +1,92 @@
+#include "shapeSchedule.hpp"
+
+#include <algorithm>
+#include <map>
+
+ShapeSchedule::ShapeSchedule(const std::vector<ShapePair> &pairs, const std::vector<uint32_t> &todo, const std::vector<uint64_t> &weights, bool freeEarly) {
+    auto weight = [&](uint32_t pi) { return pairs[pi].sid < weights.size() ? weights[pairs[pi].sid] : 1; };
+    // largest first, in pair order on a tie
+    auto largestFirst = [&](std::vector<uint32_t> &ids) {
+        std::stable_sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) { return weight(a) > weight(b); });
+    };
+    for (uint32_t pi : todo) {
+        if (pairs[pi].sid >= users_.size()) users_.resize(pairs[pi].sid + 1);
+        users_[pairs[pi].sid]++;
+    }
+    if (!freeEarly) {
+        order_ = todo;
+        largestFirst(order_);
+        peak_ = peak(pairs, order_, weights);
+        return;
+    }
+
+    // the pairs of every output shape
+    std::map<XYZ, std::vector<uint32_t>> byTarget;
+    for (uint32_t pi : todo) byTarget[pairs[pi].target].push_back(pi);
+    struct Target {
+        std::vector<uint32_t> pairs;
+        uint64_t work = 0;
+    };
+    std::vector<Target> targets;
+    for (auto &[shape, ids] : byTarget) {
+        auto &t = targets.emplace_back();
+        t.pairs = ids;
+        for (uint32_t pi : ids) t.work += weight(pi);
+    }
+    // output shapes left for every input shape
+    std::vector<uint32_t> left(users_.size());
+    for (auto &t : targets)
+        for (uint32_t pi : t.pairs) left[pairs[pi].sid]++;
+    // the output shapes in their own order, kept if the greedy order is no better
+    std::vector<uint32_t> inOrder;
+    for (auto &t : targets) inOrder.insert(inOrder.end(), t.pairs.begin(), t.pairs.end());
+    std::vector<bool> open(users_.size()), done(targets.size());
+    for (size_t step = 0; step < targets.size(); ++step) {
+        size_t best = targets.size();
+        int64_t bestCost = 0;
+        for (size_t i = 0; i < targets.size(); ++i) {
+            if (done[i]) continue;
+            int64_t cost = 0;
+            for (uint32_t pi : targets[i].pairs) {
+                const uint32_t sid = pairs[pi].sid;
+                if (!open[sid]) cost += weight(pi);
+                if (left[sid] == 1) cost -= weight(pi);
+            }
+            if (best == targets.size() || cost < bestCost || (cost == bestCost && targets[i].work > targets[best].work)) {
+                best = i;
+                bestCost = cost;
+            }
+        }
+        done[best] = true;
+        auto &t = targets[best];
+        for (uint32_t pi : t.pairs) {
+            open[pairs[pi].sid] = true;
+            left[pairs[pi].sid]--;
+        }
+        largestFirst(t.pairs);
+        order_.insert(order_.end(), t.pairs.begin(), t.pairs.end());
+    }
+    peak_ = peak(pairs, order_, weights);
+    const uint64_t inOrderPeak = peak(pairs, inOrder, weights);
+    if (inOrderPeak < peak_) {
+        order_ = inOrder;
+        peak_ = inOrderPeak;
+    }
+}
+
+uint64_t ShapeSchedule::peak(const std::vector<ShapePair> &pairs, const std::vector<uint32_t> &order, const std::vector<uint64_t> &weights) {
+    std::map<uint32_t, size_t> last;
+    for (size_t i = 0; i < order.size(); ++i) last[pairs[order[i]].sid] = i;
+    std::vector<bool> open;
+    uint64_t live = 0, peak = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const uint32_t sid = pairs[order[i]].sid;
+        const uint64_t w = sid < weights.size() ? weights[sid] : 1;
+        if (sid >= open.size()) open.resize(sid + 1);
+        if (!open[sid]) live += w;
+        open[sid] = true;
+        peak = std::max(peak, live);
+        if (last[sid] == i) live -= w;
+    }
+    return peak;
+}
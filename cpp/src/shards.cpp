@@ -0,0 +1,245 @@
+#include "shards.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "cacheWriter.hpp"
+#include "cubes.hpp"
+#include "hashes.hpp"
+#include "pcube.hpp"
+#include "workPool.hpp"
+
+std::vector<ShapePair> shapePairs(int n) {
+    std::vector<ShapePair> pairs;
+    auto outShapes = Hashy::generateShapes(n);
+    std::sort(outShapes.begin(), outShapes.end());
+    auto prevShapes = Hashy::generateShapes(n - 1);
+    std::map<XYZ, uint32_t> sids;
+    for (uint32_t sid = 0; sid < prevShapes.size(); ++sid) sids[prevShapes[sid]] = sid;
+    for (auto targetShape : outShapes) {
+        // the input shapes are one smaller in a single dimension or the same, in sid order
+        const XYZ candidates[] = {XYZ(targetShape.x() - 1, targetShape.y(), targetShape.z()), XYZ(targetShape.x(), targetShape.y() - 1, targetShape.z()),
+                                  XYZ(targetShape.x(), targetShape.y(), targetShape.z() - 1), targetShape};
+        for (auto shape : candidates) {
+            auto found = sids.find(shape);
+            if (found == sids.end()) continue;
+            int diffx = targetShape.x() - shape.x();
+            int diffy = targetShape.y() - shape.y();
+            int diffz = targetShape.z() - shape.z();
+            int abssum = diffx + diffy + diffz;
+            // handle symmetry cases
+            if (diffz == 1) {
+                if (shape.z() == shape.y()) diffy = 1;
+            }
+            if (diffy == 1)
+                if (shape.y() == shape.x()) diffx = 1;
+            pairs.push_back({targetShape, found->second, shape, XYZ(diffx, diffy, diffz), abssum != 0});
+        }
+    }
+    return pairs;
+}
+
+ShardPlan::ShardPlan(int n, ICache &base, uint64_t unitSize, bool hashless) : n_(n), unitSize_(std::max<uint64_t>(unitSize, 1)), hashless_(hashless), pairs_(shapePairs(n)) {
+    for (uint32_t i = 0; i < pairs_.size(); ++i) {
+        const uint64_t size = base.getCubesByShape(pairs_[i].sid).size();
+        for (uint64_t begin = 0; begin < size; begin += unitSize_) units_.push_back({i, begin, std::min(begin + unitSize_, size)});
+    }
+}
+
+bool ShardPlan::selectShard(const std::string &spec, std::vector<uint32_t> &ids) const {
+    unsigned i, k;
+    char rest;
+    if (std::sscanf(spec.c_str(), "%u/%u%c", &i, &k, &rest) != 2 || k == 0 || i >= k) {
+        std::printf("ERROR shard \"%s\" is not of the form i/k with i < k\n\r", spec.c_str());
+        return false;
+    }
+    ids.clear();
+    for (uint32_t id = i; id < units_.size(); id += k) ids.push_back(id);
+    return true;
+}
+
+bool ShardPlan::selectList(const std::string &path, std::vector<uint32_t> &ids) const {
+    std::ifstream in(path);
+    if (!in) {
+        std::printf("ERROR could not read unit list %s\n\r", path.c_str());
+        return false;
+    }
+    ids.clear();
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        unsigned a, b;
+        char rest;
+        int got = std::sscanf(line.c_str(), " %u - %u %c", &a, &b, &rest);
+        if (got == 1) b = a;
+        if ((got != 1 && got != 2) || a > b || b >= units_.size()) {
+            std::printf("ERROR %s:%d is not a unit id or range below %lu\n\r", path.c_str(), lineNo, units_.size());
+            return false;
+        }
+        for (uint32_t id = a; id <= b; ++id) ids.push_back(id);
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return true;
+}
+
+std::string ShardPlan::unitFile(const std::string &basePath, uint32_t id) const {
+    return basePath + "cubes_" + std::to_string(n_) + "_unit_" + std::to_string(id) + ".bin";
+}
+
+std::string ShardPlan::checkpointFile(const std::string &basePath, const std::string &shard, const std::string &unitList) const {
+    std::string name = basePath + "cubes_" + std::to_string(n_) + "_";
+    if (!shard.empty()) {
+        std::string spec = shard;
+        std::replace(spec.begin(), spec.end(), '/', '-');
+        return name + "shard_" + spec + ".done";
+    }
+    return name + "list_" + std::filesystem::path(unitList).stem().string() + ".done";
+}
+
+// first line of a checkpoint
+static std::string planLine(const ShardPlan &plan) {
+    char buf[128];
+    std::snprintf(buf, sizeof(buf), "opencubes units n=%d unit_size=%" PRIu64 " units=%zu hashless=%d\n", plan.n(), plan.unitSize(), plan.units().size(), plan.hashless());
+    return buf;
+}
+
+Checkpoint::~Checkpoint() {
+    if (file_) std::fclose(file_);
+}
+
+bool Checkpoint::read(const std::string &path, const ShardPlan &plan, std::map<uint32_t, uint64_t> &finished) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    if (!std::getline(in, line) || line + "\n" != planLine(plan)) return false;
+    // a line cut off by a crash has no newline and is ignored
+    while (std::getline(in, line) && !in.eof()) {
+        unsigned id;
+        uint64_t count;
+        if (std::sscanf(line.c_str(), "%u %" SCNu64, &id, &count) == 2 && id < plan.units().size()) finished[id] = count;
+    }
+    return true;
+}
+
+bool Checkpoint::open(const std::string &path, const ShardPlan &plan) {
+    if (file_) std::fclose(file_);
+    file_ = nullptr;
+    path_ = path;
+    finished_.clear();
+    const bool exists = std::filesystem::exists(path);
+    if (exists && !read(path, plan, finished_)) {
+        std::printf("ERROR checkpoint %s was written for a different plan\n\r", path.c_str());
+        return false;
+    }
+    file_ = std::fopen(path.c_str(), "a");
+    if (!file_) {
+        std::printf("ERROR could not open checkpoint %s\n\r", path.c_str());
+        return false;
+    }
+    if (!exists) {
+        std::fputs(planLine(plan).c_str(), file_);
+        std::fflush(file_);
+    }
+    return true;
+}
+
+void Checkpoint::record(uint32_t id, uint64_t count) {
+    std::fprintf(file_, "%u %" PRIu64 "\n", id, count);
+    if (std::fflush(file_) != 0 || fsync(fileno(file_)) != 0) {
+        std::printf("ERROR writing checkpoint %s: %s\n\r", path_.c_str(), std::strerror(errno));
+        exit(-1);
+    }
+    finished_[id] = count;
+}
+
+uint64_t shardUnitSize(const std::string &basePath, int n) {
+    const std::string prefix = "cubes_" + std::to_string(n) + "_";
+    if (!std::filesystem::is_directory(basePath)) return 0;
+    for (auto &entry : std::filesystem::directory_iterator(basePath)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(prefix, 0) != 0 || entry.path().extension() != ".done") continue;
+        std::ifstream in(entry.path());
+        std::string line;
+        int planN;
+        uint64_t unitSize;
+        if (std::getline(in, line) && std::sscanf(line.c_str(), "opencubes units n=%d unit_size=%" SCNu64, &planN, &unitSize) == 2 && planN == n) return unitSize;
+    }
+    return 0;
+}
+
+bool mergeShards(const ShardPlan &plan, const GenOptions &opts, uint64_t &totalSum) {
+    const int n = plan.n();
+    const auto &units = plan.units();
+    std::map<uint32_t, uint64_t> finished;
+    const std::string prefix = "cubes_" + std::to_string(n) + "_";
+    for (auto &entry : std::filesystem::directory_iterator(opts.base_path)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(prefix, 0) != 0 || entry.path().extension() != ".done") continue;
+        if (!Checkpoint::read(entry.path().string(), plan, finished)) std::printf("skipping %s, it was written for a different plan\n\r", name.c_str());
+    }
+    if (finished.size() != units.size()) {
+        std::printf("ERROR only %lu of %lu work units for N = %d are finished\n\r", finished.size(), units.size(), n);
+        return false;
+    }
+    std::printf("N = %d || merging %lu work units\n\r", n, units.size());
+
+    std::map<XYZ, std::vector<uint32_t>> byTarget;
+    for (uint32_t id = 0; id < units.size(); ++id) byTarget[plan.pairs()[units[id].pair].target].push_back(id);
+    auto outShapes = Hashy::generateShapes(n);
+    std::sort(outShapes.begin(), outShapes.end());
+
+    const bool write_cache = opts.write_cache && !plan.hashless();
+    if (opts.write_cache && plan.hashless()) std::printf("hashless mode only counts, no cache file for N = %d will be written\n\r", n);
+    CacheWriter writer;
+    PCubeWriter pcubeWriter;
+    if (write_cache && opts.pcube)
+        pcubeWriter.open(opts.base_path + "cubes_" + std::to_string(n) + ".pcube", n, outShapes);
+    else if (write_cache)
+        writer.open(opts.base_path + "cubes_" + std::to_string(n) + ".bin", n, outShapes, opts.direct_io);
+
+    WorkPool pool(opts.threads);
+    totalSum = 0;
+    for (auto targetShape : outShapes) {
+        uint64_t targetCount = 0;
+        if (plan.hashless()) {
+            for (auto id : byTarget[targetShape]) targetCount += finished[id];
+        } else {
+            // units of the same output shape overlap, they are deduplicated in one set
+            Hashy merged;
+            auto &set = merged.byshape[targetShape];
+            for (auto id : byTarget[targetShape]) {
+                CacheReader cr;
+                auto file = plan.unitFile(opts.base_path, id);
+                if (cr.loadFile(file) != 0) {
+                    std::printf("ERROR could not load %s\n\r", file.c_str());
+                    return false;
+                }
+                auto range = cr.getCubesByShape(0);
+                pool.submit(range.size(), [&](size_t begin, size_t end, int) {
+                    auto it = range.begin();
+                    it += begin;
+                    for (size_t i = begin; i < end; ++i, ++it) merged.insert(*it, targetShape);
+                });
+                pool.wait();
+            }
+            targetCount = set.size();
+            if (opts.sorted_cache) set.freeze(n, targetShape);
+            if (writer.isOpen()) writer.writeShape(targetShape, set);
+            if (pcubeWriter.isOpen()) pcubeWriter.writeShape(targetShape, set);
+        }
+        std::printf("  shape [%2d %2d %2d] num: %lu\n\r", targetShape.x(), targetShape.y(), targetShape.z(), targetCount);
+        totalSum += targetCount;
+    }
+    if (writer.isOpen()) writer.close();
+    if (pcubeWriter.isOpen()) pcubeWriter.close();
+    std::printf("num total cubes: %lu\n\r", totalSum);
+    return true;
+}
@@ -0,0 +1,221 @@
+#include "sortedRuns.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
+#include <utility>
+
+#include "packedCube.hpp"
+
+template <int W>
+struct Record {
+    uint64_t w[W];
+    bool operator<(const Record &b) const { return SortedRuns::less(w, b.w, W); }
+    bool operator==(const Record &b) const { return std::equal(w, w + W, b.w); }
+};
+
+template <int W>
+static size_t sortUniqueAs(uint64_t *records, size_t count) {
+    auto begin = reinterpret_cast<Record<W> *>(records);
+    std::sort(begin, begin + count);
+    return std::distance(begin, std::unique(begin, begin + count));
+}
+
+using SortFn = size_t (*)(uint64_t *, size_t);
+
+template <size_t... Ws>
+static constexpr std::array<SortFn, sizeof...(Ws)> makeSortTable(std::index_sequence<Ws...>) {
+    return {&sortUniqueAs<Ws + 1>...};
+}
+
+size_t SortedRuns::sortUnique(uint64_t *records, size_t count, int words) {
+    static constexpr auto table = makeSortTable(std::make_index_sequence<MAX_PACKED_WORDS>());
+    return table[words - 1](records, count);
+}
+
+SortedRuns::SortedRuns(int n, XYZ shape, int workers, Budget &budget, const std::string &folder)
+    : n_(n), words_(packedWords(n)), shape_(shape), budget_(budget), folder_(folder), buffers_(std::max(workers, 1)) {
+    // a few runs per worker fit into the budget
+    runBytes_ = RUN_BYTES;
+    if (budget_.limit) runBytes_ = std::clamp<uint64_t>(budget_.limit / (4 * buffers_.size()), 64 << 10, RUN_BYTES);
+}
+
+SortedRuns::~SortedRuns() {
+    uint64_t bytes = 0;
+    for (auto &b : buffers_) bytes += b.size() * sizeof(uint64_t);
+    for (auto &r : runs_) {
+        bytes += r.records.size() * sizeof(uint64_t);
+        if (!r.file.empty()) std::filesystem::remove(r.file);
+    }
+    budget_.used -= bytes;
+}
+
+void SortedRuns::add(int worker, const uint64_t *keys, size_t count) {
+    auto &buffer = buffers_[worker];
+    buffer.insert(buffer.end(), keys, keys + count * words_);
+    const uint64_t used = budget_.used += count * words_ * sizeof(uint64_t);
+    if (buffer.size() * sizeof(uint64_t) < runBytes_) return;
+    std::lock_guard<std::mutex> lk(mu_);
+    seal(buffer);
+    if (budget_.limit && used > budget_.limit) spill();
+}
+
+void SortedRuns::seal(std::vector<uint64_t> &buffer) {
+    if (buffer.empty()) return;
+    const size_t before = buffer.size();
+    const size_t count = sortUnique(buffer.data(), buffer.size() / words_, words_);
+    Run run;
+    run.count = count;
+    run.records.assign(buffer.begin(), buffer.begin() + count * words_);
+    budget_.used -= (before - run.records.size()) * sizeof(uint64_t);
+    runs_.push_back(std::move(run));
+    buffer.clear();
+    buffer.shrink_to_fit();
+}
+
+void SortedRuns::spill() {
+    std::vector<Span> spans;
+    uint64_t bytes = 0;
+    for (auto &r : runs_) {
+        if (!r.file.empty()) continue;
+        spans.push_back({r.records.data(), r.records.data() + r.records.size()});
+        bytes += r.records.size() * sizeof(uint64_t);
+    }
+    if (spans.empty()) return;
+    std::filesystem::create_directories(folder_);
+    Run run;
+    run.file = folder_ + std::to_string(shape_.x()) + "-" + std::to_string(shape_.y()) + "-" + std::to_string(shape_.z()) + "_" + std::to_string(files_++) + ".run";
+    std::FILE *f = std::fopen(run.file.c_str(), "wb");
+    if (!f) {
+        std::printf("ERROR could not create run file %s\n\r", run.file.c_str());
+        exit(-1);
+    }
+    std::vector<char> buf(4 << 20);
+    std::setvbuf(f, buf.data(), _IOFBF, buf.size());
+    const int words = words_;
+    run.count = mergeSpans(spans, words, [f, words](const uint64_t *record) { std::fwrite(record, sizeof(uint64_t), words, f); });
+    if (std::fclose(f) != 0) {
+        std::printf("ERROR could not write run file %s\n\r", run.file.c_str());
+        exit(-1);
+    }
+    budget_.spilled += run.count * words_ * sizeof(uint64_t);
+    runs_.erase(std::remove_if(runs_.begin(), runs_.end(), [](const Run &r) { return r.file.empty(); }), runs_.end());
+    runs_.push_back(std::move(run));
+    budget_.used -= bytes;
+}
+
+uint64_t SortedRuns::mergeSpans(std::vector<Span> spans, int words, const Sink &sink) {
+    spans.erase(std::remove_if(spans.begin(), spans.end(), [](const Span &s) { return s.begin == s.end; }), spans.end());
+    uint64_t count = 0;
+    if (spans.size() == 1) {
+        // runs have no duplicates
+        for (auto p = spans[0].begin; p != spans[0].end; p += words) sink(p);
+        return (spans[0].end - spans[0].begin) / words;
+    }
+    // min heap of the spans by their first record
+    auto greater = [&spans, words](size_t a, size_t b) { return less(spans[b].begin, spans[a].begin, words); };
+    std::vector<size_t> heap;
+    for (size_t i = 0; i < spans.size(); ++i) heap.push_back(i);
+    std::make_heap(heap.begin(), heap.end(), greater);
+    uint64_t last[MAX_PACKED_WORDS];
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        auto &s = spans[heap.back()];
+        if (count == 0 || !std::equal(last, last + words, s.begin)) {
+            std::copy(s.begin, s.begin + words, last);
+            sink(s.begin);
+            count++;
+        }
+        s.begin += words;
+        if (s.begin == s.end)
+            heap.pop_back();
+        else
+            std::push_heap(heap.begin(), heap.end(), greater);
+    }
+    return count;
+}
+
+// first record of [begin, end) that is not less than key
+static const uint64_t *lowerBound(const uint64_t *begin, const uint64_t *end, const uint64_t *key, int words) {
+    size_t lo = 0, hi = (end - begin) / words;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (SortedRuns::less(begin + mid * words, key, words))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return begin + lo * words;
+}
+
+uint64_t SortedRuns::merge(const Sink &sink, int threads) {
+    for (auto &b : buffers_) seal(b);
+    std::vector<Span> spans;
+    std::vector<std::pair<void *, size_t>> maps;
+    uint64_t total = 0;
+    for (auto &r : runs_) {
+        total += r.count;
+        const uint64_t bytes = r.count * words_ * sizeof(uint64_t);
+        if (r.file.empty()) {
+            spans.push_back({r.records.data(), r.records.data() + r.records.size()});
+        } else if (bytes) {
+            int fd = ::open(r.file.c_str(), O_RDONLY);
+            void *p = fd >= 0 ? mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            if (fd >= 0) ::close(fd);
+            if (p == MAP_FAILED) {
+                std::printf("ERROR could not map run file %s\n\r", r.file.c_str());
+                exit(-1);
+            }
+            madvise(p, bytes, MADV_SEQUENTIAL);
+            maps.emplace_back(p, bytes);
+            spans.push_back({(const uint64_t *)p, (const uint64_t *)p + r.count * words_});
+        }
+    }
+
+    uint64_t count = 0;
+    const uint64_t outBytes = total * words_ * sizeof(uint64_t);
+    // the parts are kept in memory until they are written in order
+    const bool parallel = threads > 1 && spans.size() > 1 && total >= PARALLEL_MERGE && (!budget_.limit || budget_.used + outBytes <= budget_.limit);
+    if (parallel) {
+        // split the key space at evenly spaced records of the largest run
+        auto largest = std::max_element(spans.begin(), spans.end(), [](const Span &a, const Span &b) { return a.end - a.begin < b.end - b.begin; });
+        const size_t records = (largest->end - largest->begin) / words_;
+        std::vector<std::vector<uint64_t>> splitters;
+        for (int p = 1; p < threads; ++p) {
+            const uint64_t *key = largest->begin + records * p / threads * words_;
+            splitters.emplace_back(key, key + words_);
+        }
+        std::vector<std::vector<uint64_t>> parts(threads);
+        std::vector<std::thread> workers;
+        budget_.used += outBytes;
+        for (int p = 0; p < threads; ++p) {
+            std::vector<Span> range;
+            for (auto &s : spans) {
+                const uint64_t *b = p == 0 ? s.begin : lowerBound(s.begin, s.end, splitters[p - 1].data(), words_);
+                const uint64_t *e = p == threads - 1 ? s.end : lowerBound(s.begin, s.end, splitters[p].data(), words_);
+                range.push_back({b, e});
+            }
+            workers.emplace_back([range, p, &parts, this]() {
+                auto &out = parts[p];
+                mergeSpans(range, words_, [&out, this](const uint64_t *record) { out.insert(out.end(), record, record + words_); });
+            });
+        }
+        for (auto &w : workers) w.join();
+        for (auto &part : parts) {
+            for (size_t i = 0; i < part.size(); i += words_) sink(&part[i]);
+            count += part.size() / words_;
+        }
+        budget_.used -= outBytes;
+    } else {
+        count = mergeSpans(spans, words_, sink);
+    }
+    for (auto &[p, bytes] : maps) munmap(p, bytes);
+    return count;
+}
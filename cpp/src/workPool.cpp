@@ -0,0 +1,135 @@
+#include "workPool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "numa.hpp"
+
+WorkPool::WorkPool(int threads, const NumaTopology *numa) {
+    threads = std::max(threads, 1);
+    // fewer threads than nodes leave the last nodes without workers
+    const int nodes = numa ? std::min(numa->nodes(), threads) : 1;
+    byNode_.resize(nodes);
+    nextQueue_.resize(nodes);
+    for (int i = 0; i < threads; ++i) {
+        queues_.emplace_back(std::make_unique<Queue>());
+        node_.push_back(nodes > 1 ? (int64_t)i * nodes / threads : 0);
+        byNode_[node_[i]].push_back(i);
+    }
+    workers_.reserve(threads);
+    for (int i = 0; i < threads; ++i) {
+        std::vector<int> cpus;
+        if (nodes > 1) cpus = numa->cpus(node_[i]);
+        workers_.emplace_back([this, i, cpus]() {
+            if (!cpus.empty() && !NumaTopology::pin(cpus)) std::printf("could not pin worker %d to its NUMA node\n\r", i);
+            run(i);
+        });
+    }
+}
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> lk(sleepMu_);
+        stop_ = true;
+    }
+    sleepCv_.notify_all();
+    for (auto &t : workers_) t.join();
+}
+
+void WorkPool::submit(size_t count, Body body, std::function<void()> done) {
+    if (count == 0) {
+        if (done) done();
+        return;
+    }
+    // aim for a few chunks per worker, the halving takes care of the rest
+    size_t grain = std::clamp(count / (8 * workers_.size()), MIN_GRAIN, MAX_GRAIN);
+    jobs_.emplace_back(std::move(body), std::move(done), grain, count);
+    outstanding_ += count;
+    // one slice per node, unless that makes them smaller than a chunk
+    const size_t nodes = byNode_.size();
+    const size_t slices = count >= nodes * grain ? nodes : 1;
+    for (size_t s = 0; s < slices; ++s) {
+        // spread new jobs over the workers, so a list of small jobs starts everywhere at once
+        const size_t node = slices == 1 ? nextNode_ : s;
+        auto &workers = byNode_[node];
+        push(workers[nextQueue_[node]], {&jobs_.back(), count * s / slices, count * (s + 1) / slices});
+        nextQueue_[node] = (nextQueue_[node] + 1) % workers.size();
+    }
+    if (slices == 1) nextNode_ = (nextNode_ + 1) % nodes;
+}
+
+void WorkPool::wait() {
+    std::unique_lock<std::mutex> lk(doneMu_);
+    doneCv_.wait(lk, [this] { return outstanding_ == 0; });
+    jobs_.clear();
+}
+
+void WorkPool::push(int worker, Task t) {
+    {
+        std::lock_guard<std::mutex> lk(queues_[worker]->mu);
+        queues_[worker]->tasks.push_back(t);
+    }
+    queued_++;
+    if (idle_ > 0) {
+        // taking the lock orders this with a worker about to sleep
+        { std::lock_guard<std::mutex> lk(sleepMu_); }
+        sleepCv_.notify_one();
+    }
+}
+
+bool WorkPool::pop(int worker, Task &t) {
+    auto &q = *queues_[worker];
+    std::lock_guard<std::mutex> lk(q.mu);
+    if (q.tasks.empty()) return false;
+    t = q.tasks.back();
+    q.tasks.pop_back();
+    queued_--;
+    return true;
+}
+
+bool WorkPool::steal(int worker, Task &t) {
+    const int n = queues_.size();
+    // the own node first, then all others
+    for (int local = byNode_.size() > 1; local >= 0; --local) {
+        for (int i = 1; i < n; ++i) {
+            const int victim = (worker + i) % n;
+            if (local && node_[victim] != node_[worker]) continue;
+            auto &q = *queues_[victim];
+            std::lock_guard<std::mutex> lk(q.mu);
+            if (q.tasks.empty()) continue;
+            t = q.tasks.front();
+            q.tasks.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::run(int worker) {
+    Task t;
+    while (true) {
+        if (!pop(worker, t) && !steal(worker, t)) {
+            std::unique_lock<std::mutex> lk(sleepMu_);
+            idle_++;
+            sleepCv_.wait(lk, [this] { return queued_ > 0 || stop_; });
+            idle_--;
+            if (stop_) return;
+            continue;
+        }
+        // split off the upper half for whoever runs out of work first
+        while (t.end - t.begin > t.job->grain) {
+            size_t mid = t.begin + (t.end - t.begin) / 2;
+            push(worker, {t.job, mid, t.end});
+            t.end = mid;
+        }
+        t.job->body(t.begin, t.end, worker);
+        const size_t done = t.end - t.begin;
+        // finish the job before wait() can return
+        if (t.job->remaining.fetch_sub(done) == done && t.job->done) t.job->done();
+        if (outstanding_.fetch_sub(done) == done) {
+            std::lock_guard<std::mutex> lk(doneMu_);
+            doneCv_.notify_all();
+        }
+    }
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <cstring>
+
 #include "cache.hpp"
 
 TEST(CacheTests, TestCacheLoadDoesNotThrow) { EXPECT_NO_THROW(Cache::load("./test_data.bin")); }
@@ -7,4 +10,21 @@ TEST(CacheTests, TestCacheLoadDoesNotThrow) { EXPECT_NO_THROW(Cache::load("./tes
 TEST(CacheTests, TestCacheSaveDoesNotThrow) {
     auto data = Cache::load("./test_data.bin");
     EXPECT_NO_THROW(Cache::save("./temp.bin", data, 255));
-}
\ No newline at end of file
+}
+// a loaded cache is frozen, it is saved with its own N and reads back the same
+TEST(CacheTests, TestSaveLoadedCacheReloads) {
+    auto data = Cache::load("./test_data.bin");
+    ASSERT_GT(data.size(), 0);
+    Cache::save("./temp_resaved.bin", data, 255);
+    auto again = Cache::load("./temp_resaved.bin");
+    EXPECT_EQ(again.size(), data.size());
+    for (auto &[shape, set] : data.byshape) {
+        auto &other = again.byshape[shape];
+        ASSERT_EQ(other.size(), set.size());
+        if (!set.frozen) continue;
+        ASSERT_TRUE(other.frozen);
+        EXPECT_EQ(other.frozen->n(), set.frozen->n());
+        EXPECT_EQ(std::memcmp(other.frozen->data(), set.frozen->data(), set.size() * set.frozen->n() * sizeof(XYZ)), 0);
+    }
+    std::remove("./temp_resaved.bin");
+}
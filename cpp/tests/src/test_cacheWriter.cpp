@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include "cache.hpp"
+#include "cacheWriter.hpp"
+#include "canonical.hpp"
+#include "newCache.hpp"
+
+// all 3-cubes in an L, shape [0 1 1], and the two straight ones with shape [0 0 2]
+static Hashy testHashes() {
+    Hashy hashes;
+    hashes.init(3);
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 0)}, XYZ(0, 1, 1));
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 1)}, XYZ(0, 1, 1));
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)}, XYZ(0, 0, 2));
+    return hashes;
+}
+
+static void writeAndCheck(const std::string &path, bool direct) {
+    auto hashes = testHashes();
+    std::vector<XYZ> shapes;
+    for (auto &[shape, set] : hashes.byshape) shapes.push_back(shape);
+    {
+        CacheWriter writer;
+        ASSERT_TRUE(writer.open(path, 3, shapes, direct));
+        // shapes go out in any order
+        writer.writeShape(XYZ(0, 1, 1), hashes.byshape[XYZ(0, 1, 1)]);
+        writer.writeShape(XYZ(0, 0, 2), hashes.byshape[XYZ(0, 0, 2)]);
+    }
+
+    CacheReader cr;
+    ASSERT_EQ(cr.loadFile(path), 0);
+    ASSERT_EQ(cr.numShapes(), shapes.size());
+    EXPECT_EQ(cr.size(), 3);
+    for (uint32_t i = 0; i < shapes.size(); ++i) {
+        auto range = cr.getCubesByShape(i);
+        EXPECT_EQ(range.shape(), shapes[i]);
+        EXPECT_EQ(range.size(), hashes.byshape[shapes[i]].size());
+        for (auto it = range.begin(); it != range.end(); ++it) {
+            Cube c = *it;
+            EXPECT_TRUE(std::is_sorted(c.begin(), c.end()));
+        }
+    }
+
+    auto loaded = Cache::load(path);
+    EXPECT_EQ(loaded.size(), 3);
+    EXPECT_EQ(loaded.byshape[XYZ(0, 1, 1)].size(), 2);
+    EXPECT_EQ(loaded.byshape[XYZ(0, 0, 2)].size(), 1);
+}
+
+TEST(CacheWriterTests, TestStreamedFileReadsBack) { writeAndCheck("./temp_writer.bin", false); }
+
+TEST(CacheWriterTests, TestDirectFileReadsBack) { writeAndCheck("./temp_writer_direct.bin", true); }
+
+TEST(CacheWriterTests, TestLoadVerifies) {
+    const std::vector<XYZ> shapes = {XYZ(0, 0, 2), XYZ(0, 1, 1)};
+    const XYZ line[] = {XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)};
+    // the same line in another orientation, not canonical
+    const XYZ turned[] = {XYZ(0, 0, 0), XYZ(0, 1, 0), XYZ(0, 2, 0)};
+    const XYZ bent[] = {XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 0)};
+    XYZ corner[3];
+    Canonical::canonicalize(bent, 3, XYZ(0, 1, 1), corner);
+    auto write = [](auto add, const XYZ *points) {
+        uint64_t words[MAX_PACKED_WORDS];
+        packXYZs(points, 3, words);
+        add(words);
+    };
+    {
+        CacheWriter writer;
+        ASSERT_TRUE(writer.open("./temp_verify.bin", 3, shapes));
+        writer.writeShapeWith(XYZ(0, 0, 2), [&](auto add) {
+            write(add, turned);
+            write(add, line);
+            write(add, line);
+        });
+        writer.writeShapeWith(XYZ(0, 1, 1), [&](auto add) { write(add, corner); });
+    }
+
+    auto trusted = Cache::load("./temp_verify.bin", Cache::ALL_SHAPES, 2);
+    EXPECT_EQ(trusted.size(), 4);
+    auto &frozen = *trusted.byshape[XYZ(0, 0, 2)].frozen;
+    for (uint64_t i = 1; i < frozen.size(); ++i) EXPECT_LE(FrozenShape::compare(frozen.cube(i - 1), frozen.cube(i), 3), 0);
+
+    auto verified = Cache::load("./temp_verify.bin", Cache::ALL_SHAPES, 2, true);
+    EXPECT_EQ(verified.size(), 2);
+    ASSERT_EQ(verified.byshape[XYZ(0, 0, 2)].size(), 1);
+    EXPECT_TRUE(verified.byshape[XYZ(0, 0, 2)].frozen->contains(line));
+    EXPECT_TRUE(verified.byshape[XYZ(0, 1, 1)].frozen->contains(corner));
+    std::remove("./temp_verify.bin");
+}
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "candidateGrid.hpp"
+
+// free neighbours of c as the sorted neighbour list finds them
+static std::vector<XYZ> reference(const Cube &c, XYZ shape, XYZ expandDim, bool notSameShape) {
+    std::vector<XYZ> out;
+    for (const auto &p : c)
+        for (int d = 0; d < 3; ++d)
+            for (int step : {-1, 1}) {
+                XYZ q = p;
+                q[d] += step;
+                bool inBox = true;
+                for (int e = 0; e < 3; ++e) inBox &= q[e] >= 0 && q[e] <= shape[e];
+                if (notSameShape ? !inBox && expandDim[d] == 1 : inBox) out.push_back(q);
+            }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    std::vector<XYZ> free;
+    std::set_difference(out.begin(), out.end(), c.begin(), c.end(), std::back_inserter(free));
+    return free;
+}
+
+// random polycube of n cubes, moved to the origin and sorted
+static Cube randomCube(std::mt19937 &rng, int n) {
+    std::vector<XYZ> pts{XYZ(0, 0, 0)};
+    while ((int)pts.size() < n) {
+        XYZ p = pts[rng() % pts.size()];
+        p[rng() % 3] += (rng() & 1) ? 1 : -1;
+        if (std::find(pts.begin(), pts.end(), p) == pts.end()) pts.push_back(p);
+    }
+    XYZ low(0, 0, 0);
+    for (auto &p : pts)
+        for (int d = 0; d < 3; ++d) low[d] = std::min(low[d], p[d]);
+    Cube c(n);
+    for (int i = 0; i < n; ++i) c.data()[i] = XYZ(pts[i].x() - low.x(), pts[i].y() - low.y(), pts[i].z() - low.z());
+    std::sort(c.begin(), c.end());
+    return c;
+}
+
+TEST(CandidateGridTests, TestMatchesNeighbourList) {
+    std::mt19937 rng(7);
+    std::vector<XYZ> got;
+    int checked64 = 0, checked128 = 0;
+    for (int iter = 0; iter < 2000; ++iter) {
+        const int n = 2 + rng() % 11;
+        Cube c = randomCube(rng, n);
+        XYZ shape(0, 0, 0);
+        for (const auto &p : c)
+            for (int d = 0; d < 3; ++d) shape[d] = std::max(shape[d], p[d]);
+        for (int d = -1; d < 3; ++d) {
+            XYZ expandDim(0, 0, 0);
+            if (d >= 0) expandDim[d] = 1;
+            CandidateGrid grid(shape, expandDim, d >= 0);
+            if (!grid.fits()) continue;
+            const int cells = (shape.x() + 3) * (shape.y() + 3) * (shape.z() + 3);
+            (cells <= 64 ? checked64 : checked128)++;
+            grid.candidates(c, got);
+            std::sort(got.begin(), got.end());
+            EXPECT_EQ(got, reference(c, shape, expandDim, d >= 0));
+        }
+    }
+    EXPECT_GT(checked64, 0);
+    EXPECT_GT(checked128, 0);
+}
+
+TEST(CandidateGridTests, TestLargeShapesDoNotFit) {
+    EXPECT_TRUE(CandidateGrid(XYZ(1, 2, 3), XYZ(0, 0, 0), false).fits());
+    EXPECT_FALSE(CandidateGrid(XYZ(2, 2, 3), XYZ(0, 0, 0), false).fits());
+}
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+#include "canonical.hpp"
+#include "cubes.hpp"
+
+// random polycube with n cubes translated to the origin, shape is set to its largest coordinates
+static Cube randomPolycube(std::mt19937 &rng, int n, XYZ &shape) {
+    std::vector<XYZ> points = {XYZ(n, n, n)};
+    while ((int)points.size() < n) {
+        XYZ p = points[rng() % points.size()];
+        int axis = rng() % 3;
+        p[axis] += rng() % 2 ? 1 : -1;
+        if (std::find(points.begin(), points.end(), p) == points.end()) points.push_back(p);
+    }
+    XYZ lo = points[0], hi = points[0];
+    for (auto &p : points)
+        for (int i = 0; i < 3; ++i) {
+            lo[i] = std::min(lo[i], p[i]);
+            hi[i] = std::max(hi[i], p[i]);
+        }
+    for (auto &p : points) p = XYZ(p.x() - lo.x(), p.y() - lo.y(), p.z() - lo.z());
+    shape = XYZ(hi.x() - lo.x(), hi.y() - lo.y(), hi.z() - lo.z());
+    return Cube(points.data(), points.data() + points.size());
+}
+
+// the greatest sorted rotation, as computed before the canonicalisation engines
+static XYZ referenceCanonical(XYZ shape, const Cube &c, Cube &out) {
+    Cube rotated(c.size());
+    XYZ outShape;
+    bool none_set = true;
+    for (int i = 0; i < 24; ++i) {
+        auto [res, ok] = Rotations::rotate(i, shape, c, rotated);
+        if (!ok) continue;
+        std::sort(rotated.begin(), rotated.end());
+        if (none_set || out < rotated) {
+            none_set = false;
+            out = rotated;
+            outShape = res;
+        }
+    }
+    return outShape;
+}
+
+TEST(CanonicalTests, TestEnginesMatchReference) {
+    std::mt19937 rng(1234);
+    for (int n = 1; n <= 40; ++n) {
+        for (int iter = 0; iter < 50; ++iter) {
+            XYZ shape;
+            Cube c = randomPolycube(rng, n, shape);
+            Cube expected = c;
+            XYZ expectedShape = referenceCanonical(shape, c, expected);
+            for (auto &engine : Canonical::engines()) {
+                if (!engine.supported()) continue;
+                Cube got = c;
+                XYZ gotShape = engine.canonicalize(c.data(), n, shape, got.data());
+                EXPECT_EQ(gotShape, expectedShape) << engine.name << " n=" << n;
+                EXPECT_EQ(got, expected) << engine.name << " n=" << n;
+            }
+        }
+    }
+}
+
+TEST(CanonicalTests, TestSelect) {
+    EXPECT_TRUE(Canonical::select("scalar"));
+    EXPECT_STREQ(Canonical::selected().name, "scalar");
+    EXPECT_FALSE(Canonical::select("no-such-engine"));
+    EXPECT_TRUE(Canonical::select("auto"));
+    EXPECT_STREQ(Canonical::selected().name, Canonical::best().name);
+}
+
+// points have to span a sorted shape
+static Canonical::Symmetry symmetryOf(std::vector<XYZ> points) {
+    XYZ shape(0, 0, 0);
+    for (auto &p : points)
+        for (int d = 0; d < 3; ++d) shape[d] = std::max(shape[d], p[d]);
+    std::vector<XYZ> canonical(points.size());
+    shape = Canonical::scalar(points.data(), points.size(), shape, canonical.data());
+    return Canonical::symmetry(canonical.data(), canonical.size(), shape);
+}
+
+TEST(CanonicalTests, TestSymmetry) {
+    auto line = symmetryOf({XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)});
+    EXPECT_EQ(line.order, 8);
+    EXPECT_FALSE(line.chiral);
+
+    auto cube = symmetryOf({XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 0), XYZ(0, 1, 1), XYZ(1, 0, 0), XYZ(1, 0, 1), XYZ(1, 1, 0), XYZ(1, 1, 1)});
+    EXPECT_EQ(cube.order, 24);
+    EXPECT_FALSE(cube.chiral);
+
+    // the L tromino only has the half turn swapping its arms
+    auto l = symmetryOf({XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 0)});
+    EXPECT_EQ(l.order, 2);
+    EXPECT_FALSE(l.chiral);
+
+    // one of the two screw tetracubes, a mirror pair
+    auto screw = symmetryOf({XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 1), XYZ(1, 1, 1)});
+    EXPECT_TRUE(screw.chiral);
+}
+
+TEST(CanonicalTests, TestRotationClasses) {
+    for (int x = 0; x < 4; ++x)
+        for (int y = 0; y < 4; ++y)
+            for (int z = 0; z < 4; ++z) {
+                XYZ shape(x, y, z);
+                uint32_t expected = 0;
+                for (int r = 0; r < 24; ++r) {
+                    auto s = Canonical::rotatedShape(r, shape);
+                    if (s.x() <= s.y() && s.y() <= s.z()) expected |= 1u << r;
+                }
+                const int cls = Canonical::rotationClass(shape);
+                EXPECT_EQ(Canonical::validRotations(shape), expected) << x << " " << y << " " << z;
+                EXPECT_EQ(Canonical::ROTATION_CLASSES.count[cls], __builtin_popcount(expected));
+                const int distinct = (x != y) + (y != z) + (x != z);
+                EXPECT_EQ(__builtin_popcount(expected), distinct == 3 ? 4 : distinct == 2 ? 8 : 24);
+            }
+}
+
+// the stabiliser has the rotations mapping a polycube onto itself, found by rotating it
+TEST(CanonicalTests, TestStabiliser) {
+    GenOptions opts;
+    opts.base_path = "./";
+    auto fc = gen(6, opts);
+    for (uint32_t sid = 0; sid < fc.numShapes(); ++sid) {
+        auto range = fc.getCubesByShape(sid);
+        for (uint64_t i = 0; i < range.size(); ++i) {
+            Cube c(range.data() + i * 6, range.data() + (i + 1) * 6), rotated(6);
+            uint32_t expected = 0;
+            for (int r = 0; r < 24; ++r) {
+                if (!Rotations::rotate(r, range.shape(), c, rotated).second) continue;
+                std::sort(rotated.begin(), rotated.end());
+                if (rotated == c) expected |= 1u << r;
+            }
+            EXPECT_EQ(Canonical::stabiliser(c.data(), 6, range.shape()), expected);
+        }
+    }
+}
+
+// expanding one candidate per orbit of the parent's symmetries finds every polycube, with fewer inserts
+TEST(CanonicalTests, TestSymmetryPruning) {
+    GenOptions opts;
+    opts.base_path = "./";
+    auto base = gen(7, opts);
+    uint64_t inserts = 0, pruned = 0;
+    for (bool symmetry : {false, true}) {
+        Hashy hashes;
+        hashes.init(8);
+        EXPECT_EQ(expandAll(8, base, hashes, false, 2, symmetry, symmetry ? &pruned : &inserts), 6922);
+        Hashy counted;
+        counted.init(8, 0);
+        EXPECT_EQ(expandAll(8, base, counted, true, 2, symmetry), 6922);
+    }
+    EXPECT_LT(pruned, inserts);
+    opts.symmetry = true;
+    EXPECT_EQ(gen(8, opts).size(), 6922);
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "cubeQuery.hpp"
+#include "cubes.hpp"
+
+// cubes_7.bin in folder, with sorted shape blocks if sorted
+static std::string writeCache(const std::string &folder, bool sorted) {
+    std::filesystem::remove_all(folder);
+    GenOptions opts;
+    opts.base_path = folder;
+    opts.write_cache = true;
+    opts.sorted_cache = sorted;
+    opts.threads = 2;
+    gen(7, opts);
+    return folder + "cubes_7.bin";
+}
+
+// cube turned about z, mirrored in y and moved away from the origin
+static std::vector<XYZ> moved(const XYZ *cube, int n) {
+    std::vector<XYZ> out;
+    for (int i = 0; i < n; ++i) out.emplace_back(cube[i].y() + 3, -cube[i].x() - 2, cube[i].z() + 5);
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+static void findAll(bool sorted) {
+    const std::string folder = sorted ? "./temp_query_sorted/" : "./temp_query/";
+    CacheReader cr;
+    ASSERT_EQ(cr.loadFile(writeCache(folder, sorted)), 0);
+    CubeQuery query(cr);
+    ASSERT_EQ(query.n(), 7);
+    std::vector<XYZ> all;
+    std::vector<CubeQuery::Result> expected;
+    for (uint32_t sid = 0; sid < cr.numShapes(); ++sid) {
+        EXPECT_EQ(cr.isSorted(sid), sorted);
+        auto range = cr.getCubesByShape(sid);
+        for (uint64_t i = 0; i < range.size(); ++i) {
+            const XYZ *cube = range.data() + i * 7;
+            auto r = query.findCanonical(cube, range.shape());
+            EXPECT_TRUE(r.found);
+            EXPECT_EQ(r.sid, sid);
+            EXPECT_EQ(r.index, i);
+            auto m = moved(cube, 7);
+            XYZ canonical[7];
+            r = query.find(m.data(), canonical);
+            EXPECT_TRUE(r.found);
+            EXPECT_EQ(r.sid, sid);
+            EXPECT_EQ(r.index, i);
+            EXPECT_EQ(FrozenShape::compare(canonical, cube, 7), 0);
+            all.insert(all.end(), m.begin(), m.end());
+            expected.push_back(r);
+        }
+    }
+    EXPECT_EQ(expected.size(), 1023);
+
+    // not connected, so not a polycube
+    XYZ apart[7] = {XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2), XYZ(0, 0, 3), XYZ(0, 0, 4), XYZ(0, 0, 5), XYZ(2, 2, 5)};
+    EXPECT_FALSE(query.find(apart).found);
+    all.insert(all.end(), apart, apart + 7);
+
+    auto results = query.findMany(all.data(), expected.size() + 1, 4);
+    ASSERT_EQ(results.size(), expected.size() + 1);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_TRUE(results[i].found);
+        EXPECT_EQ(results[i].sid, expected[i].sid);
+        EXPECT_EQ(results[i].index, expected[i].index);
+    }
+    EXPECT_FALSE(results.back().found);
+    cr.unload();
+    std::filesystem::remove_all(folder);
+}
+
+TEST(CubeQueryTests, TestFindInSortedCache) { findAll(true); }
+
+TEST(CubeQueryTests, TestFindInUnsortedCache) { findAll(false); }
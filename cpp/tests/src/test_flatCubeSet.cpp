@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "hashes.hpp"
+
+static PackedCube<3> lineCube(int8_t offset) {
+    XYZ points[] = {XYZ(0, 0, offset), XYZ(0, 1, offset), XYZ(1, 1, offset)};
+    return PackedCube<3>(points);
+}
+
+TEST(FlatCubeSetTests, TestInsertDeduplicates) {
+    CubeSet set;
+    for (int8_t i = 0; i < 3; ++i) {
+        auto c = lineCube(i);
+        EXPECT_TRUE(set.insert(c.words, 3, c.hash()));
+    }
+    for (int8_t i = 0; i < 3; ++i) {
+        auto c = lineCube(i);
+        EXPECT_FALSE(set.insert(c.words, 3, c.hash()));
+        EXPECT_TRUE(set.contains(c.words, 3, c.hash()));
+    }
+    XYZ points[] = {XYZ(0, 0, 0), XYZ(1, 0, 0), XYZ(2, 0, 0)};
+    PackedCube<3> other(points);
+    EXPECT_FALSE(set.contains(other.words, 3, other.hash()));
+    EXPECT_EQ(set.size(), 3);
+}
+
+TEST(FlatCubeSetTests, TestIterationMatchesInserted) {
+    CubeSet set;
+    for (int8_t i = 0; i < 3; ++i) {
+        auto c = lineCube(i);
+        set.insert(c.words, 3, c.hash());
+    }
+    std::vector<bool> seen(3, false);
+    for (const auto &e : set) {
+        ASSERT_EQ(e.size(), 3);
+        auto c = e.toCube();
+        seen[c.data()[0].z()] = true;
+        EXPECT_EQ(c, lineCube(c.data()[0].z()).toCube());
+    }
+    for (auto s : seen) EXPECT_TRUE(s);
+
+    set.clear();
+    EXPECT_EQ(set.size(), 0);
+    EXPECT_TRUE(set.begin() == set.end());
+}
+
+TEST(FlatCubeSetTests, TestConcurrentInsert) {
+    Hashy hashes;
+    std::vector<std::thread> ts;
+    for (int t = 0; t < 4; ++t) {
+        ts.emplace_back([&hashes]() {
+            // a line of 39 cubes with one cube attached at the side
+            Cube c(40);
+            for (int8_t z = 0; z < 39; ++z) c.data()[z] = XYZ(0, 0, z);
+            for (int8_t side = 0; side < 2; ++side)
+                for (int8_t z = 0; z < 39; ++z) {
+                    c.data()[39] = XYZ(1 - side, side, z);
+                    Cube sorted = c;
+                    std::sort(sorted.begin(), sorted.end());
+                    hashes.insert(sorted, XYZ(0, 1, 38));
+                }
+        });
+    }
+    for (auto &t : ts) t.join();
+    EXPECT_EQ(hashes.size(), 2 * 39);
+}
+
+TEST(FlatCubeSetTests, TestShardCount) {
+    EXPECT_EQ(Hashy::shardBits(1, 1 << 20), 2);
+    EXPECT_EQ(Hashy::shardBits(16, 1 << 30), 6);
+    EXPECT_EQ(Hashy::shardBits(1024, uint64_t(1) << 40), Hashy::Subhashy::MAX_BITS);
+    // small sets are not split below MIN_SHARD_SIZE
+    EXPECT_EQ(Hashy::shardBits(64, 3 * Hashy::MIN_SHARD_SIZE), 1);
+    EXPECT_EQ(Hashy::shardBits(64, 100), 0);
+
+    for (int bits : {0, 3}) {
+        Hashy hashes;
+        hashes.init(5, bits);
+        auto &set = hashes.byshape.at(XYZ(0, 0, 4));
+        EXPECT_EQ(set.byhash.size(), 1u << bits);
+        Cube line{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2), XYZ(0, 0, 3), XYZ(0, 0, 4)};
+        EXPECT_TRUE(hashes.insert(line, XYZ(0, 0, 4)));
+        EXPECT_FALSE(hashes.insert(line, XYZ(0, 0, 4)));
+        EXPECT_EQ(hashes.size(), 1);
+    }
+}
+
+TEST(FlatCubeSetTests, TestInsertManyGroupsByShard) {
+    // enough cubes to grow the tables on the way, every one twice in the batch
+    std::vector<PackedCube<8>> batch;
+    for (int round = 0; round < 2; ++round)
+        for (int8_t last = 6; last <= 7; ++last)
+            for (int8_t x = 0; x < 7; ++x)
+                for (int8_t y = 0; y < 7; ++y) {
+                    XYZ points[] = {XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2), XYZ(0, 0, 3), XYZ(0, 0, 4), XYZ(0, 0, 5), XYZ(x, y, 6), XYZ(7, 7, last)};
+                    batch.emplace_back(points);
+                }
+    Hashy::Subhashy many(1), single(1);
+    EXPECT_EQ(many.insertMany(batch[0].words, batch.size(), 8), 98);
+    for (auto &c : batch) single.insert(c.words, 8);
+    EXPECT_EQ(many.size(), 98);
+    for (size_t s = 0; s < many.byhash.size(); ++s) EXPECT_EQ(many.byhash[s].size(), single.byhash[s].size());
+    // all of them are there already
+    EXPECT_EQ(many.insertMany(batch[0].words, 98, 8), 0);
+}
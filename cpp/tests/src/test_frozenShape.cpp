@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "cacheWriter.hpp"
+#include "cubes.hpp"
+#include "newCache.hpp"
+
+// all polycubes of N = 6 with shape [1 1 2], generated from N = 5
+static Hashy shapeOf6(XYZ shape) {
+    GenOptions opts;
+    opts.base_path = "./";
+    auto fc = gen(6, opts);
+    Hashy hashes;
+    hashes.init(6, 2);
+    for (uint32_t i = 0; i < fc.numShapes(); ++i) {
+        auto range = fc.getCubesByShape(i);
+        if (range.shape() != shape) continue;
+        for (auto it = range.begin(); it != range.end(); ++it) hashes.insert(*it, shape);
+    }
+    return hashes;
+}
+
+TEST(FrozenShapeTests, TestFreezeSortsAndFinds) {
+    const XYZ shape(1, 1, 2);
+    auto hashes = shapeOf6(shape);
+    auto &set = hashes.byshape[shape];
+    const auto count = set.size();
+    ASSERT_GT(count, 0);
+    // keep the packed cubes to look them up afterwards
+    std::vector<uint64_t> keys;
+    for (auto &subset : set.byhash) subset.set.snapshot(keys);
+
+    set.freeze(6, shape);
+    ASSERT_TRUE(set.frozen);
+    EXPECT_EQ(set.size(), count);
+    EXPECT_EQ(hashes.size(), count);
+    for (auto &subset : set.byhash) EXPECT_EQ(subset.set.capacity(), 0);
+    auto &frozen = *set.frozen;
+    for (uint64_t i = 1; i < frozen.size(); ++i) EXPECT_LT(FrozenShape::compare(frozen.cube(i - 1), frozen.cube(i), 6), 0);
+
+    const size_t words = packedWords(6);
+    for (size_t k = 0; k < keys.size(); k += words) {
+        EXPECT_TRUE(set.contains(&keys[k], 6));
+        XYZ points[6];
+        unpackXYZs(&keys[k], 6, points);
+        const auto i = frozen.find(points);
+        ASSERT_GE(i, 0);
+        EXPECT_EQ(FrozenShape::compare(frozen.cube(i), points, 6), 0);
+    }
+    XYZ missing[6] = {XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2), XYZ(1, 1, 0), XYZ(1, 1, 1), XYZ(1, 1, 2)};
+    EXPECT_FALSE(frozen.contains(missing));
+}
+
+TEST(FrozenShapeTests, TestFrozenShapesAreNotCopied) {
+    const XYZ shape(1, 1, 2);
+    auto hashes = shapeOf6(shape);
+    auto &set = hashes.byshape[shape];
+    set.freeze(6, shape);
+    FlatCache fc(hashes, 6);
+    EXPECT_EQ(fc.size(), set.size());
+    for (uint32_t i = 0; i < fc.numShapes(); ++i) {
+        auto range = fc.getCubesByShape(i);
+        if (range.shape() == shape)
+            EXPECT_EQ(range.data(), set.frozen->data());
+        else
+            EXPECT_EQ(range.size(), 0);
+    }
+
+    // written as they are, sorted
+    std::vector<XYZ> shapes;
+    for (auto &[s, unused] : hashes.byshape) shapes.push_back(s);
+    {
+        CacheWriter writer;
+        ASSERT_TRUE(writer.open("./temp_frozen.bin", 6, shapes));
+        writer.writeShape(shape, set);
+    }
+    CacheReader cr;
+    ASSERT_EQ(cr.loadFile("./temp_frozen.bin"), 0);
+    EXPECT_EQ(cr.size(), set.size());
+    for (uint32_t i = 0; i < cr.numShapes(); ++i) {
+        auto range = cr.getCubesByShape(i);
+        if (range.shape() != shape) continue;
+        EXPECT_EQ(std::memcmp(range.data(), set.frozen->data(), range.bytes()), 0);
+    }
+    cr.unload();
+    std::remove("./temp_frozen.bin");
+}
+
+TEST(FrozenShapeTests, TestFlatCacheFreezesOpenShapes) {
+    const XYZ shape(1, 1, 2);
+    auto hashes = shapeOf6(shape);
+    const uint64_t size = hashes.size();
+    auto &set = hashes.byshape[shape];
+    const FrozenShape sorted(set.sets(), 6, shape);
+    FlatCache fc(hashes, 6, 4);
+    EXPECT_EQ(fc.size(), size);
+    // the shape is frozen and referred to, not copied
+    ASSERT_TRUE(set.frozen);
+    for (uint32_t i = 0; i < fc.numShapes(); ++i) {
+        auto range = fc.getCubesByShape(i);
+        if (range.shape() != shape) continue;
+        EXPECT_EQ(range.data(), set.frozen->data());
+        ASSERT_EQ(range.size(), sorted.size());
+        EXPECT_EQ(std::memcmp(range.data(), sorted.data(), range.bytes()), 0);
+    }
+}
@@ -0,0 +1,19 @@
+#include <gtest/gtest.h>
+
+#include "cubes.hpp"
+#include "gpuExpand.hpp"
+
+// the gpu finds the same polycubes as the cpu, with sets and hashless
+TEST(GpuExpandTests, TestGpuMatchesCpu) {
+    if (!GpuExpander::open(8)) GTEST_SKIP() << "built without -DCUBES_CUDA=ON or no gpu";
+    GenOptions opts;
+    opts.base_path = "./";
+    opts.threads = 2;
+    opts.gpu = true;
+    auto fc = gen(8, opts);
+    EXPECT_EQ(fc.size(), 6922);
+    opts.hashless = true;
+    gen(8, opts);
+    opts.count_only = true;
+    gen(8, opts);
+}
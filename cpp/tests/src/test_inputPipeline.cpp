@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "cacheWriter.hpp"
+#include "hashes.hpp"
+#include "inputPipeline.hpp"
+#include "newCache.hpp"
+
+// 25 cubes of 3 points in the box [2 2 2], enough for a few blocks of every size
+static void writeTestFile(const std::string &path) {
+    Hashy hashes;
+    hashes.init(3);
+    const XYZ shape(2, 2, 2);
+    for (int x = 0; x <= 2; ++x)
+        for (int y = 0; y <= 2; ++y)
+            for (int z = 0; z <= 2; ++z) {
+                const XYZ p(x, y, z);
+                if (p == XYZ(0, 0, 0) || p == shape) continue;
+                hashes.insert(Cube{XYZ(0, 0, 0), p, shape}, shape);
+            }
+    CacheWriter writer;
+    writer.open(path, 3, {shape}, false);
+    writer.writeShape(shape, hashes.byshape[shape]);
+    writer.close();
+}
+
+static std::vector<XYZ> points(ShapeRange range) {
+    std::vector<XYZ> out;
+    for (const auto c : range) out.insert(out.end(), c.begin(), c.end());
+    return out;
+}
+
+static void streamAndCheck(const std::string &path, bool direct) {
+    writeTestFile(path);
+    CacheReader cr;
+    ASSERT_EQ(cr.loadFile(path), 0);
+    auto range = cr.getCubesByShape(0);
+    ASSERT_EQ(range.size(), 25);
+    const auto expected = points(range);
+
+    // blocks of 4 cubes and only two buffers, so they have to be reused
+    BlockStream stream(path, 4 * 3 * sizeof(XYZ) + 5, 2, direct);
+    ASSERT_TRUE(stream.isOpen());
+    std::vector<XYZ> got;
+    std::function<void()> held;
+    int blocks = 0;
+    stream.read(cr.shapeOffset(0), range.bytes(), 3, range.shape(), [&](ShapeRange block, std::function<void()> release) {
+        EXPECT_LE(block.size(), 4);
+        EXPECT_EQ(block.shape(), XYZ(2, 2, 2));
+        auto p = points(block);
+        got.insert(got.end(), p.begin(), p.end());
+        // keep one block while the next one is read
+        if (held) held();
+        held = release;
+        blocks++;
+    });
+    if (held) held();
+    EXPECT_EQ(blocks, 7);
+    EXPECT_EQ(got, expected);
+}
+
+TEST(InputPipelineTests, TestStreamedBlocksHaveAllCubes) { streamAndCheck("./temp_stream.bin", false); }
+
+TEST(InputPipelineTests, TestDirectStreamedBlocksHaveAllCubes) { streamAndCheck("./temp_stream_direct.bin", true); }
+
+TEST(InputPipelineTests, TestReadaheadKeepsData) {
+    writeTestFile("./temp_readahead.bin");
+    CacheReader cr;
+    ASSERT_EQ(cr.loadFile("./temp_readahead.bin"), 0);
+    auto range = cr.getCubesByShape(0);
+    const auto expected = points(range);
+    {
+        Readahead readahead(4096, 4096, true);
+        // the same input shape for two targets, the second one is still queued when the first is done
+        auto first = readahead.queue(range);
+        auto second = readahead.queue(range);
+        readahead.consumed(range.bytes());
+        readahead.done(first);
+        EXPECT_EQ(points(range), expected);
+        readahead.consumed(range.bytes());
+        readahead.done(second);
+    }
+    // dropped pages are read again from the page cache
+    EXPECT_EQ(points(range), expected);
+}
@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "cubes.hpp"
+#include "memoryBudget.hpp"
+
+TEST(MemoryBudgetTests, TestPressure) {
+    EXPECT_GT(MemoryBudget::detectLimit(), 0);
+    EXPECT_GT(MemoryBudget::resident(), 0);
+    // the process alone is more than a MiB
+    MemoryBudget tight(1 << 20);
+    EXPECT_EQ(tight.pressure(), MemoryBudget::Pressure::Critical);
+    EXPECT_EQ(tight.headroom(), 0);
+    EXPECT_FALSE(tight.fits(0));
+    MemoryBudget roomy(uint64_t(1) << 50);
+    EXPECT_EQ(roomy.pressure(), MemoryBudget::Pressure::Low);
+    EXPECT_TRUE(roomy.fits(1 << 30));
+    EXPECT_LT(MemoryBudget::estimateSets(8, 6922), MemoryBudget::estimateSets(9, 48311));
+}
+
+// over the budget the finished shapes go to split cache files, together they are all of N
+TEST(MemoryBudgetTests, TestSpillsFinishedShapes) {
+    const std::string folder = "./temp_budget/";
+    std::filesystem::remove_all(folder);
+    GenOptions opts;
+    opts.base_path = folder;
+    opts.threads = 2;
+    opts.mem_budget = 1;
+    auto fc = gen(8, opts);
+    EXPECT_LT(fc.size(), 6922);
+    uint64_t spilled = 0;
+    for (auto shape : Hashy::generateShapes(8)) {
+        const auto file = folder + "cubes_8_" + std::to_string(shape.x()) + "-" + std::to_string(shape.y()) + "-" + std::to_string(shape.z()) + ".bin";
+        if (!std::filesystem::exists(file)) continue;
+        CacheReader cr;
+        ASSERT_EQ(cr.loadFile(file), 0);
+        spilled += cr.size();
+        cr.unload();
+    }
+    EXPECT_EQ(fc.size() + spilled, 6922);
+    // N - 1 did not fit next to N and went through its cache file
+    EXPECT_TRUE(std::filesystem::exists(folder + "cubes_7.bin"));
+    std::filesystem::remove_all(folder);
+}
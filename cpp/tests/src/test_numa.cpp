@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+#include "hashes.hpp"
+#include "numa.hpp"
+#include "workPool.hpp"
+
+TEST(NumaTests, TestParseCpuList) {
+    EXPECT_EQ(NumaTopology::parseCpuList("0-3,8,10-11\n"), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(NumaTopology::parseCpuList("5"), (std::vector<int>{5}));
+    EXPECT_TRUE(NumaTopology::parseCpuList("").empty());
+}
+
+TEST(NumaTests, TestDetectFindsCpus) {
+    auto numa = NumaTopology::detect();
+    ASSERT_GE(numa.nodes(), 1);
+    for (int i = 0; i < numa.nodes(); ++i) EXPECT_FALSE(numa.cpus(i).empty());
+}
+
+// two nodes sharing the first cpu, so it runs on any machine
+static NumaTopology twoNodes() {
+    const int cpu = NumaTopology().cpus(0)[0];
+    return NumaTopology({{cpu}, {cpu}});
+}
+
+TEST(NumaTests, TestPoolSplitsJobsByNode) {
+    auto numa = twoNodes();
+    WorkPool pool(4, &numa);
+    EXPECT_EQ(pool.node(0), 0);
+    EXPECT_EQ(pool.node(1), 0);
+    EXPECT_EQ(pool.node(2), 1);
+    EXPECT_EQ(pool.node(3), 1);
+    std::vector<std::atomic<int>> hits(10000);
+    std::atomic<int> done = 0;
+    pool.submit(
+        hits.size(),
+        [&hits](size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; ++i) hits[i]++;
+        },
+        [&done]() { done++; });
+    pool.submit(3, [&hits](size_t, size_t, int) {});
+    pool.wait();
+    for (auto &h : hits) EXPECT_EQ(h, 1);
+    EXPECT_EQ(done, 1);
+}
+
+TEST(NumaTests, TestRoutedInsertsReachTheirSets) {
+    // worker 0 on node 0, 1 on node 1
+    InsertRouter router(2, {0, 1});
+    Hashy direct, routed;
+    const XYZ shape(2, 2, 2);
+    direct.byshape.try_emplace(shape, 3);
+    routed.byshape.try_emplace(shape, 3);
+    auto &set = routed.byshape.at(shape);
+    std::atomic<int> pending = 0;
+    uint64_t duplicates = 0;
+    // every cube twice, once from each worker
+    for (int round = 0; round < 2; ++round)
+        for (int x = 0; x <= 2; ++x)
+            for (int y = 0; y <= 2; ++y)
+                for (int z = 0; z <= 2; ++z) {
+                    const XYZ p(x, y, z);
+                    if (p == XYZ(0, 0, 0) || p == shape) continue;
+                    uint64_t key[MAX_PACKED_WORDS];
+                    Cube c{XYZ(0, 0, 0), p, shape};
+                    packXYZs(c.data(), 3, key);
+                    direct.insert(c, shape);
+                    duplicates += router.insert(round, set, key, 3, pending);
+                }
+    router.flush(0);
+    router.flush(1);
+    duplicates += router.drain(1);
+    duplicates += router.finish(pending);
+    EXPECT_EQ(pending, 0);
+    EXPECT_EQ(routed.size(), 25);
+    EXPECT_EQ(duplicates, 25);
+    // the same cubes in the same shards
+    for (size_t i = 0; i < set.byhash.size(); ++i) EXPECT_EQ(set.byhash[i].size(), direct.byshape.at(shape).byhash[i].size());
+}
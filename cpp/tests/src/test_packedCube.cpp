@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "packedCube.hpp"
+
+TEST(PackedCubeTests, TestCoordBits) {
+    EXPECT_EQ(packedCoordBits(1), 1);
+    EXPECT_EQ(packedCoordBits(16), 4);
+    EXPECT_EQ(packedCoordBits(17), 5);
+    EXPECT_EQ(packedWords(16), 3);
+    EXPECT_EQ(sizeof(PackedCube<16>), 24);
+}
+
+TEST(PackedCubeTests, TestPackUnpackRoundtrip) {
+    // a line uses the largest coordinates possible
+    Cube line(16);
+    for (int i = 0; i < 16; ++i) line.data()[i] = XYZ(0, i / 2, 15 - i);
+    std::sort(line.begin(), line.end());
+    PackedCube<16> packed(line);
+    EXPECT_EQ(packed.toCube(), line);
+}
+
+TEST(PackedCubeTests, TestOrderMatchesCube) {
+    std::vector<Cube> cubes;
+    for (int8_t a = 0; a < 4; ++a)
+        for (int8_t b = 0; b < 4; ++b)
+            for (int8_t c = 0; c < 4; ++c) {
+                Cube cube = {XYZ(0, a, b), XYZ(c, 1, 3), XYZ(3, b, a), XYZ(1, c, 2)};
+                std::sort(cube.begin(), cube.end());
+                cubes.push_back(cube);
+            }
+    for (auto &a : cubes)
+        for (auto &b : cubes) {
+            PackedCube<4> pa(a), pb(b);
+            EXPECT_EQ(a < b, pa < pb);
+            EXPECT_EQ(a == b, pa == pb);
+            if (a == b) {
+                EXPECT_EQ(pa.hash(), pb.hash());
+            }
+        }
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include "canonical.hpp"
+#include "pcube.hpp"
+
+TEST(PCubeTests, TestEncodeDecodeRoundtrip) {
+    XYZ points[] = {XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 1), XYZ(1, 1, 1), XYZ(1, 1, 2)};
+    XYZ shape(1, 1, 2);
+    std::vector<uint8_t> record(PCube::recordSize(shape));
+    ASSERT_EQ(record.size(), 3 + 2);  // 12 bits
+    PCube::encode(points, 5, shape, record.data());
+    EXPECT_EQ(record[0], 2);
+    EXPECT_EQ(record[1], 2);
+    EXPECT_EQ(record[2], 3);
+    // bit index is (x * 2 + y) * 3 + z, least significant bit first
+    EXPECT_EQ(record[3], 0b00010011);
+    EXPECT_EQ(record[4], 0b00001100);
+
+    XYZ decoded[5];
+    EXPECT_EQ(PCube::decode(record.data(), 5, decoded), shape);
+    for (int i = 0; i < 5; ++i) EXPECT_EQ(decoded[i], points[i]);
+    EXPECT_EQ(PCube::decode(record.data(), 4, decoded), XYZ(-1, -1, -1));
+}
+
+// both 3-cubes in canonical form, so the sequential reader finds the same ones
+static Hashy testHashes() {
+    Hashy hashes;
+    hashes.init(3);
+    for (auto c : {Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 0)}, Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)}}) {
+        XYZ shape(0, 0, 0);
+        for (auto p : c) shape = XYZ(std::max(shape.x(), p.x()), std::max(shape.y(), p.y()), std::max(shape.z(), p.z()));
+        Cube canonical = c;
+        shape = Canonical::canonicalize(c.data(), 3, shape, canonical.data());
+        hashes.insert(canonical, shape);
+    }
+    return hashes;
+}
+
+static void writeAndLoad(const std::string &path, PCube::Compression compression) {
+    auto hashes = testHashes();
+    std::vector<XYZ> shapes;
+    for (auto &[shape, set] : hashes.byshape) shapes.push_back(shape);
+    {
+        PCubeWriter writer;
+        ASSERT_TRUE(writer.open(path, 3, shapes, compression));
+        // shapes go out in any order
+        for (auto it = shapes.rbegin(); it != shapes.rend(); ++it) writer.writeShape(*it, hashes.byshape[*it]);
+    }
+    FlatCache fc;
+    ASSERT_TRUE(PCube::load(path, 3, 2, fc));
+    ASSERT_EQ(fc.numShapes(), shapes.size());
+    for (uint32_t i = 0; i < shapes.size(); ++i) {
+        auto range = fc.getCubesByShape(i);
+        EXPECT_EQ(range.shape(), shapes[i]);
+        ASSERT_EQ(range.size(), 1);
+        Cube c = *range.begin();
+        Cube again = c;
+        EXPECT_EQ(Canonical::canonicalize(c.data(), 3, shapes[i], again.data()), shapes[i]);
+        EXPECT_EQ(again, c);
+    }
+}
+
+// gzip with the block index, inflated per block
+TEST(PCubeTests, TestIndexedFileLoads) { writeAndLoad("./temp_indexed.pcube", PCube::GZIP); }
+
+// no compression has no index and goes through the sequential reader
+TEST(PCubeTests, TestUncompressedFileLoads) { writeAndLoad("./temp_plain.pcube", PCube::NONE); }
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+
+#include "progress.hpp"
+
+TEST(ProgressTests, TestFinalLineHasTotals) {
+    const std::string path = "./temp_progress.jsonl";
+    std::remove(path.c_str());
+    Hashy hashes;
+    hashes.init(3);
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)}, XYZ(0, 0, 2));
+    {
+        Progress progress(3, 2, &hashes);
+        ASSERT_TRUE(progress.start(path, 60));
+        auto pair = progress.addPair(XYZ(0, 0, 1), XYZ(0, 0, 2), 4);
+        pair->advance(3);
+        Progress::Counters::add(progress.worker(0).parents, 2);
+        Progress::Counters::add(progress.worker(1).parents, 1);
+        Progress::Counters::add(progress.worker(1).inserts, 5);
+        Progress::Counters::add(progress.worker(1).duplicates, 4);
+        progress.stop();
+    }
+    std::ifstream in(path);
+    std::string line, extra;
+    ASSERT_TRUE(std::getline(in, line));
+    EXPECT_FALSE(std::getline(in, extra));
+    EXPECT_NE(line.find("\"final\": true"), std::string::npos);
+    EXPECT_NE(line.find("\"parents\": 3,"), std::string::npos);
+    EXPECT_NE(line.find("\"inserts\": 5,"), std::string::npos);
+    EXPECT_NE(line.find("\"duplicates\": 4,"), std::string::npos);
+    EXPECT_NE(line.find("\"expanded\": 3, \"queued\": 4,"), std::string::npos);
+    EXPECT_NE(line.find("\"stored\": 1,"), std::string::npos);
+    // the unfinished pair is listed
+    EXPECT_NE(line.find("\"shape\": [0, 0, 1], \"target\": [0, 0, 2], \"done\": 3, \"size\": 4"), std::string::npos);
+    std::remove(path.c_str());
+}
+
+// frozen shapes are counted apart, the load factor is the one of the live tables
+TEST(ProgressTests, TestFrozenShapesAreSeparate) {
+    const std::string path = "./temp_progress_frozen.jsonl";
+    std::remove(path.c_str());
+    Hashy hashes;
+    hashes.init(3);
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)}, XYZ(0, 0, 2));
+    hashes.byshape[XYZ(0, 0, 2)].freeze(3, XYZ(0, 0, 2));
+    {
+        Progress progress(3, 1, &hashes);
+        ASSERT_TRUE(progress.start(path, 60));
+        progress.stop();
+    }
+    std::ifstream in(path);
+    std::string line;
+    ASSERT_TRUE(std::getline(in, line));
+    EXPECT_NE(line.find("\"stored\": 1,"), std::string::npos);
+    EXPECT_NE(line.find("\"load_factor\": 0.000,"), std::string::npos);
+    EXPECT_NE(line.find("\"frozen\": 1, \"frozen_bytes\": 9,"), std::string::npos);
+    std::remove(path.c_str());
+}
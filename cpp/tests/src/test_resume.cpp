@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "resume.hpp"
+
+TEST(ResumeTests, TestSnapshotsLoadBack) {
+    const std::string dir = "./temp_resume/";
+    std::filesystem::remove_all(dir);
+    auto pairs = shapePairs(3);
+    Hashy hashes;
+    hashes.init(3);
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 1, 1)}, XYZ(0, 1, 1));
+    hashes.insert(Cube{XYZ(0, 0, 0), XYZ(0, 0, 1), XYZ(0, 0, 2)}, XYZ(0, 0, 2));
+    bool dropped = false;
+    {
+        ResumeWriter writer(dir, 3, hashes, pairs, {});
+        writer.pairDone(pairs[0].target, 0, 5);
+        writer.pairDone(pairs[1].target, 1, 7);
+        writer.targetDone(pairs[1].target, [&dropped]() { dropped = true; });
+        writer.flush();
+        EXPECT_TRUE(dropped);
+    }
+
+    Hashy loaded;
+    loaded.init(3);
+    std::map<uint32_t, uint64_t> done;
+    ASSERT_TRUE(ResumeWriter::load(dir, 3, loaded, done));
+    EXPECT_EQ(done, (std::map<uint32_t, uint64_t>{{0, 5}, {1, 7}}));
+    EXPECT_EQ(loaded.byshape[pairs[0].target].size(), hashes.byshape[pairs[0].target].size());
+    EXPECT_EQ(loaded.byshape[pairs[1].target].size(), hashes.byshape[pairs[1].target].size());
+
+    // a later snapshot of a shape keeps the pairs loaded before
+    ResumeWriter writer(dir, 3, loaded, pairs, done);
+    writer.pairDone(pairs[0].target, 2, 0);
+    writer.flush();
+    Hashy again;
+    again.init(3);
+    done.clear();
+    ASSERT_TRUE(ResumeWriter::load(dir, 3, again, done));
+    EXPECT_EQ(done.size(), 3);
+    writer.remove();
+    EXPECT_FALSE(std::filesystem::exists(dir));
+    EXPECT_FALSE(ResumeWriter::load(dir, 3, again, done));
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "canonical.hpp"
 #include "rotations.hpp"
 
 TEST(RotationsTests, TestRotateDoesNotThrow) {
@@ -55,3 +56,32 @@ TEST(RotationsTests, TestRotationsMatchesExpectation) {
         }
     }
 }
+
+// the functors do what reading LUT at runtime did, for every rotation and point of a shape
+TEST(RotationsTests, TestFunctorsMatchLUT) {
+    const XYZ shape(2, 3, 3);
+    Cube all(3 * 4 * 4);
+    auto put = all.begin();
+    for (int x = 0; x <= shape.x(); ++x)
+        for (int y = 0; y <= shape.y(); ++y)
+            for (int z = 0; z <= shape.z(); ++z) *put++ = XYZ(x, y, z);
+    int checked = 0;
+    Rotations::forEach([&](auto r) {
+        using R = Rotations::Rotation<decltype(r)::value>;
+        const auto &L = Rotations::LUT[r];
+        const auto &K = Canonical::ROTATION_KEYS;
+        const int32_t off = shape.x() * K.offx[r] + shape.y() * K.offy[r] + shape.z() * K.offz[r];
+        for (const auto &p : all) {
+            XYZ expected;
+            for (int d = 0; d < 3; ++d) expected[d] = L[3 + d] < 0 ? shape[L[d]] - p[L[d]] : p[L[d]];
+            EXPECT_EQ(R::apply(shape, p), expected);
+            EXPECT_EQ(R::key(shape, p), p.x() * K.mx[r] + p.y() * K.my[r] + p.z() * K.mz[r] + off);
+        }
+        Cube rotated(all.size());
+        auto [res, ok] = Rotations::rotate(r, shape, all, rotated);
+        EXPECT_EQ(res, XYZ(shape[L[0]], shape[L[1]], shape[L[2]]));
+        EXPECT_EQ(ok, (Canonical::validRotations(shape) >> r) & 1);
+        checked++;
+    });
+    EXPECT_EQ(checked, 24);
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "hashes.hpp"
+#include "shapeSchedule.hpp"
+
+// the pairs as found by comparing every input shape with every output shape
+static std::vector<ShapePair> scannedPairs(int n) {
+    std::vector<ShapePair> pairs;
+    auto outShapes = Hashy::generateShapes(n);
+    std::sort(outShapes.begin(), outShapes.end());
+    auto prevShapes = Hashy::generateShapes(n - 1);
+    for (auto targetShape : outShapes) {
+        for (uint32_t sid = 0; sid < prevShapes.size(); ++sid) {
+            auto &shape = prevShapes[sid];
+            int diffx = targetShape.x() - shape.x();
+            int diffy = targetShape.y() - shape.y();
+            int diffz = targetShape.z() - shape.z();
+            int abssum = abs(diffx) + abs(diffy) + abs(diffz);
+            if (abssum > 1 || diffx < 0 || diffy < 0 || diffz < 0) continue;
+            if (diffz == 1 && shape.z() == shape.y()) diffy = 1;
+            if (diffy == 1 && shape.y() == shape.x()) diffx = 1;
+            pairs.push_back({targetShape, sid, shape, XYZ(diffx, diffy, diffz), abssum != 0});
+        }
+    }
+    return pairs;
+}
+
+// about the number of cubes of every input shape, larger for more compact shapes
+static std::vector<uint64_t> volumes(int n) {
+    std::vector<uint64_t> weights;
+    for (auto s : Hashy::generateShapes(n - 1)) weights.push_back((uint64_t)(s.x() + 1) * (s.y() + 1) * (s.z() + 1));
+    return weights;
+}
+
+static std::vector<uint32_t> allPairs(size_t count) {
+    std::vector<uint32_t> ids(count);
+    std::iota(ids.begin(), ids.end(), 0);
+    return ids;
+}
+
+TEST(ShapeScheduleTests, TestPairsAreTheNeighbours) {
+    for (int n = 2; n <= 16; ++n) {
+        auto pairs = shapePairs(n), scanned = scannedPairs(n);
+        ASSERT_EQ(pairs.size(), scanned.size());
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            EXPECT_EQ(pairs[i].target, scanned[i].target);
+            EXPECT_EQ(pairs[i].sid, scanned[i].sid);
+            EXPECT_EQ(pairs[i].expandDim, scanned[i].expandDim);
+            EXPECT_EQ(pairs[i].notSameShape, scanned[i].notSameShape);
+        }
+    }
+}
+
+TEST(ShapeScheduleTests, TestEveryPairOnce) {
+    const int n = 12;
+    auto pairs = shapePairs(n);
+    // every third pair is done already
+    std::vector<uint32_t> todo;
+    for (uint32_t pi = 0; pi < pairs.size(); ++pi)
+        if (pi % 3) todo.push_back(pi);
+    for (bool freeEarly : {false, true}) {
+        ShapeSchedule schedule(pairs, todo, volumes(n), freeEarly);
+        auto order = schedule.order();
+        std::sort(order.begin(), order.end());
+        EXPECT_EQ(order, todo);
+        uint32_t users = 0;
+        for (uint32_t sid = 0; sid < Hashy::generateShapes(n - 1).size(); ++sid) users += schedule.users(sid);
+        EXPECT_EQ(users, todo.size());
+    }
+}
+
+TEST(ShapeScheduleTests, TestLargestFirst) {
+    const int n = 10;
+    auto pairs = shapePairs(n);
+    auto weights = volumes(n);
+    ShapeSchedule schedule(pairs, allPairs(pairs.size()), weights, false);
+    auto &order = schedule.order();
+    for (size_t i = 1; i < order.size(); ++i) EXPECT_GE(weights[pairs[order[i - 1]].sid], weights[pairs[order[i]].sid]);
+}
+
+TEST(ShapeScheduleTests, TestFreeEarlyKeepsFewerInputs) {
+    for (int n = 8; n <= 16; ++n) {
+        auto pairs = shapePairs(n);
+        auto weights = volumes(n);
+        auto byTarget = allPairs(pairs.size());
+        ShapeSchedule schedule(pairs, byTarget, weights, true);
+        EXPECT_LE(schedule.peak(), ShapeSchedule::peak(pairs, byTarget, weights)) << "n = " << n;
+        // the pairs of an output shape stay together
+        std::vector<XYZ> seen;
+        for (size_t i = 0; i < schedule.order().size(); ++i) {
+            const XYZ target = pairs[schedule.order()[i]].target;
+            if (i > 0 && target == pairs[schedule.order()[i - 1]].target) continue;
+            EXPECT_EQ(std::count(seen.begin(), seen.end(), target), 0);
+            seen.push_back(target);
+        }
+    }
+}
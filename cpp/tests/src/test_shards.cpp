@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "shards.hpp"
+
+// empty N-1 cache with count cubes for every input shape
+static FlatCache baseCache(int n, uint64_t count) {
+    auto shapes = Hashy::generateShapes(n - 1);
+    return FlatCache(n - 1, shapes, std::vector<uint64_t>(shapes.size(), count));
+}
+
+TEST(ShardTests, TestPairsAreGroupedByTarget) {
+    auto pairs = shapePairs(6);
+    ASSERT_FALSE(pairs.empty());
+    for (size_t i = 1; i < pairs.size(); ++i) EXPECT_FALSE(pairs[i].target < pairs[i - 1].target);
+    auto prevShapes = Hashy::generateShapes(5);
+    for (auto &p : pairs) {
+        ASSERT_LT(p.sid, prevShapes.size());
+        EXPECT_EQ(p.shape, prevShapes[p.sid]);
+        int grown = (p.target.x() - p.shape.x()) + (p.target.y() - p.shape.y()) + (p.target.z() - p.shape.z());
+        EXPECT_EQ(grown, p.notSameShape ? 1 : 0);
+    }
+}
+
+TEST(ShardTests, TestShardsPartitionUnits) {
+    auto base = baseCache(7, 10);
+    ShardPlan plan(7, base, 4, false);
+    // every pair is cut into 0-4, 4-8 and 8-10
+    ASSERT_EQ(plan.units().size(), plan.pairs().size() * 3);
+    for (size_t i = 0; i < plan.units().size(); ++i) {
+        auto &u = plan.units()[i];
+        EXPECT_EQ(u.pair, i / 3);
+        EXPECT_EQ(u.begin, (i % 3) * 4);
+        EXPECT_EQ(u.end, std::min<uint64_t>(u.begin + 4, 10));
+    }
+
+    std::vector<int> hits(plan.units().size());
+    for (int i = 0; i < 3; ++i) {
+        std::vector<uint32_t> ids;
+        ASSERT_TRUE(plan.selectShard(std::to_string(i) + "/3", ids));
+        for (auto id : ids) hits[id]++;
+    }
+    for (auto h : hits) EXPECT_EQ(h, 1);
+
+    std::vector<uint32_t> ids;
+    EXPECT_FALSE(plan.selectShard("3/3", ids));
+    EXPECT_FALSE(plan.selectShard("1/3x", ids));
+    EXPECT_FALSE(plan.selectShard("1", ids));
+}
+
+TEST(ShardTests, TestUnitList) {
+    auto base = baseCache(6, 5);
+    ShardPlan plan(6, base, 5, false);
+    ASSERT_GT(plan.units().size(), 8);
+    {
+        std::ofstream out("./temp_units.txt");
+        out << "# first units\n5\n0 - 2\n\n7 # trailing comment\n1\n";
+    }
+    std::vector<uint32_t> ids;
+    ASSERT_TRUE(plan.selectList("./temp_units.txt", ids));
+    EXPECT_EQ(ids, (std::vector<uint32_t>{0, 1, 2, 5, 7}));
+    {
+        std::ofstream out("./temp_units.txt");
+        out << "0\n" << plan.units().size() << "\n";
+    }
+    EXPECT_FALSE(plan.selectList("./temp_units.txt", ids));
+}
+
+TEST(ShardTests, TestCheckpointResumes) {
+    auto base = baseCache(6, 5);
+    ShardPlan plan(6, base, 2, true);
+    const std::string path = "./temp_checkpoint.done";
+    std::remove(path.c_str());
+    {
+        Checkpoint cp;
+        ASSERT_TRUE(cp.open(path, plan));
+        EXPECT_TRUE(cp.finished().empty());
+        cp.record(3, 17);
+        cp.record(0, 4);
+    }
+    {
+        // a record cut off by a crash
+        std::ofstream out(path, std::ios::app);
+        out << "5 12";
+    }
+    Checkpoint cp;
+    ASSERT_TRUE(cp.open(path, plan));
+    EXPECT_TRUE(cp.done(0));
+    EXPECT_TRUE(cp.done(3));
+    EXPECT_FALSE(cp.done(5));
+    EXPECT_EQ(cp.finished().at(3), 17);
+
+    // same N, but units of a different size
+    ShardPlan other(6, base, 3, true);
+    std::map<uint32_t, uint64_t> finished;
+    EXPECT_FALSE(Checkpoint::read(path, other, finished));
+    Checkpoint otherCp;
+    EXPECT_FALSE(otherCp.open(path, other));
+}
+
+// -m takes the unit size from the checkpoints of the shards
+TEST(ShardTests, TestMergeFindsUnitSize) {
+    auto base = baseCache(6, 5);
+    const std::string folder = "./temp_shards/";
+    std::filesystem::remove_all(folder);
+    std::filesystem::create_directories(folder);
+    EXPECT_EQ(shardUnitSize(folder, 6), 0);
+    ShardPlan plan(6, base, 3, true);
+    {
+        Checkpoint cp;
+        ASSERT_TRUE(cp.open(plan.checkpointFile(folder, "0/2", ""), plan));
+    }
+    EXPECT_EQ(shardUnitSize(folder, 6), 3);
+    EXPECT_EQ(shardUnitSize(folder, 7), 0);
+    std::filesystem::remove_all(folder);
+}
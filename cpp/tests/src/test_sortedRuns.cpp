@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "sortedRuns.hpp"
+
+// merge count records with duplicates from two workers and compare with sorting all of them
+static void mergeAndCheck(SortedRuns::Budget &budget, size_t count, int threads) {
+    const std::string folder = "./temp_runs/";
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> all;
+    {
+        // 4 cubes pack into one word, the records do not have to be polycubes
+        SortedRuns runs(4, XYZ(0, 1, 1), 2, budget, folder);
+        std::vector<uint64_t> batch;
+        for (size_t i = 0; i < count; ++i) {
+            // about every third record twice
+            uint64_t v = rng() % (count / 3 * 2);
+            batch.push_back(v);
+            all.push_back(v);
+            if (batch.size() == 1000) {
+                runs.add(i % 2, batch.data(), batch.size());
+                batch.clear();
+            }
+        }
+        runs.add(0, batch.data(), batch.size());
+        std::vector<uint64_t> merged;
+        uint64_t n = runs.merge([&merged](const uint64_t *w) { merged.push_back(*w); }, threads);
+        std::sort(all.begin(), all.end());
+        all.erase(std::unique(all.begin(), all.end()), all.end());
+        EXPECT_EQ(n, all.size());
+        EXPECT_EQ(merged, all);
+    }
+    // the run files go with the runs
+    EXPECT_TRUE(!std::filesystem::exists(folder) || std::filesystem::is_empty(folder));
+    std::filesystem::remove_all(folder);
+    EXPECT_EQ(budget.used, 0);
+}
+
+TEST(SortedRunsTests, TestSortUnique) {
+    std::vector<uint64_t> records = {3, 1, 0, 2, 1, 9, 0, 2, 3, 1};
+    // two words per record: (3 1) (0 2) (1 9) (0 2) (3 1)
+    EXPECT_EQ(SortedRuns::sortUnique(records.data(), 5, 2), 3);
+    records.resize(6);
+    EXPECT_EQ(records, (std::vector<uint64_t>{0, 2, 1, 9, 3, 1}));
+}
+
+TEST(SortedRunsTests, TestMergeInMemory) {
+    SortedRuns::Budget budget;
+    mergeAndCheck(budget, 30000, 1);
+    EXPECT_EQ(budget.spilled, 0);
+}
+
+TEST(SortedRunsTests, TestMergeSpilledRuns) {
+    SortedRuns::Budget budget;
+    budget.limit = 1;  // every run goes to disk
+    mergeAndCheck(budget, 100000, 1);
+    EXPECT_GT(budget.spilled, 0);
+}
+
+TEST(SortedRunsTests, TestParallelMerge) {
+    SortedRuns::Budget budget;
+    mergeAndCheck(budget, 3 * SortedRuns::PARALLEL_MERGE, 3);
+}
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+#include "workPool.hpp"
+
+TEST(WorkPoolTests, TestEveryItemRunsOnce) {
+    WorkPool pool(4);
+    const std::vector<size_t> sizes = {0, 1, 7, 100, 10000, 3};
+    std::vector<std::vector<std::atomic<int>>> hits;
+    for (auto s : sizes) hits.emplace_back(s);
+    for (size_t j = 0; j < sizes.size(); ++j) {
+        pool.submit(sizes[j], [&hits, j](size_t begin, size_t end, int worker) {
+            EXPECT_LT(begin, end);
+            EXPECT_GE(worker, 0);
+            EXPECT_LT(worker, 4);
+            for (size_t i = begin; i < end; ++i) hits[j][i]++;
+        });
+    }
+    pool.wait();
+    for (auto &job : hits)
+        for (auto &h : job) EXPECT_EQ(h, 1);
+}
+
+TEST(WorkPoolTests, TestWaitCanBeRepeated) {
+    WorkPool pool(3);
+    std::atomic<size_t> sum = 0;
+    for (int round = 1; round <= 5; ++round) {
+        pool.submit(1000, [&sum](size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; ++i) sum += i;
+        });
+        pool.wait();
+        EXPECT_EQ(sum, round * (999 * 1000 / 2));
+    }
+    pool.wait();  // nothing queued
+}